@@ -0,0 +1,60 @@
+#[[
+    LibConfCompile.cmake - contains functions to compile configuration files
+    Copyright 2022 The NexNix Project
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    There should be a copy of the License distributed in a file named
+    LICENSE, if not, you may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License
+]]
+
+# Compiles a configuration file into a target with confc. NAME.c and NAME.h are
+# written to the current binary directory, and NAME.h declares the view NAME.
+# confc runs in WORKDIR, which defaults to the directory of SOURCE, so that
+# includes are found. Included files must be listed in DEPENDS to be tracked
+function(libconf_compile_config)
+    # Read in the arguments
+    cmake_parse_arguments(__CONFARG ""
+                          "TARGET;NAME;SOURCE;WORKDIR;CONFC"
+                          "DEPENDS" ${ARGN})
+    if(NOT __CONFARG_TARGET OR NOT __CONFARG_NAME OR NOT __CONFARG_SOURCE)
+        message(FATAL_ERROR "Required argument missing")
+    endif()
+    get_filename_component(__CONFARG_SOURCE ${__CONFARG_SOURCE} ABSOLUTE)
+    if(NOT __CONFARG_WORKDIR)
+        get_filename_component(__CONFARG_WORKDIR ${__CONFARG_SOURCE} DIRECTORY)
+    endif()
+    # Figure out which confc to run
+    if(NOT __CONFARG_CONFC)
+        if(TARGET confc)
+            set(__CONFARG_CONFC confc)
+        elseif(TARGET LibConf::confc)
+            set(__CONFARG_CONFC LibConf::confc)
+        else()
+            find_program(LIBCONF_CONFC confc REQUIRED)
+            set(__CONFARG_CONFC ${LIBCONF_CONFC})
+        endif()
+    endif()
+    # Views are compiled again when a confc that is built here changes
+    if(TARGET ${__CONFARG_CONFC})
+        list(APPEND __CONFARG_DEPENDS ${__CONFARG_CONFC})
+    endif()
+    set(__CONFARG_OUTPUT ${CMAKE_CURRENT_BINARY_DIR}/${__CONFARG_NAME})
+    add_custom_command(OUTPUT ${__CONFARG_OUTPUT}.c ${__CONFARG_OUTPUT}.h
+                       COMMAND ${__CONFARG_CONFC} -n ${__CONFARG_NAME}
+                               -o ${__CONFARG_OUTPUT} ${__CONFARG_SOURCE}
+                       DEPENDS ${__CONFARG_SOURCE} ${__CONFARG_DEPENDS}
+                       WORKING_DIRECTORY ${__CONFARG_WORKDIR}
+                       COMMENT "Compiling configuration ${__CONFARG_NAME}"
+                       VERBATIM)
+    target_sources(${__CONFARG_TARGET} PRIVATE ${__CONFARG_OUTPUT}.c)
+    target_include_directories(${__CONFARG_TARGET} PRIVATE ${CMAKE_CURRENT_BINARY_DIR})
+endfunction()
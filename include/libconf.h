@@ -24,6 +24,14 @@
 #include <libnex/char32.h>
 #include <libnex/list.h>
 #include <libnex/stringref.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
 
 #define MAX_PROPVAR 16    // The maximum amount of values in a property
 
@@ -35,6 +43,7 @@
 typedef struct tagPropertyValue
 {
     int lineNo;    ///< The line number of this property value
+    int colNo;     ///< The column this property value starts at
     union          ///< The value of this property
     {
         StringRef32_t* id;     ///< An identifier
@@ -42,6 +51,7 @@ typedef struct tagPropertyValue
         int64_t numVal;        ///< ... or a number
     };
     int type;    ///< 0 = identifier, 1 = string, 2 = numeric
+    int base;    ///< Base a number was written in. 0 if it isn't known
 } ConfPropVal_t;
 
 /// A property. Properties are what define characteristics of what is being
@@ -49,6 +59,7 @@ typedef struct tagPropertyValue
 typedef struct tagProperty
 {
     int lineNo;             ///< The line number of this property declaration
+    int colNo;              ///< The column this property declaration starts at
     StringRef32_t* name;    ///< The property represented here
     ConfPropVal_t vals[MAX_PROPVAR];    ///< 64 comma seperated values
     int nextVal;                        ///< The next value to work with
@@ -64,13 +75,228 @@ typedef struct tagProperty
 typedef struct tagBlock
 {
     int lineNo;    ///< The line number of this block declaration in the source file
+    int colNo;     ///< The column this block declaration starts at
     StringRef32_t* blockType;    ///< What this block specifies
     StringRef32_t* blockName;    ///< The name of this block
     ListHead_t* props;    ///< The list of properties associated with this block
 } ConfBlock_t;
 
+/**
+ * @brief A block in a frozen parse tree
+ *
+ * The properties of this block are props[propStart] through
+ * props[propStart + numProps - 1] in the view
+ */
+typedef struct tagViewBlock
+{
+    int lineNo;                   ///< The line number of this block declaration
+    int colNo;                    ///< The column this block declaration starts at
+    const char32_t* blockType;    ///< What this block specifies
+    const char32_t* blockName;    ///< The name of this block. NULL if it has none
+    size_t propStart;             ///< Index of first property in the view
+    size_t numProps;              ///< Number of properties in this block
+} ConfViewBlock_t;
+
+/// A property in a frozen parse tree. Values are found like properties are
+typedef struct tagViewProperty
+{
+    int lineNo;              ///< The line number of this property declaration
+    int colNo;               ///< The column this property declaration starts at
+    const char32_t* name;    ///< The property represented here
+    size_t valStart;         ///< Index of first value in the view
+    size_t numVals;          ///< Number of values in this property
+} ConfViewProp_t;
+
+/// A property value in a frozen parse tree
+typedef struct tagViewValue
+{
+    int lineNo;    ///< The line number of this property value
+    int colNo;     ///< The column this property value starts at
+    int type;      ///< 0 = identifier, 1 = string, 2 = numeric
+    int base;      ///< Base a number was written in. 0 if it isn't known
+    union          ///< The value of this property
+    {
+        const char32_t* id;     ///< An identifier
+        const char32_t* str;    ///< ... or a string
+        int64_t numVal;         ///< ... or a number
+    };
+} ConfViewVal_t;
+
+/**
+ * @brief A frozen, read-only parse tree
+ *
+ * All blocks, properties, values and strings are laid out in contiguous
+ * arrays, so the tree can be walked with plain indices instead of chasing list
+ * entries. The view is self contained and does not reference the list it was
+ * created from
+ */
+typedef struct tagView
+{
+    const ConfViewBlock_t* blocks;    ///< Array of all blocks
+    size_t numBlocks;                 ///< Number of blocks
+    const ConfViewProp_t* props;      ///< Array of all properties
+    size_t numProps;                  ///< Number of properties
+    const ConfViewVal_t* vals;        ///< Array of all values
+    size_t numVals;                   ///< Number of values
+} ConfView_t;
+
+/**
+ * @brief A memory allocator
+ *
+ * Blocks are freed and reallocated with the size they were last allocated
+ * with, so allocators don't have to remember sizes themselves. Blocks must be
+ * aligned like malloc aligns them
+ */
+typedef struct tagConfAllocator
+{
+    void* (*alloc) (size_t sz, void* userData);    ///< Allocates a block
+    void* (*realloc) (void* ptr,
+                      size_t oldSz,
+                      size_t sz,
+                      void* userData);    ///< Resizes a block
+    void (*free) (void* ptr, size_t sz, void* userData);    ///< Frees a block
+    void* userData;    ///< Passed to every function
+} ConfAllocator_t;
+
+#define CONF_DIAG_UNEXPECTED_TOKEN  1     ///< Token that doesn't belong where it is
+#define CONF_DIAG_INTERNAL          2     ///< I/O or similar error, see detail
+#define CONF_DIAG_TOO_MANY_VALUES   3     ///< Too many values on a property
+#define CONF_DIAG_MISSING_SEMICOLON 4     ///< Property not ended with ';'
+#define CONF_DIAG_PROP_NO_BLOCK     5     ///< Property outside of a block
+#define CONF_DIAG_UNKNOWN_TOKEN     6     ///< Character value starts no token
+#define CONF_DIAG_UNEXPECTED_EOF    7     ///< File ends inside a token
+#define CONF_DIAG_INVALID_NUMBER    8     ///< Number that can't be read
+#define CONF_DIAG_TOO_LONG          9     ///< Name or string is too long
+#define CONF_DIAG_INVALID_VAR       10    ///< Bad character in a variable
+#define CONF_DIAG_UNTERMINATED      11    ///< File ends inside a block
+#define CONF_DIAG_BYTE_LIMIT        12    ///< ConfLimits_t::maxBytes was hit
+#define CONF_DIAG_TOKEN_LIMIT       13    ///< ConfLimits_t::maxTokens was hit
+#define CONF_DIAG_BLOCK_LIMIT       14    ///< ConfLimits_t::maxBlocks was hit
+#define CONF_DIAG_PROP_LIMIT        15    ///< ConfLimits_t::maxProps was hit
+#define CONF_DIAG_MEMORY_LIMIT      16    ///< ConfLimits_t::maxMemory was hit
+#define CONF_DIAG_DEPTH_LIMIT       17    ///< Includes nested too deep
+#define CONF_DIAG_CONFLICT          18    ///< Property set by two overlaid trees
+#define CONF_DIAG_UNKNOWN_PROPERTY  19    ///< Property a schema doesn't have
+#define CONF_DIAG_BAD_VALUE         20    ///< Value a schema can't convert
+
+/**
+ * @brief A problem found while parsing
+ *
+ * Token types are the ones named by ConfGetTokenName
+ */
+typedef struct tagConfDiag
+{
+    const char* file;      ///< File the problem is in
+    int line;              ///< Line it is on. 0 if it isn't on a line
+    int column;            ///< Column it is at, in characters. 0 if not known
+    int code;              ///< What the problem is. One of CONF_DIAG_*
+    int token;             ///< Type of token it is on. -1 if none
+    int prevToken;         ///< Type of token before that. -1 if none
+    int expected;          ///< Type of token expected instead. -1 if none
+    int64_t value;         ///< The limit that was hit, or the unknown character
+    const char* detail;    ///< Internal error, or property of schema errors
+} ConfDiag_t;
+
+/// A list of diagnostics. Zero-initialize it before use
+typedef struct tagConfDiagList
+{
+    ConfDiag_t* diags;    ///< Array of diagnostics, in the order they were found
+    size_t numDiags;      ///< Number of diagnostics
+    size_t maxDiags;      ///< Space in diags
+} ConfDiagList_t;
+
+#define CONF_MAX_INCLUDE_DEPTH 32    ///< Default limit on the nesting of includes
+
+/**
+ * @brief Limits on the resources a parse may use
+ *
+ * A parse that goes over a limit is stopped with a diagnostic, and no tree is
+ * returned. A limit of 0 means no limit. Limits apply to each file passed to
+ * ConfInitEx or ConfInitMany, together with everything it includes
+ */
+typedef struct tagConfLimits
+{
+    uint64_t maxBytes;      ///< Size of all files read
+    uint64_t maxTokens;     ///< Tokens parsed
+    uint64_t maxBlocks;     ///< Blocks in the tree
+    uint64_t maxProps;      ///< Properties in the tree
+    uint64_t maxMemory;     ///< Bytes allocated by libconf at once
+    int maxIncludeDepth;    ///< Nesting of includes. 0 = CONF_MAX_INCLUDE_DEPTH
+} ConfLimits_t;
+
+/**
+ * @brief Options that control how a configuration file is parsed
+ *
+ * A zero-initialized structure gives the same behavior as ConfInit. Relative
+ * include paths are looked for next to the including file, then in each of
+ * includeDirs in order, and then in the working directory
+ */
+typedef struct tagConfOptions
+{
+    const char32_t** blockTypes;     ///< Block types to parse. NULL = all blocks
+    size_t numBlockTypes;            ///< Number of entries in blockTypes
+    int lexThreads;                  ///< Threads to lex with. 0 or 1 is sequential
+    int parseThreads;                ///< Threads for ConfInitMany and includes of
+                                     ///< several files. 0 = one per CPU
+    const ConfAllocator_t* alloc;    ///< Allocator for the parse. NULL = malloc
+    const ConfLimits_t* limits;      ///< Limits on the parse. NULL = none
+    ConfDiagList_t* diags;           ///< Collects diagnostics. NULL prints them
+    bool recover;                    ///< Go on after errors, see ConfInitEx
+    const char** includeDirs;        ///< Directories to search for includes
+    size_t numIncludeDirs;           ///< Number of entries in includeDirs
+} ConfOptions_t;
+
+/**
+ * @brief Options that control how a parse tree is written
+ *
+ * A zero-initialized structure gives the default layout
+ */
+typedef struct tagConfWriteOptions
+{
+    int indent;        ///< Spaces to indent properties with. 0 = 4
+    bool canonical;    ///< Write equal trees as equal text, see ConfWrite
+} ConfWriteOptions_t;
+
+#define CONF_STATS_NUM_TOKENS 16    ///< Number of token types counted in ConfStats_t
+
+/**
+ * @brief Statistics about a parse
+ *
+ * Times are in nanoseconds. Statistics are only collected if libconf was built
+ * with LIBCONF_ENABLE_STATS
+ */
+typedef struct tagConfStats
+{
+    uint64_t totalNs;                          ///< Time spent in ConfInit
+    uint64_t detectNs;                         ///< Time detecting character sets
+    uint64_t decodeNs;                         ///< Time loading files into memory
+    uint64_t lexNs;                            ///< Time lexing and decoding streams
+    uint64_t parseNs;                          ///< Time building the parse tree
+    uint64_t includeNs;                        ///< Time in includes. Overlaps others
+    uint64_t teardownNs;                       ///< Time in ConfFreeParseTree
+    uint64_t bytesRead;                        ///< Size of all files read
+    uint64_t tokens[CONF_STATS_NUM_TOKENS];    ///< Tokens lexed, by type
+    uint64_t blocks;                           ///< Blocks parsed
+    uint64_t props;                            ///< Properties parsed
+    uint64_t includes;                         ///< Files included
+    uint64_t allocs;                           ///< Allocations made
+    uint64_t allocBytes;                       ///< Bytes allocated
+    uint64_t peakBytes;                        ///< Peak bytes in libconf buffers
+} ConfStats_t;
+
+#define CONF_OVERLAY_REPLACE 0    ///< Later trees replace properties of earlier ones
+#define CONF_OVERLAY_APPEND  1    ///< Later trees add values to earlier properties
+#define CONF_OVERLAY_ERROR   2    ///< Setting a property in two trees is an error
+
+/// A parser that input is pushed into as it arrives. See ConfParserCreate
+typedef struct tagConfParser ConfParser_t;
+
 /**
  * @brief Gets the name of the file being worked on
+ *
+ * This is the last file passed to ConfInit or ConfInitEx on the calling thread.
+ * Files parsed by ConfInitMany don't change it
+ *
  * @return The file name
  */
 LIBCONF_PUBLIC const char* ConfGetFileName (void);
@@ -83,9 +309,319 @@ LIBCONF_PUBLIC const char* ConfGetFileName (void);
  */
 LIBCONF_PUBLIC ListHead_t* ConfInit (const char* file);
 
+/**
+ * @brief Initializes configuration context with options
+ *
+ * Works like ConfInit, but allows the caller to control parsing. If
+ * opts->blockTypes is set, blocks of any other type are skipped over without
+ * being added to the parse tree. Includes are still followed
+ *
+ * If opts->alloc is set, the tree, its strings and all memory used while
+ * parsing come from it, except for the list entries and StringRef objects that
+ * libnex allocates. The allocator must outlive the tree
+ *
+ * If opts->recover is set, syntax errors don't stop the parse. The parser skips
+ * to the next ';' or '}' and goes on, and a lexer error stops only the file it
+ * is in. Everything parsed around the errors is returned, so the tree may be
+ * missing blocks or values. Set opts->diags to find out what went wrong.
+ * Internal errors and limits still stop the parse without a tree
+ *
+ * @param file the file to read configuration from
+ * @param opts the options to parse with. May be NULL
+ * @return The list of blocks
+ */
+LIBCONF_PUBLIC ListHead_t* ConfInitEx (const char* file, const ConfOptions_t* opts);
+
+/**
+ * @brief Parses several files at once
+ *
+ * The files are parsed concurrently on a pool of threads. Each file gets its
+ * own parse tree, as if it was passed to ConfInitEx. Character sets detected
+ * for files included by more than one file are shared between them. Nothing is
+ * cached between calls, so each call sees the files as they are when it runs.
+ * If opts->diags is set, diagnostics of all files go in it, in no certain order
+ *
+ * @param files the files to read configuration from
+ * @param count the number of files
+ * @param opts the options to parse with. May be NULL
+ * @return An array of count parse trees. Files that failed to parse have a NULL
+ * tree. Returns NULL if the array can't be allocated
+ */
+LIBCONF_PUBLIC ListHead_t** ConfInitMany (const char** files,
+                                          size_t count,
+                                          const ConfOptions_t* opts);
+
+/**
+ * @brief Creates a parser for input that arrives in pieces
+ *
+ * Input is passed to ConfParserFeed as it arrives, and is parsed as far as it
+ * goes. Only input that hasn't been parsed yet is kept, and blocks are added to
+ * the tree once their closing brace has arrived. Input must be UTF-8. Included
+ * files are read like ConfInitEx reads them. Options and limits work like they
+ * do for ConfInitEx, with the input counting as one file
+ *
+ * @param name the name to report diagnostics with
+ * @param opts the options to parse with. May be NULL. Must outlive the parser
+ * @return The parser, or NULL on error
+ */
+LIBCONF_PUBLIC ConfParser_t* ConfParserCreate (const char* name,
+                                               const ConfOptions_t* opts);
+
+/**
+ * @brief Passes input to a push parser
+ *
+ * Input may be split anywhere, even in the middle of a token or character. If
+ * opts->recover is set, input after a lexer error is ignored
+ *
+ * @param parser the parser to pass input to
+ * @param data the bytes to parse
+ * @param len the number of bytes in data
+ * @return false if parsing failed, after which ConfParserFinish returns NULL
+ */
+LIBCONF_PUBLIC bool ConfParserFeed (ConfParser_t* parser,
+                                    const void* data,
+                                    size_t len);
+
+/**
+ * @brief Tells a push parser that all input has been passed to it
+ *
+ * After this, the parser can only be reset or destroyed
+ *
+ * @param parser the parser to finish
+ * @return The list of blocks, or NULL if parsing failed. The list belongs to
+ * the caller
+ */
+LIBCONF_PUBLIC ListHead_t* ConfParserFinish (ConfParser_t* parser);
+
+/**
+ * @brief Resets a push parser, so it can parse new input
+ *
+ * The parser keeps its buffers, so parsing many small inputs with one parser
+ * allocates little more than the trees. Included files are looked up once for
+ * the life of the parser, so changes to which of them exist aren't seen until
+ * it is destroyed. A tree that ConfParserFinish didn't return is freed
+ *
+ * @param parser the parser to reset
+ * @param name the name to report diagnostics with. NULL keeps the old name
+ * @return false if out of memory, after which the parser can only be reset
+ * again or destroyed
+ */
+LIBCONF_PUBLIC bool ConfParserReset (ConfParser_t* parser, const char* name);
+
+/**
+ * @brief Destroys a push parser
+ *
+ * If ConfParserFinish wasn't called, the blocks parsed so far are freed too
+ */
+LIBCONF_PUBLIC void ConfParserDestroy (ConfParser_t* parser);
+
+/**
+ * @brief Formats a diagnostic as libconf would print it
+ * @param diag the diagnostic to format
+ * @param[out] buf the buffer to write to
+ * @param sz the size of buf
+ * @return The length of the message, as snprintf returns it
+ */
+LIBCONF_PUBLIC int ConfFormatDiag (const ConfDiag_t* diag, char* buf, size_t sz);
+
+/**
+ * @brief Reports a diagnostic as libconf would
+ *
+ * This lets code built on libconf, like the C++ binding, report problems with
+ * the same list or output as the parser. The strings of diag are copied
+ *
+ * @param list the list to add diag to. NULL prints it
+ * @param diag the diagnostic to report
+ */
+LIBCONF_PUBLIC void ConfReportDiag (ConfDiagList_t* list, const ConfDiag_t* diag);
+
+/**
+ * @brief Frees everything in a list of diagnostics
+ *
+ * The list is left empty, ready to be used again
+ *
+ * @param list the list to free
+ */
+LIBCONF_PUBLIC void ConfFreeDiags (ConfDiagList_t* list);
+
+/**
+ * @brief Frees the parse trees returned by ConfInitMany
+ * @param trees the array returned by ConfInitMany
+ * @param count the number of files that were parsed
+ */
+LIBCONF_PUBLIC void ConfFreeMany (ListHead_t** trees, size_t count);
+
+/**
+ * @brief Gets the pool allocator
+ *
+ * The pool allocator hands out small blocks from per-thread free lists, which
+ * makes parsing many small files cheaper than with malloc. Memory it frees is
+ * kept for reuse until ConfFreePool is called
+ *
+ * @return The pool allocator, to be put in ConfOptions_t::alloc
+ */
+LIBCONF_PUBLIC const ConfAllocator_t* ConfGetPoolAllocator (void);
+
+/**
+ * @brief Gives all memory held by the pool allocator back to the system
+ *
+ * Nothing allocated from the pool may be in use when this is called, so every
+ * parse tree made with it must have been freed, and no parse may be running
+ */
+LIBCONF_PUBLIC void ConfFreePool (void);
+
+/**
+ * @brief Gets statistics about the last parse on the calling thread
+ *
+ * Statistics are reset by ConfInit, ConfInitEx, ConfInitMany and
+ * ConfParserCreate. For ConfInitMany, the statistics of every file are added
+ * up. Teardown time is added by ConfFreeParseTree and ConfFreeMany
+ *
+ * @param[out] stats the structure to fill in
+ * @return true if statistics were collected, false if libconf was built
+ * without them, in which case stats is zeroed
+ */
+LIBCONF_PUBLIC bool ConfGetStats (ConfStats_t* stats);
+
+/**
+ * @brief Gets the name of a token type
+ * @param type the index in ConfStats_t::tokens
+ * @return The name of the token type
+ */
+LIBCONF_PUBLIC const char* ConfGetTokenName (int type);
+
+/**
+ * @brief Converts a string of a parse tree to UTF-8
+ *
+ * The conversion doesn't depend on the locale. Works like strlcpy: if buf is
+ * too small, the string is cut off before the first character that doesn't
+ * fit, and still null terminated
+ *
+ * @param str the string to convert
+ * @param[out] buf the buffer to write to. May be NULL if bufSz is 0
+ * @param bufSz the size of buf
+ * @return The length of the whole UTF-8 string, without the null terminator
+ */
+LIBCONF_PUBLIC size_t ConfStrToUtf8 (const char32_t* str, char* buf, size_t bufSz);
+
 /**
  * @brief Frees all memory associated with parse tree
  */
 LIBCONF_PUBLIC void ConfFreeParseTree (ListHead_t* list);
 
+/**
+ * @brief Writes a parse tree as configuration text
+ *
+ * The text parses back into the same blocks, properties and values. Numbers
+ * are written in the base they were parsed from, and strings are quoted and
+ * escaped as needed. Included files are written in place of their include
+ * statements, and comments and line numbers are not kept
+ *
+ * If opts->canonical is set, the layout is fixed and numbers are written in
+ * base 10, so trees with the same contents always give the same bytes, which
+ * can be hashed or diffed
+ *
+ * @param list the parse tree to write
+ * @param fd the file descriptor to write to
+ * @param opts the options to write with. May be NULL
+ * @return false if writing failed, with errno set
+ */
+LIBCONF_PUBLIC bool ConfWrite (ListHead_t* list,
+                               int fd,
+                               const ConfWriteOptions_t* opts);
+
+/**
+ * @brief Writes a parse tree as configuration text into memory
+ *
+ * Works like ConfWrite
+ *
+ * @param list the parse tree to write
+ * @param[out] len the length of the text, without the null terminator. May be
+ * NULL
+ * @param opts the options to write with. May be NULL
+ * @return The null terminated text, to be freed with free(), or NULL on error
+ */
+LIBCONF_PUBLIC char* ConfWriteBuffer (ListHead_t* list,
+                                      size_t* len,
+                                      const ConfWriteOptions_t* opts);
+
+/**
+ * @brief Merges parse trees on top of each other
+ *
+ * Blocks with the same type and name are merged into one, in the place the
+ * first of them is in. In a merged block, a property set by a later tree than
+ * the one that set it last is handled according to policy.
+ * CONF_OVERLAY_REPLACE drops every earlier property with the name and keeps
+ * the later one, CONF_OVERLAY_APPEND adds the later property's values to the
+ * last earlier property with the name, and CONF_OVERLAY_ERROR fails with a
+ * CONF_DIAG_CONFLICT diagnostic. A property repeated within one tree is kept as
+ * many times as it appears
+ *
+ * The merged tree is made in time linear in the size of the trees, and doesn't
+ * copy them. Blocks that aren't merged, and properties that aren't appended
+ * to, are shared with the trees, which must outlive it and not be changed
+ *
+ * @param trees the trees to merge, from the bottom up
+ * @param count the number of trees
+ * @param policy how to merge properties. One of CONF_OVERLAY_*
+ * @param diags collects diagnostics. NULL prints them. Diagnostics name the
+ * index of the tree they are about instead of a file
+ * @return The merged tree, to be freed with ConfFreeParseTree, or NULL on error
+ */
+LIBCONF_PUBLIC ListHead_t* ConfOverlay (ListHead_t** trees,
+                                        size_t count,
+                                        int policy,
+                                        ConfDiagList_t* diags);
+
+/**
+ * @brief Creates a frozen view of a parse tree
+ *
+ * The view is allocated as one block of memory and stays valid after list is
+ * freed
+ *
+ * @param list the parse tree to freeze
+ * @return The view, or NULL on error
+ */
+LIBCONF_PUBLIC ConfView_t* ConfFreeze (ListHead_t* list);
+
+/**
+ * @brief Frees a view created by ConfFreeze
+ */
+LIBCONF_PUBLIC void ConfFreeView (ConfView_t* view);
+
+/**
+ * @brief Gets a block from a view
+ * @param view the view to read from
+ * @param idx the index of the block
+ * @return The block, or NULL if idx is out of range
+ */
+LIBCONF_PUBLIC const ConfViewBlock_t* ConfViewGetBlock (const ConfView_t* view,
+                                                        size_t idx);
+
+/**
+ * @brief Gets a property of a block in a view
+ * @param view the view to read from
+ * @param block the block the property is in
+ * @param idx the index of the property in block
+ * @return The property, or NULL if idx is out of range
+ */
+LIBCONF_PUBLIC const ConfViewProp_t* ConfViewGetProp (const ConfView_t* view,
+                                                      const ConfViewBlock_t* block,
+                                                      size_t idx);
+
+/**
+ * @brief Gets a value of a property in a view
+ * @param view the view to read from
+ * @param prop the property the value is in
+ * @param idx the index of the value in prop
+ * @return The value, or NULL if idx is out of range
+ */
+LIBCONF_PUBLIC const ConfViewVal_t* ConfViewGetVal (const ConfView_t* view,
+                                                    const ConfViewProp_t* prop,
+                                                    size_t idx);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif
@@ -0,0 +1,949 @@
+/*
+    libconf.hpp - contains C++ binding of configuration file parser
+    Copyright 2022 The NexNix Project
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+         http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+/// @file libconf.hpp
+
+#ifndef CONF_HPP
+#define CONF_HPP
+
+#include "libconf.h"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/// C++ binding of libconf. Needs C++17
+namespace libconf
+{
+    /**
+     * @brief Encodes a string as UTF-8
+     *
+     * Strings are kept as UTF-32 in the tree, so this is the only accessor
+     * that copies
+     *
+     * @param str the string to encode
+     * @return The UTF-8 string
+     */
+    inline std::string toUtf8 (std::u32string_view str)
+    {
+        std::string res;
+        res.reserve (str.size());
+        for (char32_t c : str)
+        {
+            if (c < 0x80)
+                res += static_cast<char> (c);
+            else if (c < 0x800)
+            {
+                res += static_cast<char> (0xC0 | (c >> 6));
+                res += static_cast<char> (0x80 | (c & 0x3F));
+            }
+            else if (c < 0x10000)
+            {
+                res += static_cast<char> (0xE0 | (c >> 12));
+                res += static_cast<char> (0x80 | ((c >> 6) & 0x3F));
+                res += static_cast<char> (0x80 | (c & 0x3F));
+            }
+            else
+            {
+                res += static_cast<char> (0xF0 | (c >> 18));
+                res += static_cast<char> (0x80 | ((c >> 12) & 0x3F));
+                res += static_cast<char> (0x80 | ((c >> 6) & 0x3F));
+                res += static_cast<char> (0x80 | (c & 0x3F));
+            }
+        }
+        return res;
+    }
+
+    namespace detail
+    {
+        /// Gets a view of a string in a tree
+        inline std::u32string_view view (StringRef32_t* str) noexcept
+        {
+            return str ? std::u32string_view (StrRefGet (str))
+                       : std::u32string_view();
+        }
+    }    // namespace detail
+
+    /// Iterates over the entries of a libnex list, wrapping each in T
+    template <typename T> class ListIterator
+    {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = T;
+
+        explicit ListIterator (ListEntry_t* entry = nullptr) noexcept : ent (entry)
+        {
+        }
+
+        T operator* () const noexcept
+        {
+            using native = typename T::native_type;
+            return T (static_cast<native*> (ListEntryData (ent)));
+        }
+
+        ListIterator& operator++() noexcept
+        {
+            ent = ListIterate (ent);
+            return *this;
+        }
+
+        ListIterator operator++ (int) noexcept
+        {
+            ListIterator res = *this;
+            ent = ListIterate (ent);
+            return res;
+        }
+
+        bool operator== (const ListIterator& other) const noexcept
+        {
+            return ent == other.ent;
+        }
+
+        bool operator!= (const ListIterator& other) const noexcept
+        {
+            return ent != other.ent;
+        }
+
+    private:
+        ListEntry_t* ent;    ///< Current entry. NULL at the end
+    };
+
+    /// A value of a property. Doesn't own anything
+    class Value
+    {
+    public:
+        using native_type = const ConfPropVal_t;    ///< What this wraps
+
+        explicit Value (const ConfPropVal_t* value = nullptr) noexcept : val (value)
+        {
+        }
+
+        /// Checks if this refers to a value
+        explicit operator bool() const noexcept
+        {
+            return val != nullptr;
+        }
+
+        /// Gets the wrapped value
+        const ConfPropVal_t* get() const noexcept
+        {
+            return val;
+        }
+
+        /// Gets the type of the value. One of DATATYPE_*
+        int type() const noexcept
+        {
+            return val->type;
+        }
+
+        /// Gets the line the value is on
+        int line() const noexcept
+        {
+            return val->lineNo;
+        }
+
+        /// Gets the column the value starts at
+        int column() const noexcept
+        {
+            return val->colNo;
+        }
+
+        /// Checks if the value is a number
+        bool isNumber() const noexcept
+        {
+            return val->type == DATATYPE_NUMBER;
+        }
+
+        /// Checks if the value is a string
+        bool isString() const noexcept
+        {
+            return val->type == DATATYPE_STRING;
+        }
+
+        /// Checks if the value is an identifier
+        bool isIdentifier() const noexcept
+        {
+            return val->type == DATATYPE_IDENTIFIER;
+        }
+
+        /**
+         * @brief Converts the value to T
+         *
+         * Numbers convert to integer and floating point types. Integers that T
+         * can't hold don't convert. Strings and identifiers convert to
+         * std::u32string_view and const char32_t*, which point into the tree.
+         * Other types don't compile. Nothing is allocated
+         *
+         * @return The value, or nothing if it isn't of a type that converts to T
+         */
+        template <typename T> std::optional<T> get() const noexcept
+        {
+            if constexpr (std::is_integral_v<T> && !std::is_same_v<T, bool>)
+            {
+                if (!isNumber() || !_fits<T> (val->numVal))
+                    return std::nullopt;
+                return static_cast<T> (val->numVal);
+            }
+            else if constexpr (std::is_floating_point_v<T>)
+            {
+                if (!isNumber())
+                    return std::nullopt;
+                return static_cast<T> (val->numVal);
+            }
+            else if constexpr (std::is_same_v<T, std::u32string_view>)
+            {
+                if (isNumber())
+                    return std::nullopt;
+                return detail::view (val->str);
+            }
+            else if constexpr (std::is_same_v<T, const char32_t*>)
+            {
+                if (isNumber())
+                    return std::nullopt;
+                return StrRefGet (val->str);
+            }
+            else
+            {
+                static_assert (sizeof (T) == 0, "type can't be converted to");
+                return std::nullopt;
+            }
+        }
+
+        /// Gets a string or identifier as UTF-8. Empty if this is a number
+        std::string utf8() const
+        {
+            return isNumber() ? std::string() : toUtf8 (detail::view (val->str));
+        }
+
+    private:
+        /// Checks if num can be held by T
+        template <typename T> static bool _fits (int64_t num) noexcept
+        {
+            if constexpr (std::is_signed_v<T>)
+            {
+                using limits = std::numeric_limits<T>;
+                return num >= static_cast<int64_t> (limits::min()) &&
+                       num <= static_cast<int64_t> (limits::max());
+            }
+            else
+            {
+                return num >= 0 && static_cast<uint64_t> (num) <=
+                                       std::numeric_limits<T>::max();
+            }
+        }
+
+        const ConfPropVal_t* val;    ///< The wrapped value
+    };
+
+    /// A property of a block. Doesn't own anything
+    class Property
+    {
+    public:
+        using native_type = ConfProperty_t;    ///< What this wraps
+
+        explicit Property (ConfProperty_t* property = nullptr) noexcept
+            : prop (property)
+        {
+        }
+
+        /// Checks if this refers to a property
+        explicit operator bool() const noexcept
+        {
+            return prop != nullptr;
+        }
+
+        /// Gets the wrapped property
+        ConfProperty_t* get() const noexcept
+        {
+            return prop;
+        }
+
+        /// Gets the name of the property
+        std::u32string_view name() const noexcept
+        {
+            return detail::view (prop->name);
+        }
+
+        /// Gets the line the property is on
+        int line() const noexcept
+        {
+            return prop->lineNo;
+        }
+
+        /// Gets the column the property starts at
+        int column() const noexcept
+        {
+            return prop->colNo;
+        }
+
+        /// Gets the number of values
+        std::size_t size() const noexcept
+        {
+            return static_cast<std::size_t> (prop->nextVal);
+        }
+
+        /// Gets a value. idx must be less than size()
+        Value operator[] (std::size_t idx) const noexcept
+        {
+            return Value (&prop->vals[idx]);
+        }
+
+        /**
+         * @brief Converts a value to T, as Value::get does
+         * @param idx the index of the value
+         * @return The value, or nothing if there is no such value or it doesn't
+         * convert to T
+         */
+        template <typename T>
+        std::optional<T> get (std::size_t idx = 0) const noexcept
+        {
+            if (idx >= size())
+                return std::nullopt;
+            return (*this)[idx].get<T>();
+        }
+
+        /// Iterates over the values
+        class iterator
+        {
+        public:
+            using iterator_category = std::forward_iterator_tag;
+            using value_type = Value;
+            using difference_type = std::ptrdiff_t;
+            using pointer = void;
+            using reference = Value;
+
+            explicit iterator (const ConfPropVal_t* value) noexcept : val (value)
+            {
+            }
+
+            Value operator* () const noexcept
+            {
+                return Value (val);
+            }
+
+            iterator& operator++() noexcept
+            {
+                ++val;
+                return *this;
+            }
+
+            iterator operator++ (int) noexcept
+            {
+                iterator res = *this;
+                ++val;
+                return res;
+            }
+
+            bool operator== (const iterator& other) const noexcept
+            {
+                return val == other.val;
+            }
+
+            bool operator!= (const iterator& other) const noexcept
+            {
+                return val != other.val;
+            }
+
+        private:
+            const ConfPropVal_t* val;    ///< Current value
+        };
+
+        iterator begin() const noexcept
+        {
+            return iterator (prop->vals);
+        }
+
+        iterator end() const noexcept
+        {
+            return iterator (prop->vals + prop->nextVal);
+        }
+
+    private:
+        ConfProperty_t* prop;    ///< The wrapped property
+    };
+
+    /// A block of a tree. Doesn't own anything
+    class Block
+    {
+    public:
+        using native_type = ConfBlock_t;            ///< What this wraps
+        using iterator = ListIterator<Property>;    ///< Iterates properties
+
+        explicit Block (ConfBlock_t* native = nullptr) noexcept : block (native)
+        {
+        }
+
+        /// Checks if this refers to a block
+        explicit operator bool() const noexcept
+        {
+            return block != nullptr;
+        }
+
+        /// Gets the wrapped block
+        ConfBlock_t* get() const noexcept
+        {
+            return block;
+        }
+
+        /// Gets the type of the block
+        std::u32string_view type() const noexcept
+        {
+            return detail::view (block->blockType);
+        }
+
+        /// Gets the name of the block. Empty if it has none
+        std::u32string_view name() const noexcept
+        {
+            return detail::view (block->blockName);
+        }
+
+        /// Checks if the block has a name
+        bool hasName() const noexcept
+        {
+            return block->blockName != nullptr;
+        }
+
+        /// Gets the line the block is on
+        int line() const noexcept
+        {
+            return block->lineNo;
+        }
+
+        /// Gets the column the block starts at
+        int column() const noexcept
+        {
+            return block->colNo;
+        }
+
+        /**
+         * @brief Finds a property by name
+         *
+         * This searches the block from the start
+         *
+         * @param name the name of the property
+         * @return The first property with the name. Refers to nothing if there
+         * is none
+         */
+        Property find (std::u32string_view name) const noexcept
+        {
+            for (Property prop : *this)
+            {
+                if (prop.name() == name)
+                    return prop;
+            }
+            return Property();
+        }
+
+        iterator begin() const noexcept
+        {
+            return iterator (ListFront (block->props));
+        }
+
+        iterator end() const noexcept
+        {
+            return iterator();
+        }
+
+    private:
+        ConfBlock_t* block;    ///< The wrapped block
+    };
+
+    /// A parse tree. Owns the tree, which is freed when this is destroyed
+    class Tree
+    {
+    public:
+        using iterator = ListIterator<Block>;    ///< Iterates blocks
+
+        Tree() noexcept = default;
+
+        /// Takes ownership of a tree
+        explicit Tree (ListHead_t* tree) noexcept : list (tree)
+        {
+        }
+
+        Tree (const Tree&) = delete;
+        Tree& operator= (const Tree&) = delete;
+
+        Tree (Tree&& other) noexcept : list (other.release())
+        {
+        }
+
+        Tree& operator= (Tree&& other) noexcept
+        {
+            if (this != &other)
+                reset (other.release());
+            return *this;
+        }
+
+        ~Tree()
+        {
+            reset();
+        }
+
+        /**
+         * @brief Parses a file, like ConfInitEx
+         * @param file the file to read configuration from
+         * @param opts the options to parse with. May be NULL
+         * @return The tree, which holds nothing if parsing failed
+         */
+        static Tree parse (const char* file, const ConfOptions_t* opts = nullptr)
+        {
+            return Tree (ConfInitEx (file, opts));
+        }
+
+        /// Checks if this holds a tree
+        explicit operator bool() const noexcept
+        {
+            return list != nullptr;
+        }
+
+        /// Gets the tree, which is still owned by this
+        ListHead_t* get() const noexcept
+        {
+            return list;
+        }
+
+        /// Gives up ownership of the tree
+        ListHead_t* release() noexcept
+        {
+            ListHead_t* res = list;
+            list = nullptr;
+            return res;
+        }
+
+        /// Frees the tree, and takes ownership of another one
+        void reset (ListHead_t* other = nullptr) noexcept
+        {
+            if (list)
+                ConfFreeParseTree (list);
+            list = other;
+        }
+
+        iterator begin() const noexcept
+        {
+            return iterator (list ? ListFront (list) : nullptr);
+        }
+
+        iterator end() const noexcept
+        {
+            return iterator();
+        }
+
+    private:
+        ListHead_t* list = nullptr;    ///< The tree. NULL if there is none
+    };
+    /// A property of a schema, and the member of S it is put in
+    template <typename S, typename M> struct Field
+    {
+        using struct_type = S;    ///< Struct the member is in
+
+        std::u32string_view name;    ///< Name of the property
+        M S::*member;                ///< Member the property is put in
+    };
+
+    /**
+     * @brief Declares a property of a schema
+     *
+     * The member may be an integer, floating point or bool type,
+     * std::u32string_view, const char32_t*, std::u32string or std::string. The
+     * property must then have one value. A std::vector of any of these takes
+     * all values of the property. bool properties are the identifiers true and
+     * false. std::u32string_view and const char32_t* point into the tree, and
+     * std::string is UTF-8
+     *
+     * @param name the name of the property
+     * @param member the member to put it in
+     * @return The field
+     */
+    template <typename S, typename M>
+    constexpr Field<S, M> field (std::u32string_view name, M S::*member) noexcept
+    {
+        return Field<S, M>{name, member};
+    }
+
+    namespace detail
+    {
+        /// Hashes a property name. Collisions are found when a schema is built
+        constexpr uint32_t hashName (std::u32string_view name) noexcept
+        {
+            uint32_t hash = 2166136261U;
+            for (char32_t c : name)
+                hash = (hash ^ static_cast<uint32_t> (c)) * 16777619U;
+            return hash;
+        }
+
+        /// Mixes the bits of a hash, so all of them affect the low ones
+        constexpr uint32_t mixHash (uint32_t hash) noexcept
+        {
+            hash ^= hash >> 16;
+            hash *= 0x7FEB352DU;
+            hash ^= hash >> 15;
+            hash *= 0x846CA68BU;
+            hash ^= hash >> 16;
+            return hash;
+        }
+
+        /// Gets the size of the hash table of a schema, which is kept half full
+        constexpr std::size_t schemaTableSize (std::size_t num) noexcept
+        {
+            std::size_t sz = 1;
+            while (sz < (num * 2))
+                sz *= 2;
+            return sz;
+        }
+
+        /// Called when two names of a schema are the same, or hash the same.
+        /// It isn't constexpr, so a constexpr schema with them doesn't compile
+        inline void schemaNamesClash() noexcept
+        {
+        }
+
+        template <typename T> struct IsVector : std::false_type
+        {
+        };
+
+        template <typename T, typename A>
+        struct IsVector<std::vector<T, A>> : std::true_type
+        {
+        };
+
+        /// Converts a value to the type of a schema member
+        template <typename T> bool convert (T& dst, Value val)
+        {
+            if constexpr (std::is_same_v<T, bool>)
+            {
+                std::optional<std::u32string_view> id =
+                    val.isIdentifier() ? val.get<std::u32string_view>()
+                                       : std::nullopt;
+                if (id == U"true")
+                    dst = true;
+                else if (id == U"false")
+                    dst = false;
+                else
+                    return false;
+                return true;
+            }
+            else if constexpr (std::is_same_v<T, std::u32string>)
+            {
+                std::optional<std::u32string_view> str =
+                    val.get<std::u32string_view>();
+                if (str)
+                    dst.assign (*str);
+                return str.has_value();
+            }
+            else if constexpr (std::is_same_v<T, std::string>)
+            {
+                if (val.isNumber())
+                    return false;
+                dst = val.utf8();
+                return true;
+            }
+            else
+            {
+                std::optional<T> res = val.get<T>();
+                if (res)
+                    dst = *res;
+                return res.has_value();
+            }
+        }
+
+        /// Puts a property in a schema member
+        template <typename T> bool assign (T& dst, Property prop)
+        {
+            if constexpr (IsVector<T>::value)
+            {
+                dst.clear();
+                dst.reserve (prop.size());
+                for (Value val : prop)
+                {
+                    typename T::value_type elem{};
+                    if (!convert (elem, val))
+                        return false;
+                    dst.push_back (std::move (elem));
+                }
+                return true;
+            }
+            else
+                return prop.size() == 1 && convert (dst, prop[0]);
+        }
+    }    // namespace detail
+
+    /**
+     * @brief Maps blocks of one type onto a struct
+     *
+     * Schemas are meant to be constexpr, which makes the compiler build a
+     * perfect hash of their property names. Each name hashes to a bucket,
+     * which has a seed that was picked so no two names land in the same slot
+     * of the table. Finding a property is then one hash of its name, two
+     * array lookups and one comparison. Names that hash the same can only be
+     * in a schema that isn't constexpr, which compares names one by one
+     * instead. Make schemas with libconf::schema
+     */
+    template <typename S, typename... Fields> class Schema
+    {
+    public:
+        static constexpr std::size_t numFields = sizeof...(Fields);    ///< Fields
+        static constexpr std::size_t tableSz = detail::schemaTableSize (numFields);
+        static constexpr std::size_t numBuckets = numFields ? numFields : 1;
+
+        /**
+         * @brief Builds a schema and its perfect hash
+         * @param type the type of block the schema is for
+         * @param members the properties of the block
+         */
+        constexpr Schema (std::u32string_view type, Fields... members)
+            : blockType (type), fields (members...), names{members.name...}
+        {
+            for (std::size_t i = 0; i < numFields; ++i)
+            {
+                hashes[i] = detail::hashName (names[i]);
+                for (std::size_t j = 0; j < i; ++j)
+                {
+                    // The hash can't be made perfect
+                    if (hashes[j] == hashes[i])
+                    {
+                        detail::schemaNamesClash();
+                        perfect = false;
+                        return;
+                    }
+                }
+            }
+            for (std::size_t i = 0; i < tableSz; ++i)
+                table[i] = numFields;
+            std::array<std::size_t, numBuckets> sizes{};
+            for (std::size_t i = 0; i < numFields; ++i)
+                ++sizes[_bucket (hashes[i])];
+            // Place the biggest buckets first, while the table is emptiest
+            for (std::size_t size = numFields; size; --size)
+            {
+                for (std::size_t bucket = 0; bucket < numBuckets; ++bucket)
+                {
+                    if (sizes[bucket] == size)
+                        _placeBucket (bucket);
+                }
+            }
+        }
+
+        /// Gets the type of block the schema is for
+        constexpr std::u32string_view type() const noexcept
+        {
+            return blockType;
+        }
+
+        /// Checks if a block is of the type of the schema
+        bool matches (Block block) const noexcept
+        {
+            return block.type() == blockType;
+        }
+
+        /**
+         * @brief Finds a property in the schema
+         * @param name the name of the property
+         * @return The index of its field, or numFields if there is none
+         */
+        constexpr std::size_t find (std::u32string_view name) const noexcept
+        {
+            if (!perfect)
+            {
+                for (std::size_t i = 0; i < numFields; ++i)
+                {
+                    if (names[i] == name)
+                        return i;
+                }
+                return numFields;
+            }
+            uint32_t hash = detail::hashName (name);
+            std::size_t idx = table[_slot (hash, seeds[_bucket (hash)])];
+            if (idx == numFields || names[idx] != name)
+                return numFields;
+            return idx;
+        }
+
+        /**
+         * @brief Puts the properties of a block in a struct
+         *
+         * Members of properties that aren't in the block are left as they are.
+         * Properties the schema doesn't have are reported as
+         * CONF_DIAG_UNKNOWN_PROPERTY, and properties that can't be converted to
+         * their member as CONF_DIAG_BAD_VALUE. Every property is looked at,
+         * so all problems are reported
+         *
+         * @param block the block to read from. Doesn't have to match
+         * @param[out] out the struct to fill in
+         * @param diags collects diagnostics. NULL prints them
+         * @param file the file to report diagnostics in
+         * @return false if any property was reported
+         */
+        bool bind (Block block,
+                   S& out,
+                   ConfDiagList_t* diags = nullptr,
+                   const char* file = "<tree>") const
+        {
+            using Setter = bool (*) (const Schema&, S&, Property);
+            static constexpr std::array<Setter, numFields> setters =
+                _setters (std::make_index_sequence<numFields>());
+            bool res = true;
+            for (Property prop : block)
+            {
+                std::size_t idx = find (prop.name());
+                if (idx == numFields)
+                {
+                    _report (diags, file, CONF_DIAG_UNKNOWN_PROPERTY, prop);
+                    res = false;
+                }
+                else if (!setters[idx](*this, out, prop))
+                {
+                    _report (diags, file, CONF_DIAG_BAD_VALUE, prop);
+                    res = false;
+                }
+            }
+            return res;
+        }
+
+    private:
+        /// Gets the bucket of a name
+        static constexpr std::size_t _bucket (uint32_t hash) noexcept
+        {
+            return detail::mixHash (hash) % numBuckets;
+        }
+
+        /// Gets the slot a seed puts a name in
+        static constexpr std::size_t _slot (uint32_t hash, uint32_t seed) noexcept
+        {
+            return detail::mixHash (hash ^ (seed * 0x9E3779B9U)) & (tableSz - 1);
+        }
+
+        /// Finds a seed that puts every name in a bucket in an empty slot
+        constexpr void _placeBucket (std::size_t bucket) noexcept
+        {
+            for (uint32_t seed = 1;; ++seed)
+            {
+                std::size_t placed = 0;
+                bool fits = true;
+                for (std::size_t i = 0; i < numFields && fits; ++i)
+                {
+                    if (_bucket (hashes[i]) != bucket)
+                        continue;
+                    std::size_t slot = _slot (hashes[i], seed);
+                    if (table[slot] != numFields)
+                        fits = false;
+                    else
+                    {
+                        table[slot] = i;
+                        ++placed;
+                    }
+                }
+                if (fits)
+                {
+                    seeds[bucket] = seed;
+                    return;
+                }
+                // Take back what this seed placed
+                for (std::size_t i = 0; i < numFields && placed; ++i)
+                {
+                    std::size_t slot = _slot (hashes[i], seed);
+                    if (_bucket (hashes[i]) == bucket && table[slot] == i)
+                    {
+                        table[slot] = numFields;
+                        --placed;
+                    }
+                }
+            }
+        }
+
+        /// Puts a property in the member of field I
+        template <std::size_t I>
+        static bool _set (const Schema& schema, S& out, Property prop)
+        {
+            return detail::assign (out.*(std::get<I> (schema.fields).member), prop);
+        }
+
+        /// Gets the setters of every field
+        template <std::size_t... I>
+        static constexpr auto _setters (std::index_sequence<I...>) noexcept
+        {
+            using Setter = bool (*) (const Schema&, S&, Property);
+            return std::array<Setter, numFields>{&_set<I>...};
+        }
+
+        /// Reports a property that can't be put in the struct
+        static void _report (ConfDiagList_t* diags,
+                             const char* file,
+                             int code,
+                             Property prop)
+        {
+            std::string name = toUtf8 (prop.name());
+            ConfDiag_t diag = {};
+            diag.file = file;
+            diag.line = prop.line();
+            diag.column = prop.column();
+            diag.code = code;
+            diag.token = -1;
+            diag.prevToken = -1;
+            diag.expected = -1;
+            diag.detail = name.c_str();
+            ConfReportDiag (diags, &diag);
+        }
+
+        std::u32string_view blockType;                       ///< Type of block
+        std::tuple<Fields...> fields;                        ///< Properties
+        std::array<std::u32string_view, numFields> names;    ///< Property names
+        std::array<uint32_t, numFields> hashes{};            ///< Hashes of names
+        std::array<uint32_t, numBuckets> seeds{};            ///< Seed of each bucket
+        std::array<std::size_t, tableSz> table{};            ///< Fields, by slot
+        bool perfect = true;    ///< Is the hash perfect? Else names are compared
+    };
+
+    /**
+     * @brief Makes a schema
+     *
+     * Schemas should be declared constexpr, like
+     *
+     *     static constexpr auto serverSchema =
+     *         libconf::schema (U"server",
+     *                          libconf::field (U"port", &Server::port),
+     *                          libconf::field (U"host", &Server::host));
+     *
+     * @param type the type of block the schema is for
+     * @param first the first property of the block
+     * @param rest the other properties
+     * @return The schema
+     */
+    template <typename First, typename... Rest>
+    constexpr Schema<typename First::struct_type, First, Rest...> schema (
+        std::u32string_view type,
+        First first,
+        Rest... rest)
+    {
+        return Schema<typename First::struct_type, First, Rest...> (type,
+                                                                     first,
+                                                                     rest...);
+    }
+}    // namespace libconf
+
+#endif
@@ -0,0 +1,364 @@
+/*
+    alloc.c - contains memory allocation
+    Copyright 2022 The NexNix Project
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+         http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+/// @file alloc.c
+
+#include "internal.h"
+#include <libconf.h>
+#include <libnex/safemalloc.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Allocations are prefixed with the allocator they came from and their size, so
+// they can be freed on any thread, and after the parse that made them is over.
+// The header is kept big enough to not break the alignment of what follows it
+typedef union _allocHeader
+{
+    struct
+    {
+        const ConfAllocator_t* alloc;    // Allocator this came from
+        size_t size;                     // Size of block, without the header
+    };
+    max_align_t align;
+} allocHeader_t;
+
+static void* _allocDefAlloc (size_t sz, void* userData)
+{
+    (void) userData;
+    return malloc_s (sz);
+}
+
+static void* _allocDefRealloc (void* ptr, size_t oldSz, size_t sz, void* userData)
+{
+    (void) oldSz;
+    (void) userData;
+    return realloc (ptr, sz);
+}
+
+static void _allocDefFree (void* ptr, size_t sz, void* userData)
+{
+    (void) sz;
+    (void) userData;
+    free (ptr);
+}
+
+// Allocator used when none was given
+static const ConfAllocator_t defAlloc = {_allocDefAlloc,
+                                         _allocDefRealloc,
+                                         _allocDefFree,
+                                         NULL};
+
+// Allocator of the parse running on this thread
+static _Thread_local const ConfAllocator_t* curAlloc = NULL;
+
+// Budget of the parse running on this thread
+static _Thread_local _confBudget_t* curBudget = NULL;
+
+#ifdef LIBCONF_ENABLE_STATS
+// Bytes currently allocated by this thread
+static _Thread_local int64_t curBytes = 0;
+
+// Updates the number of bytes allocated
+static inline void _allocTrack (int64_t sz)
+{
+    curBytes += sz;
+    if (curBytes > 0 && (uint64_t) curBytes > _confStats.peakBytes)
+        _confStats.peakBytes = curBytes;
+}
+
+void _confStatsResetAlloc (void)
+{
+    curBytes = 0;
+}
+#else
+#define _allocTrack(sz)
+#endif
+
+const ConfAllocator_t* _confGetAllocator (void)
+{
+    return curAlloc;
+}
+
+const ConfAllocator_t* _confSetAllocator (const ConfAllocator_t* alloc)
+{
+    const ConfAllocator_t* prev = curAlloc;
+    curAlloc = alloc;
+    return prev;
+}
+
+_confBudget_t* _confGetBudget (void)
+{
+    return curBudget;
+}
+
+_confBudget_t* _confSetBudget (_confBudget_t* budget)
+{
+    _confBudget_t* prev = curBudget;
+    curBudget = budget;
+    return prev;
+}
+
+// Charges memory to the budget of this thread. Returns false if that would go
+// over the limit. The parallel lexer shares a budget between threads
+static inline bool _allocCharge (int64_t sz)
+{
+    _confBudget_t* budget = curBudget;
+    if (!budget || !budget->limits->maxMemory)
+        return true;
+    int64_t mem = __atomic_add_fetch (&budget->memory, sz, __ATOMIC_RELAXED);
+    if (sz > 0 && (uint64_t) mem > budget->limits->maxMemory)
+    {
+        __atomic_sub_fetch (&budget->memory, sz, __ATOMIC_RELAXED);
+        budget->outOfMemory = true;
+        return false;
+    }
+    return true;
+}
+
+void* _confMalloc (size_t sz)
+{
+    if (!_allocCharge ((int64_t) sz))
+        return NULL;
+    const ConfAllocator_t* alloc = curAlloc ? curAlloc : &defAlloc;
+    allocHeader_t* hdr = alloc->alloc (sizeof (allocHeader_t) + sz, alloc->userData);
+    if (!hdr)
+    {
+        _allocCharge (-(int64_t) sz);
+        return NULL;
+    }
+    hdr->alloc = alloc;
+    hdr->size = sz;
+    STATS_ALLOC (sz);
+    _allocTrack ((int64_t) sz);
+    return hdr + 1;
+}
+
+void* _confCalloc (size_t sz)
+{
+    void* ptr = _confMalloc (sz);
+    if (ptr)
+        memset (ptr, 0, sz);
+    return ptr;
+}
+
+void* _confRealloc (void* ptr, size_t sz)
+{
+    if (!ptr)
+        return _confMalloc (sz);
+    allocHeader_t* hdr = (allocHeader_t*) ptr - 1;
+    const ConfAllocator_t* alloc = hdr->alloc;
+    size_t oldSz = hdr->size;
+    if (!_allocCharge ((int64_t) sz - (int64_t) oldSz))
+        return NULL;
+    hdr = alloc->realloc (hdr,
+                          sizeof (allocHeader_t) + oldSz,
+                          sizeof (allocHeader_t) + sz,
+                          alloc->userData);
+    if (!hdr)
+    {
+        _allocCharge ((int64_t) oldSz - (int64_t) sz);
+        return NULL;
+    }
+    hdr->size = sz;
+    STATS_ALLOC (sz);
+    _allocTrack ((int64_t) sz - (int64_t) oldSz);
+    return hdr + 1;
+}
+
+void _confFree (void* ptr)
+{
+    if (!ptr)
+        return;
+    allocHeader_t* hdr = (allocHeader_t*) ptr - 1;
+    const ConfAllocator_t* alloc = hdr->alloc;
+    _allocCharge (-(int64_t) hdr->size);
+    _allocTrack (-(int64_t) hdr->size);
+    alloc->free (hdr, sizeof (allocHeader_t) + hdr->size, alloc->userData);
+}
+
+StringRef32_t* _confStrCreate (char32_t* str)
+{
+    StringRef32_t* ref = StrRefCreate (str);
+    // libnex would free the string with free(), which is wrong for strings from
+    // _confMalloc. _confStrRelease frees it instead
+    StrRefNoFree (ref);
+    return ref;
+}
+
+void _confStrRelease (StringRef32_t* ref)
+{
+    // References to a string are only ever dropped by the thread that owns the
+    // tree it's in, so the count can't change between here and StrRefDestroy
+    char32_t* str = (char32_t*) StrRefGet (ref);
+    bool last = (ref->obj.refCount == 1);
+    StrRefDestroy (ref);
+    if (last)
+        _confFree (str);
+}
+
+// The pool allocator. Small blocks are carved out of big chunks and put on a
+// free list for their size class when freed. Each thread has its own free
+// lists, so no locking is needed except to get a new chunk
+#define POOL_MIN_SHIFT   4              // Smallest class is 16 bytes
+#define POOL_NUM_CLASSES 8              // Largest class is 2 KiB
+#define POOL_CHUNK_SZ    (64 * 1024)    // Size of a chunk
+#define POOL_MAX_SZ      ((size_t) 1 << (POOL_MIN_SHIFT + POOL_NUM_CLASSES - 1))
+
+// A free block
+typedef struct _poolBlock
+{
+    struct _poolBlock* next;    // Next free block in class
+} poolBlock_t;
+
+// A chunk that blocks are carved out of. The blocks start after the header
+typedef union _poolChunk
+{
+    union _poolChunk* next;    // Next chunk in pool
+    max_align_t align;
+} poolChunk_t;
+
+// The free lists of a thread
+typedef struct _poolCache
+{
+    unsigned gen;                                // Pool generation of lists
+    poolBlock_t* freeList[POOL_NUM_CLASSES];    // Free blocks of each class
+    uint8_t* pos;                                // Next free byte in chunk
+    uint8_t* end;                                // End of chunk
+} poolCache_t;
+
+static _Thread_local poolCache_t poolCache = {0};
+
+// Every chunk ever allocated, so ConfFreePool can free them
+static poolChunk_t* poolChunks = NULL;
+static _confMutex_t poolLock = CONF_MUTEX_INITIALIZER;
+
+// Bumped by ConfFreePool, so threads know to throw away their free lists
+static unsigned poolGen = 0;
+
+// Gets the size class of a block. sz must be at most POOL_MAX_SZ
+static inline int _poolClass (size_t sz)
+{
+    int cls = 0;
+    while (((size_t) 1 << (POOL_MIN_SHIFT + cls)) < sz)
+        ++cls;
+    return cls;
+}
+
+// Gets the free lists of this thread, throwing them away if the pool was freed
+static inline poolCache_t* _poolGetCache (void)
+{
+    unsigned gen = __atomic_load_n (&poolGen, __ATOMIC_ACQUIRE);
+    if (poolCache.gen != gen)
+    {
+        memset (&poolCache, 0, sizeof (poolCache_t));
+        poolCache.gen = gen;
+    }
+    return &poolCache;
+}
+
+static void* _poolAlloc (size_t sz, void* userData)
+{
+    (void) userData;
+    if (sz > POOL_MAX_SZ)
+        return malloc_s (sz);
+    poolCache_t* cache = _poolGetCache();
+    int cls = _poolClass (sz);
+    poolBlock_t* block = cache->freeList[cls];
+    if (block)
+    {
+        cache->freeList[cls] = block->next;
+        return block;
+    }
+    // Carve a new block out of the chunk
+    size_t clsSz = (size_t) 1 << (POOL_MIN_SHIFT + cls);
+    if (!cache->pos || (size_t) (cache->end - cache->pos) < clsSz)
+    {
+        poolChunk_t* chunk = malloc_s (POOL_CHUNK_SZ);
+        if (!chunk)
+            return NULL;
+        _confMutexLock (&poolLock);
+        chunk->next = poolChunks;
+        poolChunks = chunk;
+        _confMutexUnlock (&poolLock);
+        // What's left of the old chunk is lost until the pool is freed
+        cache->pos = (uint8_t*) (chunk + 1);
+        cache->end = (uint8_t*) chunk + POOL_CHUNK_SZ;
+    }
+    void* res = cache->pos;
+    cache->pos += clsSz;
+    return res;
+}
+
+static void _poolFree (void* ptr, size_t sz, void* userData)
+{
+    (void) userData;
+    if (sz > POOL_MAX_SZ)
+    {
+        free (ptr);
+        return;
+    }
+    // The block goes to the freeing thread's lists, wherever it came from
+    poolCache_t* cache = _poolGetCache();
+    int cls = _poolClass (sz);
+    poolBlock_t* block = ptr;
+    block->next = cache->freeList[cls];
+    cache->freeList[cls] = block;
+}
+
+static void* _poolRealloc (void* ptr, size_t oldSz, size_t sz, void* userData)
+{
+    if (oldSz > POOL_MAX_SZ && sz > POOL_MAX_SZ)
+        return realloc (ptr, sz);
+    // Blocks can grow up to the size of their class in place
+    if (oldSz <= POOL_MAX_SZ && sz <= POOL_MAX_SZ &&
+        _poolClass (sz) <= _poolClass (oldSz))
+    {
+        return ptr;
+    }
+    void* res = _poolAlloc (sz, userData);
+    if (!res)
+        return NULL;
+    memcpy (res, ptr, (oldSz < sz) ? oldSz : sz);
+    _poolFree (ptr, oldSz, userData);
+    return res;
+}
+
+static const ConfAllocator_t poolAlloc = {_poolAlloc,
+                                          _poolRealloc,
+                                          _poolFree,
+                                          NULL};
+
+LIBCONF_PUBLIC const ConfAllocator_t* ConfGetPoolAllocator (void)
+{
+    return &poolAlloc;
+}
+
+LIBCONF_PUBLIC void ConfFreePool (void)
+{
+    _confMutexLock (&poolLock);
+    poolChunk_t* chunk = poolChunks;
+    poolChunks = NULL;
+    __atomic_add_fetch (&poolGen, 1, __ATOMIC_RELEASE);
+    _confMutexUnlock (&poolLock);
+    while (chunk)
+    {
+        poolChunk_t* next = chunk->next;
+        free (chunk);
+        chunk = next;
+    }
+}
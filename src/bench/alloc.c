@@ -0,0 +1,140 @@
+/*
+    alloc.c - contains allocation counting for benchmarks
+    Copyright 2022 The NexNix Project
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+         http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+/// @file alloc.c
+
+#include "alloc.h"
+#include <stddef.h>
+#include <stdlib.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+// Allocations are counted by replacing malloc and friends. glibc lets programs
+// do that, and exports its own versions under other names for us to call
+#ifdef __GLIBC__
+extern void* __libc_malloc (size_t sz);
+extern void* __libc_calloc (size_t num, size_t sz);
+extern void* __libc_realloc (void* ptr, size_t sz);
+extern void __libc_free (void* ptr);
+
+static volatile int counting = 0;
+static uint64_t numAllocs = 0;
+static uint64_t numFrees = 0;
+static uint64_t numBytes = 0;
+static int64_t curBytes = 0;
+static int64_t peakBytes = 0;
+
+// Counts an allocation. ConfInitMany allocates from several threads, so the
+// counters are atomic
+static inline void _benchCount (uint64_t* counter, uint64_t val)
+{
+    if (counting)
+        __atomic_fetch_add (counter, val, __ATOMIC_RELAXED);
+}
+
+// Tracks the number of bytes in use. Blocks are measured by the allocator, so
+// frees can be counted too. The peak is only exact for one thread
+static inline void _benchTrack (void* ptr, int sign)
+{
+    if (!counting || !ptr)
+        return;
+    int64_t sz = (int64_t) malloc_usable_size (ptr) * sign;
+    int64_t cur = __atomic_add_fetch (&curBytes, sz, __ATOMIC_RELAXED);
+    if (cur > peakBytes)
+        peakBytes = cur;
+}
+
+void* malloc (size_t sz)
+{
+    _benchCount (&numAllocs, 1);
+    _benchCount (&numBytes, sz);
+    void* ptr = __libc_malloc (sz);
+    _benchTrack (ptr, 1);
+    return ptr;
+}
+
+void* calloc (size_t num, size_t sz)
+{
+    _benchCount (&numAllocs, 1);
+    _benchCount (&numBytes, num * sz);
+    void* ptr = __libc_calloc (num, sz);
+    _benchTrack (ptr, 1);
+    return ptr;
+}
+
+void* realloc (void* ptr, size_t sz)
+{
+    _benchCount (&numAllocs, 1);
+    _benchCount (&numBytes, sz);
+    _benchTrack (ptr, -1);
+    void* newPtr = __libc_realloc (ptr, sz);
+    // If it failed, the old block is still there. A size of 0 frees it though
+    if (newPtr || sz)
+        _benchTrack (newPtr ? newPtr : ptr, 1);
+    return newPtr;
+}
+
+void free (void* ptr)
+{
+    if (ptr)
+        _benchCount (&numFrees, 1);
+    _benchTrack (ptr, -1);
+    __libc_free (ptr);
+}
+
+bool benchAllocSupported (void)
+{
+    return true;
+}
+
+void benchAllocStart (void)
+{
+    numAllocs = 0;
+    numFrees = 0;
+    numBytes = 0;
+    curBytes = 0;
+    peakBytes = 0;
+    counting = 1;
+}
+
+void benchAllocStop (benchAllocs_t* allocs)
+{
+    counting = 0;
+    allocs->allocs = numAllocs;
+    allocs->frees = numFrees;
+    allocs->bytes = numBytes;
+    allocs->peak = (uint64_t) peakBytes;
+}
+#else
+bool benchAllocSupported (void)
+{
+    return false;
+}
+
+void benchAllocStart (void)
+{
+}
+
+void benchAllocStop (benchAllocs_t* allocs)
+{
+    allocs->allocs = 0;
+    allocs->frees = 0;
+    allocs->bytes = 0;
+    allocs->peak = 0;
+}
+#endif
@@ -0,0 +1,51 @@
+/*
+    alloc.h - contains allocation counting header
+    Copyright 2022 The NexNix Project
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+         http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+/// @file alloc.h
+
+#ifndef _ALLOC_H
+#define _ALLOC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/// Allocation counters
+typedef struct _benchAllocs
+{
+    uint64_t allocs;    ///< Number of allocations
+    uint64_t frees;     ///< Number of frees
+    uint64_t bytes;     ///< Bytes allocated
+    uint64_t peak;      ///< Most bytes allocated at once since counting started
+} benchAllocs_t;
+
+/**
+ * @brief Checks if allocations can be counted on this platform
+ */
+bool benchAllocSupported (void);
+
+/**
+ * @brief Resets the allocation counters and starts counting
+ */
+void benchAllocStart (void);
+
+/**
+ * @brief Stops counting allocations
+ * @param[out] allocs the counts since benchAllocStart
+ */
+void benchAllocStop (benchAllocs_t* allocs);
+
+#endif
@@ -0,0 +1,249 @@
+/*
+    bench.c - contains libconf benchmark suite
+    Copyright 2022 The NexNix Project
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+         http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+/// @file bench.c
+
+#include "bench.h"
+#include "internal.h"
+#include <errno.h>
+#include <libconf.h>
+#include <libnex/progname.h>
+#include <locale.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// Results of one parse
+typedef struct _benchSample
+{
+    uint64_t parseNs;          // Time spent in ConfInitEx
+    uint64_t freeNs;           // Time spent in ConfFreeParseTree
+    benchAllocs_t parse;       // Allocations made by ConfInitEx
+    benchAllocs_t teardown;    // Allocations freed by ConfFreeParseTree
+} benchSample_t;
+
+static void _benchUsage (void)
+{
+    printf ("usage: conf_bench [-n ITERATIONS] [-s SCALE] [-d DIR] [WORKLOAD...]\n");
+    printf ("workloads:\n");
+    for (const benchGen_t* gen = benchGens; gen->name; ++gen)
+        printf ("    %-10s %s\n", gen->name, gen->desc);
+}
+
+static uint64_t _benchNow (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+
+static int _benchCompare (const void* a, const void* b)
+{
+    uint64_t left = *((const uint64_t*) a);
+    uint64_t right = *((const uint64_t*) b);
+    return (left > right) - (left < right);
+}
+
+// Gets a percentile of a sorted array of times
+static uint64_t _benchPercentile (const uint64_t* times, int num, int pct)
+{
+    int idx = ((num * pct) + 99) / 100 - 1;
+    if (idx < 0)
+        idx = 0;
+    return times[idx];
+}
+
+// Counts the tokens in the generated files
+static uint64_t _benchCountTokens (const benchFiles_t* files)
+{
+    uint64_t numToks = 0;
+    for (size_t i = 0; i < files->num; ++i)
+    {
+        lexState_t* state = _confLexInit (files->names[i], NULL, NULL);
+        if (!state)
+            return 0;
+        while (1)
+        {
+            _confToken_t* tok = _confLex (state);
+            if (tok->type == LEX_TOKEN_NONE || tok->type == LEX_TOKEN_EOF ||
+                tok->type == LEX_TOKEN_ERROR)
+            {
+                break;
+            }
+            ++numToks;
+        }
+        _confLexDestroy (state);
+    }
+    return numToks;
+}
+
+// Runs one workload
+static bool _benchRun (const benchGen_t* gen, int scale, int iterations)
+{
+    benchFiles_t files = {0};
+    if (!gen->generate (scale, &files))
+    {
+        fprintf (stderr, "conf_bench: unable to generate %s\n", gen->name);
+        benchFreeFiles (&files);
+        return false;
+    }
+    uint64_t numToks = _benchCountTokens (&files);
+    benchSample_t* samples = calloc (iterations, sizeof (benchSample_t));
+    uint64_t* times = calloc (iterations, sizeof (uint64_t));
+    if (!samples || !times)
+        goto error;
+    ConfOptions_t opts = {0};
+    opts.lexThreads = gen->lexThreads;
+    // Warm up the page cache
+    ListHead_t* list = ConfInitEx (files.names[0], &opts);
+    if (!list)
+        goto error;
+    ConfFreeParseTree (list);
+    for (int i = 0; i < iterations; ++i)
+    {
+        benchSample_t* sample = &samples[i];
+        benchAllocStart();
+        uint64_t start = _benchNow();
+        list = ConfInitEx (files.names[0], &opts);
+        uint64_t end = _benchNow();
+        benchAllocStop (&sample->parse);
+        if (!list)
+            goto error;
+        sample->parseNs = end - start;
+        benchAllocStart();
+        start = _benchNow();
+        ConfFreeParseTree (list);
+        end = _benchNow();
+        benchAllocStop (&sample->teardown);
+        sample->freeNs = end - start;
+    }
+    // Report parse times
+    for (int i = 0; i < iterations; ++i)
+        times[i] = samples[i].parseNs;
+    qsort (times, iterations, sizeof (uint64_t), _benchCompare);
+    uint64_t median = _benchPercentile (times, iterations, 50);
+    double secs = (double) (median ? median : 1) / 1e9;
+    printf ("%-10s %5zu %10zu %9.2f %9.2f %9.1f %9.1f %9.1f",
+            gen->name,
+            files.num,
+            files.bytes,
+            ((double) files.bytes / (1024 * 1024)) / secs,
+            ((double) numToks / 1e6) / secs,
+            (double) median / 1e3,
+            (double) _benchPercentile (times, iterations, 90) / 1e3,
+            (double) _benchPercentile (times, iterations, 99) / 1e3);
+    // Report teardown times
+    for (int i = 0; i < iterations; ++i)
+        times[i] = samples[i].freeNs;
+    qsort (times, iterations, sizeof (uint64_t), _benchCompare);
+    printf (" %9.1f", (double) _benchPercentile (times, iterations, 50) / 1e3);
+    if (benchAllocSupported())
+    {
+        printf (" %9llu %9llu %9llu %9llu\n",
+                (unsigned long long) samples[0].parse.allocs,
+                (unsigned long long) samples[0].parse.bytes / 1024,
+                (unsigned long long) samples[0].parse.peak / 1024,
+                (unsigned long long) samples[0].teardown.frees);
+    }
+    else
+        printf (" %9s %9s %9s %9s\n", "n/a", "n/a", "n/a", "n/a");
+    free (samples);
+    free (times);
+    benchFreeFiles (&files);
+    return true;
+error:
+    fprintf (stderr, "conf_bench: %s failed\n", gen->name);
+    free (samples);
+    free (times);
+    benchFreeFiles (&files);
+    return false;
+}
+
+int main (int argc, char** argv)
+{
+    setlocale (LC_ALL, "");
+    setprogname ("conf_bench");
+    int iterations = 20, scale = 10;
+    const char* dir = "conf_bench_data";
+    int arg = 1;
+    for (; arg < argc && argv[arg][0] == '-'; ++arg)
+    {
+        if (!strcmp (argv[arg], "-h"))
+        {
+            _benchUsage();
+            return 0;
+        }
+        if ((arg + 1) >= argc)
+        {
+            _benchUsage();
+            return 1;
+        }
+        if (!strcmp (argv[arg], "-n"))
+            iterations = atoi (argv[++arg]);
+        else if (!strcmp (argv[arg], "-s"))
+            scale = atoi (argv[++arg]);
+        else if (!strcmp (argv[arg], "-d"))
+            dir = argv[++arg];
+        else
+        {
+            _benchUsage();
+            return 1;
+        }
+    }
+    if (iterations < 1 || scale < 1)
+    {
+        _benchUsage();
+        return 1;
+    }
+    // Files are generated into dir, and includes are relative to it
+    if ((mkdir (dir, 0755) && errno != EEXIST) || chdir (dir))
+    {
+        fprintf (stderr, "conf_bench: %s: %s\n", dir, strerror (errno));
+        return 1;
+    }
+    printf ("%-10s %5s %10s %9s %9s %9s %9s %9s %9s %9s %9s %9s %9s\n",
+            "workload",
+            "files",
+            "bytes",
+            "MB/s",
+            "Mtok/s",
+            "p50(us)",
+            "p90(us)",
+            "p99(us)",
+            "free(us)",
+            "allocs",
+            "alloc(KB)",
+            "peak(KB)",
+            "frees");
+    bool res = true;
+    for (const benchGen_t* gen = benchGens; gen->name; ++gen)
+    {
+        // Run everything if nothing was picked
+        bool picked = (arg == argc);
+        for (int i = arg; i < argc; ++i)
+        {
+            if (!strcmp (argv[i], gen->name))
+                picked = true;
+        }
+        if (picked && !_benchRun (gen, scale, iterations))
+            res = false;
+    }
+    return !res;
+}
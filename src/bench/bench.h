@@ -0,0 +1,54 @@
+/*
+    bench.h - contains benchmark suite header
+    Copyright 2022 The NexNix Project
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+         http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+/// @file bench.h
+
+#ifndef _BENCH_H
+#define _BENCH_H
+
+#include "alloc.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// Files written by a generator
+typedef struct _benchFiles
+{
+    char** names;    ///< Names of files. The first one is the file to parse
+    size_t num;      ///< Number of files
+    size_t bytes;    ///< Total size of all files
+} benchFiles_t;
+
+/// A config generator
+typedef struct _benchGen
+{
+    const char* name;                                     ///< Name of workload
+    const char* desc;                                     ///< Description of it
+    bool (*generate) (int scale, benchFiles_t* files);    ///< Writes the files
+    int lexThreads;                                       ///< Threads to lex with
+} benchGen_t;
+
+/// Table of generators, terminated by an entry with a NULL name
+extern const benchGen_t benchGens[];
+
+/**
+ * @brief Frees the names in a file list
+ * @param files the list to free
+ */
+void benchFreeFiles (benchFiles_t* files);
+
+#endif
@@ -0,0 +1,334 @@
+/*
+    gen.c - contains benchmark config generators
+    Copyright 2022 The NexNix Project
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+         http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+/// @file gen.c
+
+#include "bench.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Generators are deterministic, so results can be compared between runs. Each
+// generator seeds its own random number generator
+typedef struct _genState
+{
+    char* buf;        // Text of file being generated
+    size_t len;       // Length of text
+    size_t maxLen;    // Size of buf
+    uint64_t rand;    // State of random number generator
+    bool failed;      // Did an allocation fail?
+} genState_t;
+
+// Gets a random number in [0, max)
+static uint32_t _genRand (genState_t* gen, uint32_t max)
+{
+    // xorshift64
+    gen->rand ^= gen->rand << 13;
+    gen->rand ^= gen->rand >> 7;
+    gen->rand ^= gen->rand << 17;
+    return (uint32_t) (gen->rand % max);
+}
+
+// Appends formatted text to the file
+static void _genPrintf (genState_t* gen, const char* fmt, ...)
+{
+    va_list ap;
+    while (!gen->failed)
+    {
+        va_start (ap, fmt);
+        int len = vsnprintf (gen->buf + gen->len, gen->maxLen - gen->len, fmt, ap);
+        va_end (ap);
+        if (len < 0)
+        {
+            gen->failed = true;
+            return;
+        }
+        if ((gen->len + len) < gen->maxLen)
+        {
+            gen->len += len;
+            return;
+        }
+        size_t maxLen = gen->maxLen ? (gen->maxLen * 2) : 65536;
+        while (maxLen <= (gen->len + len))
+            maxLen *= 2;
+        char* buf = realloc (gen->buf, maxLen);
+        if (!buf)
+            gen->failed = true;
+        else
+        {
+            gen->buf = buf;
+            gen->maxLen = maxLen;
+        }
+    }
+}
+
+static void _genInit (genState_t* gen, uint64_t seed)
+{
+    memset (gen, 0, sizeof (genState_t));
+    gen->rand = seed;
+    _genPrintf (gen, "");
+}
+
+// Adds a file name to the list
+static bool _genAddName (benchFiles_t* files, const char* name)
+{
+    char** names = realloc (files->names, (files->num + 1) * sizeof (char*));
+    if (!names)
+        return false;
+    files->names = names;
+    names[files->num] = malloc (strlen (name) + 1);
+    if (!names[files->num])
+        return false;
+    strcpy (names[files->num++], name);
+    return true;
+}
+
+// Writes out a generated file, optionally as UTF-16LE
+static bool _genWrite (genState_t* gen,
+                       benchFiles_t* files,
+                       const char* name,
+                       bool utf16)
+{
+    bool res = false;
+    if (gen->failed)
+        goto end;
+    FILE* file = fopen (name, "wb");
+    if (!file)
+        goto end;
+    size_t written = 0;
+    if (!utf16)
+        written = fwrite (gen->buf, 1, gen->len, file);
+    else
+    {
+        // Convert UTF-8 to UTF-16LE with a BOM
+        uint8_t bom[] = {0xFF, 0xFE};
+        written = fwrite (bom, 1, 2, file);
+        const uint8_t* s = (const uint8_t*) gen->buf;
+        size_t i = 0;
+        while (i < gen->len)
+        {
+            uint32_t c = s[i];
+            size_t sz = 1;
+            if (c >= 0xF0)
+                c = c & 0x07, sz = 4;
+            else if (c >= 0xE0)
+                c = c & 0x0F, sz = 3;
+            else if (c >= 0xC0)
+                c = c & 0x1F, sz = 2;
+            for (size_t j = 1; j < sz; ++j)
+                c = (c << 6) | (s[i + j] & 0x3F);
+            i += sz;
+            uint8_t units[4];
+            size_t numBytes = 2;
+            if (c >= 0x10000)
+            {
+                uint32_t hi = 0xD800 + ((c - 0x10000) >> 10);
+                uint32_t lo = 0xDC00 + ((c - 0x10000) & 0x3FF);
+                units[0] = hi & 0xFF, units[1] = hi >> 8;
+                units[2] = lo & 0xFF, units[3] = lo >> 8;
+                numBytes = 4;
+            }
+            else
+                units[0] = c & 0xFF, units[1] = c >> 8;
+            written += fwrite (units, 1, numBytes, file);
+        }
+    }
+    bool ok = !ferror (file);
+    if (fclose (file) || !ok)
+        goto end;
+    files->bytes += written;
+    res = _genAddName (files, name);
+end:
+    free (gen->buf);
+    gen->buf = NULL;
+    return res;
+}
+
+// Writes a random value
+static void _genValue (genState_t* gen)
+{
+    switch (_genRand (gen, 4))
+    {
+        case 0:
+            _genPrintf (gen, "%u", _genRand (gen, 100000));
+            break;
+        case 1:
+            _genPrintf (gen, "0x%x", _genRand (gen, 0x10000));
+            break;
+        case 2:
+            _genPrintf (gen, "'value %u'", _genRand (gen, 1000));
+            break;
+        case 3:
+            _genPrintf (gen, "ident%u", _genRand (gen, 100));
+            break;
+    }
+}
+
+// Writes a block with numProps properties
+static void _genBlock (genState_t* gen, int idx, int numProps)
+{
+    _genPrintf (gen, "block%d name%d\n{\n", idx % 16, idx);
+    for (int i = 0; i < numProps; ++i)
+    {
+        _genPrintf (gen, "    prop%d: ", i);
+        int numVals = 1 + _genRand (gen, 3);
+        for (int j = 0; j < numVals; ++j)
+        {
+            if (j)
+                _genPrintf (gen, ", ");
+            _genValue (gen);
+        }
+        _genPrintf (gen, ";\n");
+    }
+    _genPrintf (gen, "}\n\n");
+}
+
+// Many blocks with a few properties each
+static bool _genSmallBlocks (int scale, benchFiles_t* files)
+{
+    genState_t gen;
+    _genInit (&gen, 1);
+    for (int i = 0; i < (scale * 2000); ++i)
+        _genBlock (&gen, i, 1 + _genRand (&gen, 4));
+    return _genWrite (&gen, files, "small.conf", false);
+}
+
+// A few blocks with very many properties
+static bool _genHugeBlocks (int scale, benchFiles_t* files)
+{
+    genState_t gen;
+    _genInit (&gen, 2);
+    for (int i = 0; i < 4; ++i)
+        _genBlock (&gen, i, scale * 2000);
+    return _genWrite (&gen, files, "huge.conf", false);
+}
+
+// Writes include file idx and its children
+static bool _genIncludeTree (int idx, int depth, benchFiles_t* files)
+{
+    char name[64];
+    snprintf (name, 64, "include%d.conf", idx);
+    genState_t gen;
+    _genInit (&gen, 3 + idx);
+    if (depth)
+    {
+        _genPrintf (&gen, "include 'include%d.conf'\n", (idx * 2) + 1);
+        _genPrintf (&gen, "include 'include%d.conf'\n\n", (idx * 2) + 2);
+    }
+    for (int i = 0; i < 8; ++i)
+        _genBlock (&gen, i, 1 + _genRand (&gen, 4));
+    if (!_genWrite (&gen, files, name, false))
+        return false;
+    if (depth)
+    {
+        if (!_genIncludeTree ((idx * 2) + 1, depth - 1, files) ||
+            !_genIncludeTree ((idx * 2) + 2, depth - 1, files))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// A binary tree of files including each other
+static bool _genIncludes (int scale, benchFiles_t* files)
+{
+    // Each level doubles the number of files
+    int depth = 5;
+    for (int i = 1; i < scale; i *= 2)
+        ++depth;
+    return _genIncludeTree (0, depth, files);
+}
+
+// Blocks with more comments than content
+static bool _genComments (int scale, benchFiles_t* files)
+{
+    genState_t gen;
+    _genInit (&gen, 4);
+    _genPrintf (&gen, "/*\n    Generated file\n    with a header comment\n*/\n\n");
+    for (int i = 0; i < (scale * 1000); ++i)
+    {
+        _genPrintf (&gen, "# Block %d does something important\n", i);
+        _genPrintf (&gen, "// and this is what it does\n");
+        _genPrintf (&gen, "block name%d\n{\n", i);
+        for (int j = 0; j < 3; ++j)
+        {
+            _genPrintf (&gen, "    /* property %d, with a long comment */\n", j);
+            _genPrintf (&gen, "    prop%d: ", j);
+            _genValue (&gen);
+            _genPrintf (&gen, "; // trailing comment\n");
+        }
+        _genPrintf (&gen, "}\n\n");
+    }
+    return _genWrite (&gen, files, "comments.conf", false);
+}
+
+// Properties whose values are long strings
+static bool _genStrings (int scale, benchFiles_t* files)
+{
+    genState_t gen;
+    _genInit (&gen, 5);
+    for (int i = 0; i < (scale * 1000); ++i)
+    {
+        _genPrintf (&gen, "block name%d\n{\n", i);
+        _genPrintf (&gen, "    path: '/usr/share/config/%d/file.conf';\n", i);
+        _genPrintf (&gen,
+                    "    desc: 'A longer description of block %d, which \\\n"
+                    "           continues on the next line';\n",
+                    i);
+        _genPrintf (&gen, "    quoted: \"It's \\\"quoted\\\"\\n\";\n");
+        _genPrintf (&gen, "    list: 'one', 'two', 'three', 'four \\' five';\n");
+        _genPrintf (&gen, "}\n\n");
+    }
+    return _genWrite (&gen, files, "strings.conf", false);
+}
+
+// Non-ASCII text stored as UTF-16
+static bool _genUtf16 (int scale, benchFiles_t* files)
+{
+    genState_t gen;
+    _genInit (&gen, 6);
+    for (int i = 0; i < (scale * 1000); ++i)
+    {
+        _genPrintf (&gen, "block name%d\n{\n", i);
+        _genPrintf (&gen, "    greeting: 'Grüße, ¡hola!, こんにちは';\n");
+        _genPrintf (&gen, "    symbols: '€ ← → ∀ 🙂';\n");
+        _genPrintf (&gen, "    num: %u;\n", _genRand (&gen, 100000));
+        _genPrintf (&gen, "}\n\n");
+    }
+    return _genWrite (&gen, files, "utf16.conf", true);
+}
+
+const benchGen_t benchGens[] = {
+    {"small", "many small blocks", _genSmallBlocks, 0},
+    {"huge", "a few huge blocks", _genHugeBlocks, 0},
+    {"includes", "deep include tree", _genIncludes, 0},
+    {"comments", "comment heavy", _genComments, 0},
+    {"strings", "string heavy", _genStrings, 0},
+    {"utf16", "UTF-16 input", _genUtf16, 0},
+    {"lex2", "string heavy, lexed on 2 threads", _genStrings, 2},
+    {"lex4", "string heavy, lexed on 4 threads", _genStrings, 4},
+    {NULL, NULL, NULL, 0}};
+
+void benchFreeFiles (benchFiles_t* files)
+{
+    for (size_t i = 0; i < files->num; ++i)
+        free (files->names[i]);
+    free (files->names);
+    memset (files, 0, sizeof (benchFiles_t));
+}
@@ -19,32 +19,124 @@
 
 #include "internal.h"
 #include <libconf.h>
+#include <libnex/safemalloc.h>
+#include <limits.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-// The name of the file being read
-static const char* fileName = NULL;
+// The name of the file this thread is reading. Diagnostics take the file name
+// from the lexer, this is only kept for ConfGetFileName
+static _Thread_local const char* fileName = NULL;
+
+// A batch of files being parsed by ConfInitMany
+typedef struct _confBatch
+{
+    const char** files;           // Files to parse
+    const ConfOptions_t* opts;    // Options to parse them with
+    ListHead_t** trees;           // Resulting parse trees
+    _confFileCache_t cache;       // Files looked up so far
+#ifdef LIBCONF_ENABLE_STATS
+    ConfStats_t* stats;           // Statistics of each file
+#endif
+} confBatch_t;
 
 LIBCONF_PUBLIC ListHead_t* ConfInit (const char* file)
+{
+    return ConfInitEx (file, NULL);
+}
+
+LIBCONF_PUBLIC ListHead_t* ConfInitEx (const char* file, const ConfOptions_t* opts)
 {
     fileName = file;
-    return _confParse (file);
+    STATS_RESET();
+    STATS_START (start);
+    const ConfAllocator_t* prevAlloc =
+        _confSetAllocator (opts ? opts->alloc : NULL);
+    ListHead_t* list = _confParse (file, opts, NULL);
+    _confSetAllocator (prevAlloc);
+    STATS_FINISH (start);
+    return list;
 }
 
-LIBCONF_PUBLIC const char* ConfGetFileName (void)
+// Parses one file of a batch
+static void _confParseBatch (void* data, int idx)
 {
-    return fileName;
+    confBatch_t* batch = data;
+    STATS_RESET();
+    STATS_START (start);
+    batch->trees[idx] = _confParse (batch->files[idx], batch->opts, &batch->cache);
+    STATS_FINISH (start);
+#ifdef LIBCONF_ENABLE_STATS
+    batch->stats[idx] = _confStats;
+#endif
 }
 
-LIBCONF_PUBLIC void _confSetFileName (const char* file)
+LIBCONF_PUBLIC ListHead_t** ConfInitMany (const char** files,
+                                          size_t count,
+                                          const ConfOptions_t* opts)
 {
-    fileName = file;
+    if (count > INT_MAX)
+        return NULL;
+    STATS_RESET();
+    // Workers inherit the allocator from this thread
+    const ConfAllocator_t* prevAlloc =
+        _confSetAllocator (opts ? opts->alloc : NULL);
+    confBatch_t batch = {0};
+    batch.files = files;
+    batch.opts = opts;
+    batch.trees = _confCalloc ((count ? count : 1) * sizeof (ListHead_t*));
+    if (!batch.trees)
+        goto done;
+#ifdef LIBCONF_ENABLE_STATS
+    batch.stats = _confCalloc ((count ? count : 1) * sizeof (ConfStats_t));
+    if (!batch.stats)
+    {
+        _confFree (batch.trees);
+        batch.trees = NULL;
+        goto done;
+    }
+#endif
+    _confFileCacheInit (&batch.cache);
+    int threads = (opts && opts->parseThreads > 0) ? opts->parseThreads
+                                                    : _confNumCpus();
+    _confRunPool ((int) count, threads, _confParseBatch, &batch);
+    _confFileCacheDestroy (&batch.cache);
+#ifdef LIBCONF_ENABLE_STATS
+    // Add up the statistics of every file
+    ConfStats_t total = {0};
+    for (size_t i = 0; i < count; ++i)
+        _confStatsAdd (&total, &batch.stats[i]);
+    _confFree (batch.stats);
+    _confStats = total;
+#endif
+done:
+    _confSetAllocator (prevAlloc);
+    return batch.trees;
+}
+
+LIBCONF_PUBLIC void ConfFreeMany (ListHead_t** trees, size_t count)
+{
+    if (!trees)
+        return;
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (trees[i])
+            ConfFreeParseTree (trees[i]);
+    }
+    _confFree (trees);
+}
+
+LIBCONF_PUBLIC const char* ConfGetFileName (void)
+{
+    return fileName;
 }
 
 LIBCONF_PUBLIC void ConfFreeParseTree (ListHead_t* list)
 {
     // Destroy the list
+    STATS_START (start);
     ListDestroy (list);
+    STATS_END (teardownNs, start);
 }
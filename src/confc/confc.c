@@ -0,0 +1,300 @@
+/*
+    confc.c - contains configuration compiler
+    Copyright 2022 The NexNix Project
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+         http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+/// @file confc.c
+
+/*
+ * confc parses a configuration file at build time, and writes it out as C
+ * source. The source defines a ConfView_t and the arrays it points to as const
+ * data, laid out like ConfFreeze lays them out, so programs get the same view
+ * without parsing anything when they start
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <libconf.h>
+#include <libnex/progname.h>
+#include <locale.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void _confcUsage (void)
+{
+    printf ("usage: confc [-n NAME] [-o OUTPUT] FILE\n");
+    printf ("writes OUTPUT.c and OUTPUT.h, which define the view NAME of FILE\n");
+}
+
+// Makes a C identifier out of the name of a file, without its directory or
+// extension
+static char* _confcMakeName (const char* file)
+{
+    const char* start = strrchr (file, '/');
+    start = start ? (start + 1) : file;
+    const char* end = strchr (start, '.');
+    size_t len = end ? (size_t) (end - start) : strlen (start);
+    char* name = malloc (len + 2);
+    if (!name)
+        return NULL;
+    char* out = name;
+    if (!len || isdigit ((unsigned char) *start))
+        *out++ = '_';
+    for (size_t i = 0; i < len; ++i)
+        *out++ = isalnum ((unsigned char) start[i]) ? start[i] : '_';
+    *out = '\0';
+    return name;
+}
+
+// Writes a string as a UTF-32 literal
+static void _confcWriteString (FILE* out, const char32_t* str)
+{
+    if (!str)
+    {
+        fputs ("NULL", out);
+        return;
+    }
+    fputs ("U\"", out);
+    for (; *str; ++str)
+    {
+        char32_t c = *str;
+        // Question marks are escaped so they can't start trigraphs
+        if (c == '"' || c == '\\' || c == '?')
+            fprintf (out, "\\%c", (char) c);
+        else if (c >= 0x20 && c < 0x7F)
+            fputc ((char) c, out);
+        else
+            fprintf (out, "\\U%08X", (unsigned int) c);
+    }
+    fputc ('"', out);
+}
+
+// Writes a number as a C constant
+static void _confcWriteNum (FILE* out, int64_t num)
+{
+    // The smallest number can't be written as a literal
+    if (num == INT64_MIN)
+        fputs ("(-INT64_C (9223372036854775807) - 1)", out);
+    else
+        fprintf (out, "INT64_C (%lld)", (long long) num);
+}
+
+// Writes the source file
+static bool _confcWriteSource (FILE* out,
+                               const ConfView_t* view,
+                               const char* name,
+                               const char* header,
+                               const char* file)
+{
+    fprintf (out, "/* Generated by confc from %s. Do not edit */\n\n", file);
+    fprintf (out, "#include \"%s\"\n", header);
+    if (view->numBlocks)
+    {
+        fprintf (out, "\nstatic const ConfViewBlock_t %s_blocks[] = {\n", name);
+        for (size_t i = 0; i < view->numBlocks; ++i)
+        {
+            const ConfViewBlock_t* block = &view->blocks[i];
+            fprintf (out, "    {%d, %d, ", block->lineNo, block->colNo);
+            _confcWriteString (out, block->blockType);
+            fputs (", ", out);
+            _confcWriteString (out, block->blockName);
+            fprintf (out, ", %zu, %zu},\n", block->propStart, block->numProps);
+        }
+        fputs ("};\n", out);
+    }
+    if (view->numProps)
+    {
+        fprintf (out, "\nstatic const ConfViewProp_t %s_props[] = {\n", name);
+        for (size_t i = 0; i < view->numProps; ++i)
+        {
+            const ConfViewProp_t* prop = &view->props[i];
+            fprintf (out, "    {%d, %d, ", prop->lineNo, prop->colNo);
+            _confcWriteString (out, prop->name);
+            fprintf (out, ", %zu, %zu},\n", prop->valStart, prop->numVals);
+        }
+        fputs ("};\n", out);
+    }
+    if (view->numVals)
+    {
+        fprintf (out, "\nstatic const ConfViewVal_t %s_vals[] = {\n", name);
+        for (size_t i = 0; i < view->numVals; ++i)
+        {
+            const ConfViewVal_t* val = &view->vals[i];
+            fprintf (out,
+                     "    {%d, %d, %d, %d, ",
+                     val->lineNo,
+                     val->colNo,
+                     val->type,
+                     val->base);
+            if (val->type == DATATYPE_NUMBER)
+            {
+                fputs (".numVal = ", out);
+                _confcWriteNum (out, val->numVal);
+            }
+            else
+            {
+                fputs ((val->type == DATATYPE_STRING) ? ".str = " : ".id = ", out);
+                _confcWriteString (out, val->str);
+            }
+            fputs ("},\n", out);
+        }
+        fputs ("};\n", out);
+    }
+    // Empty arrays aren't allowed in C, so those are left out
+    fprintf (out, "\nconst ConfView_t %s = {\n", name);
+    if (view->numBlocks)
+        fprintf (out, "    %s_blocks,\n", name);
+    else
+        fputs ("    NULL,\n", out);
+    fprintf (out, "    %zu,\n", view->numBlocks);
+    if (view->numProps)
+        fprintf (out, "    %s_props,\n", name);
+    else
+        fputs ("    NULL,\n", out);
+    fprintf (out, "    %zu,\n", view->numProps);
+    if (view->numVals)
+        fprintf (out, "    %s_vals,\n", name);
+    else
+        fputs ("    NULL,\n", out);
+    fprintf (out, "    %zu,\n};\n", view->numVals);
+    return !ferror (out);
+}
+
+// Writes the header file
+static bool _confcWriteHeader (FILE* out, const char* name, const char* file)
+{
+    fprintf (out, "/* Generated by confc from %s. Do not edit */\n\n", file);
+    fprintf (out, "#ifndef _CONFC_%s_H\n", name);
+    fprintf (out, "#define _CONFC_%s_H\n\n", name);
+    fputs ("#include <libconf.h>\n\n", out);
+    fputs ("#ifdef __cplusplus\nextern \"C\"\n{\n#endif\n\n", out);
+    fprintf (out, "/// View of %s. It is never freed\n", file);
+    fprintf (out, "extern const ConfView_t %s;\n\n", name);
+    fputs ("#ifdef __cplusplus\n}\n#endif\n\n#endif\n", out);
+    return !ferror (out);
+}
+
+// Writes OUTPUT.h or OUTPUT.c, and removes it if that failed
+static bool _confcWriteFile (const char* path,
+                             const char* ext,
+                             bool isHeader,
+                             const ConfView_t* view,
+                             const char* name,
+                             const char* file)
+{
+    char* outPath = malloc (strlen (path) + strlen (ext) + 1);
+    if (!outPath)
+        return false;
+    strcpy (outPath, path);
+    strcat (outPath, ext);
+    FILE* out = fopen (outPath, "w");
+    if (!out)
+    {
+        fprintf (stderr, "confc: %s: %s\n", outPath, strerror (errno));
+        free (outPath);
+        return false;
+    }
+    bool res = false;
+    if (isHeader)
+        res = _confcWriteHeader (out, name, file);
+    else
+    {
+        // The source includes the header from its own directory
+        const char* header = strrchr (path, '/');
+        header = header ? (header + 1) : path;
+        char* headerName = malloc (strlen (header) + 3);
+        if (headerName)
+        {
+            strcpy (headerName, header);
+            strcat (headerName, ".h");
+            res = _confcWriteSource (out, view, name, headerName, file);
+            free (headerName);
+        }
+    }
+    if (fclose (out) || !res)
+    {
+        fprintf (stderr, "confc: unable to write %s\n", outPath);
+        remove (outPath);
+        free (outPath);
+        return false;
+    }
+    free (outPath);
+    return true;
+}
+
+int main (int argc, char** argv)
+{
+    setlocale (LC_ALL, "");
+    setprogname ("confc");
+    const char* name = NULL;
+    const char* output = NULL;
+    int arg = 1;
+    for (; arg < argc && argv[arg][0] == '-'; ++arg)
+    {
+        if (!strcmp (argv[arg], "-h"))
+        {
+            _confcUsage();
+            return 0;
+        }
+        if ((arg + 1) >= argc)
+        {
+            _confcUsage();
+            return 1;
+        }
+        if (!strcmp (argv[arg], "-n"))
+            name = argv[++arg];
+        else if (!strcmp (argv[arg], "-o"))
+            output = argv[++arg];
+        else
+        {
+            _confcUsage();
+            return 1;
+        }
+    }
+    if ((arg + 1) != argc)
+    {
+        _confcUsage();
+        return 1;
+    }
+    const char* file = argv[arg];
+    char* madeName = name ? NULL : _confcMakeName (file);
+    if (!name && !madeName)
+        return 1;
+    if (!name)
+        name = madeName;
+    if (!output)
+        output = name;
+    // The parser reports what went wrong itself
+    ListHead_t* list = ConfInit (file);
+    if (!list)
+    {
+        free (madeName);
+        return 1;
+    }
+    ConfView_t* view = ConfFreeze (list);
+    ConfFreeParseTree (list);
+    if (!view)
+    {
+        fprintf (stderr, "confc: out of memory\n");
+        free (madeName);
+        return 1;
+    }
+    bool res = _confcWriteFile (output, ".h", true, view, name, file) &&
+               _confcWriteFile (output, ".c", false, view, name, file);
+    ConfFreeView (view);
+    free (madeName);
+    return !res;
+}
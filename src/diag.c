@@ -0,0 +1,225 @@
+/*
+    diag.c - contains diagnostic reporting
+    Copyright 2022 The NexNix Project
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+         http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+/// @file diag.c
+
+#include "internal.h"
+#include <libconf.h>
+#include <libnex/error.h>
+#include <libnex/safemalloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <uchar.h>
+
+// Protects diagnostic lists, as ConfInitMany may report to one from several
+// threads
+static _confMutex_t diagLock = CONF_MUTEX_INITIALIZER;
+
+// Copies a string for a diagnostic list
+static char* _diagCopy (const char* s)
+{
+    if (!s)
+        return NULL;
+    char* res = malloc_s (strlen (s) + 1);
+    if (res)
+        strcpy (res, s);
+    return res;
+}
+
+void _confDiag (ConfDiagList_t* list, const ConfDiag_t* diag)
+{
+    if (!list)
+    {
+        char buf[2048];
+        ConfFormatDiag (diag, buf, sizeof (buf));
+        error ("%s", buf);
+        return;
+    }
+    // Diagnostics outlive the parse, so they don't come from its allocator.
+    // If they can't be saved, they are printed instead
+    _confMutexLock (&diagLock);
+    if (list->numDiags == list->maxDiags)
+    {
+        size_t maxDiags = list->maxDiags ? (list->maxDiags * 2) : 8;
+        ConfDiag_t* diags = realloc (list->diags, maxDiags * sizeof (ConfDiag_t));
+        if (!diags)
+        {
+            _confMutexUnlock (&diagLock);
+            _confDiag (NULL, diag);
+            return;
+        }
+        list->diags = diags;
+        list->maxDiags = maxDiags;
+    }
+    ConfDiag_t* res = &list->diags[list->numDiags++];
+    *res = *diag;
+    res->file = _diagCopy (diag->file);
+    res->detail = _diagCopy (diag->detail);
+    _confMutexUnlock (&diagLock);
+}
+
+LIBCONF_PUBLIC int ConfFormatDiag (const ConfDiag_t* diag, char* buf, size_t sz)
+{
+    // Internal errors aren't about the contents of the file
+    if (diag->code == CONF_DIAG_INTERNAL)
+    {
+        return snprintf (buf,
+                         sz,
+                         "internal error: %s: %s",
+                         diag->file,
+                         diag->detail);
+    }
+    int len = 0;
+    if (diag->line && diag->column)
+    {
+        len = snprintf (buf,
+                        sz,
+                        "error: %s:%d:%d: ",
+                        diag->file,
+                        diag->line,
+                        diag->column);
+    }
+    else if (diag->line)
+        len = snprintf (buf, sz, "error: %s:%d: ", diag->file, diag->line);
+    else
+        len = snprintf (buf, sz, "error: %s: ", diag->file);
+    if (len < 0)
+        return len;
+    // Keep going past the end of buf, so the full length is returned
+    char* end = ((size_t) len < sz) ? (buf + len) : NULL;
+    size_t left = end ? (sz - len) : 0;
+    const char* tok = _confLexGetTokenNameType (diag->token);
+    unsigned long long value = (unsigned long long) diag->value;
+    int res = 0;
+    switch (diag->code)
+    {
+        case CONF_DIAG_UNEXPECTED_TOKEN:
+            if (diag->prevToken != -1 && diag->expected != -1)
+            {
+                res = snprintf (end,
+                                left,
+                                "unexpected token %s after token %s (expected %s)",
+                                tok,
+                                _confLexGetTokenNameType (diag->prevToken),
+                                _confLexGetTokenNameType (diag->expected));
+            }
+            else if (diag->prevToken != -1)
+            {
+                res = snprintf (end,
+                                left,
+                                "unexpected token %s after token %s",
+                                tok,
+                                _confLexGetTokenNameType (diag->prevToken));
+            }
+            else if (diag->expected != -1)
+            {
+                res = snprintf (end,
+                                left,
+                                "unexpected token %s (expected %s)",
+                                tok,
+                                _confLexGetTokenNameType (diag->expected));
+            }
+            else
+                res = snprintf (end, left, "unexpected token %s", tok);
+            break;
+        case CONF_DIAG_TOO_MANY_VALUES:
+            res = snprintf (end, left, "too many values on property");
+            break;
+        case CONF_DIAG_MISSING_SEMICOLON:
+            res = snprintf (end, left, "expected ';' before token %s", tok);
+            break;
+        case CONF_DIAG_PROP_NO_BLOCK:
+            res = snprintf (end, left, "property declared outside of a block");
+            break;
+        case CONF_DIAG_UNKNOWN_TOKEN: {
+            // Files are UTF-8 whatever the locale is, so the token is too
+            uint8_t c[5];
+            char32_t val = (char32_t) diag->value;
+            if (diag->value < 0 || diag->value > 0x10FFFF)
+                val = 0xFFFD;
+            c[_confUtf8Encode (val, c)] = '\0';
+            res = snprintf (end, left, "Unknown token '%s'", (const char*) c);
+            break;
+        }
+        case CONF_DIAG_UNEXPECTED_EOF:
+            res = snprintf (end, left, "Unexpected EOF on token %s", tok);
+            break;
+        case CONF_DIAG_INVALID_NUMBER:
+            res = snprintf (end, left, "Invalid numeric value");
+            break;
+        case CONF_DIAG_TOO_LONG:
+            res = snprintf (end, left, "Name too long on token %s", tok);
+            break;
+        case CONF_DIAG_INVALID_VAR:
+            res = snprintf (end, left, "Invalid character in variable");
+            break;
+        case CONF_DIAG_UNTERMINATED:
+            res = snprintf (end, left, "Unexpected EOF in block");
+            break;
+        case CONF_DIAG_BYTE_LIMIT:
+            res = snprintf (end,
+                            left,
+                            "input larger than limit of %llu bytes",
+                            value);
+            break;
+        case CONF_DIAG_TOKEN_LIMIT:
+            res = snprintf (end, left, "more tokens than limit of %llu", value);
+            break;
+        case CONF_DIAG_BLOCK_LIMIT:
+            res = snprintf (end, left, "more blocks than limit of %llu", value);
+            break;
+        case CONF_DIAG_PROP_LIMIT:
+            res = snprintf (end, left, "more properties than limit of %llu", value);
+            break;
+        case CONF_DIAG_MEMORY_LIMIT:
+            res = snprintf (end,
+                            left,
+                            "parse needs more than limit of %llu bytes of memory",
+                            value);
+            break;
+        case CONF_DIAG_DEPTH_LIMIT:
+            res = snprintf (end, left, "includes nested deeper than %llu", value);
+            break;
+        case CONF_DIAG_CONFLICT:
+            res = snprintf (end, left, "property already set by an earlier tree");
+            break;
+        case CONF_DIAG_UNKNOWN_PROPERTY:
+            res = snprintf (end, left, "unknown property '%s'", diag->detail);
+            break;
+        case CONF_DIAG_BAD_VALUE:
+            res = snprintf (end, left, "bad value on property '%s'", diag->detail);
+            break;
+    }
+    return (res < 0) ? res : (len + res);
+}
+
+LIBCONF_PUBLIC void ConfReportDiag (ConfDiagList_t* list, const ConfDiag_t* diag)
+{
+    _confDiag (list, diag);
+}
+
+LIBCONF_PUBLIC void ConfFreeDiags (ConfDiagList_t* list)
+{
+    for (size_t i = 0; i < list->numDiags; ++i)
+    {
+        free ((void*) list->diags[i].file);
+        free ((void*) list->diags[i].detail);
+    }
+    free (list->diags);
+    memset (list, 0, sizeof (ConfDiagList_t));
+}
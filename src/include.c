@@ -0,0 +1,404 @@
+/*
+    include.c - contains include path expansion
+    Copyright 2022 The NexNix Project
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+         http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+/// @file include.c
+
+#include "internal.h"
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#if defined HAVE_DIRENT_H && defined HAVE_FNMATCH_H
+#include <dirent.h>
+#include <fnmatch.h>
+#define INCLUDE_CAN_SCAN
+#endif
+
+// Array of paths being collected
+typedef struct _includeList
+{
+    char** files;       // Paths found so far
+    size_t numFiles;    // Number of paths
+    size_t maxFiles;    // Space in files
+} includeList_t;
+
+// Joins the first dirLen bytes of dir and name into a path. dirLen is 0 if there
+// is no directory
+static char* _includeJoin (const char* dir, size_t dirLen, const char* name)
+{
+    size_t nameLen = strlen (name);
+    char* file = _confMalloc (dirLen + nameLen + 2);
+    if (!file)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+    if (dirLen)
+    {
+        memcpy (file, dir, dirLen);
+        if (dir[dirLen - 1] != '/')
+            file[dirLen++] = '/';
+    }
+    memcpy (file + dirLen, name, nameLen + 1);
+    return file;
+}
+
+// Gets the length of the directory part of a path, or 0 if it has none
+static size_t _includeDirLen (const char* path)
+{
+    const char* name = strrchr (path, '/');
+    if (!name)
+        return 0;
+    // Files in the root directory keep its slash
+    return (name == path) ? 1 : (size_t) (name - path);
+}
+
+// Adds dir/name to a list
+static bool _includeAdd (includeList_t* list,
+                         const char* dir,
+                         size_t dirLen,
+                         const char* name)
+{
+    if (list->numFiles == list->maxFiles)
+    {
+        size_t maxFiles = list->maxFiles ? (list->maxFiles * 2) : 8;
+        char** files = _confRealloc (list->files, maxFiles * sizeof (char*));
+        if (!files)
+        {
+            errno = ENOMEM;
+            return false;
+        }
+        list->files = files;
+        list->maxFiles = maxFiles;
+    }
+    char* file = _includeJoin (dir, dirLen, name);
+    if (!file)
+        return false;
+    list->files[list->numFiles++] = file;
+    return true;
+}
+
+#ifdef INCLUDE_CAN_SCAN
+// Compares two paths by byte value, so the order doesn't depend on the locale
+static int _includeCompare (const void* left, const void* right)
+{
+    return strcmp (*(const char* const*) left, *(const char* const*) right);
+}
+
+// Checks if an entry of a directory is a file, and not a directory or the like
+static bool _includeIsFile (const char* dir,
+                            size_t dirLen,
+                            const struct dirent* ent)
+{
+#ifdef _DIRENT_HAVE_D_TYPE
+    if (ent->d_type == DT_REG)
+        return true;
+    if (ent->d_type != DT_UNKNOWN && ent->d_type != DT_LNK)
+        return false;
+#endif
+    // Symbolic links count as what they point to. Entries that can't be
+    // checked are kept, and opening them reports what is wrong
+    char* path = _confMalloc (dirLen + strlen (ent->d_name) + 2);
+    if (!path)
+        return true;
+    const char* sep = (dirLen && dir[dirLen - 1] != '/') ? "/" : "";
+    sprintf (path, "%.*s%s%s", (int) dirLen, dir, sep, ent->d_name);
+    struct stat st;
+    bool res = !stat (path, &st) && S_ISREG (st.st_mode);
+    _confFree (path);
+    return res;
+}
+
+// Adds the files in dir that match pattern to a list. A NULL pattern matches
+// every file. Hidden files are left out either way
+static bool _includeScan (includeList_t* list,
+                          const char* dir,
+                          size_t dirLen,
+                          const char* pattern)
+{
+    char* dirPath = _confMalloc (dirLen + 1);
+    if (!dirPath)
+    {
+        errno = ENOMEM;
+        return false;
+    }
+    memcpy (dirPath, dir, dirLen);
+    dirPath[dirLen] = '\0';
+    DIR* d = opendir (dirLen ? dirPath : ".");
+    if (!d)
+    {
+        _confFree (dirPath);
+        // A wildcard in a directory that isn't there matches nothing
+        return pattern && errno == ENOENT;
+    }
+    size_t start = list->numFiles;
+    bool res = true;
+    struct dirent* ent = NULL;
+    errno = 0;
+    while ((ent = readdir (d)))
+    {
+        if (ent->d_name[0] == '.')
+            continue;
+        if (pattern && fnmatch (pattern, ent->d_name, FNM_PERIOD))
+            continue;
+        if (!_includeIsFile (dirPath, dirLen, ent))
+            continue;
+        if (!_includeAdd (list, dirPath, dirLen, ent->d_name))
+        {
+            res = false;
+            break;
+        }
+        errno = 0;
+    }
+    if (res && errno)
+        res = false;
+    closedir (d);
+    _confFree (dirPath);
+    qsort (list->files + start,
+           list->numFiles - start,
+           sizeof (char*),
+           _includeCompare);
+    return res;
+}
+#endif
+
+// Finds the slot of a path in the path table, or the empty slot it would go in.
+// The cache must be locked, and the table must exist
+static size_t _includePathSlot (_confFileCache_t* cache,
+                                const char* path,
+                                uint32_t hash)
+{
+    size_t mask = (cache->maxPaths * 2) - 1;
+    size_t idx = hash & mask;
+    while (cache->pathTable[idx])
+    {
+        _confPathInfo_t* ent = &cache->paths[cache->pathTable[idx] - 1];
+        if (ent->hash == hash && !strcmp (ent->path, path))
+            break;
+        idx = (idx + 1) & mask;
+    }
+    return idx;
+}
+
+// Makes room for another path in the cache, rebuilding its table. The cache
+// must be locked
+static bool _includeGrowPaths (_confFileCache_t* cache)
+{
+    size_t maxPaths = cache->maxPaths ? (cache->maxPaths * 2) : 16;
+    size_t* table = _confCalloc (maxPaths * 2 * sizeof (size_t));
+    if (!table)
+        return false;
+    _confPathInfo_t* paths =
+        _confRealloc (cache->paths, maxPaths * sizeof (_confPathInfo_t));
+    if (!paths)
+    {
+        _confFree (table);
+        return false;
+    }
+    _confFree (cache->pathTable);
+    cache->paths = paths;
+    cache->maxPaths = maxPaths;
+    cache->pathTable = table;
+    for (size_t i = 0; i < cache->numPaths; ++i)
+    {
+        _confPathInfo_t* ent = &cache->paths[i];
+        table[_includePathSlot (cache, ent->path, ent->hash)] = i + 1;
+    }
+    return true;
+}
+
+bool _confFileCacheStat (_confFileCache_t* cache,
+                         const char* path,
+                         _confPathInfo_t* info)
+{
+    uint32_t hash = 0;
+    if (cache)
+    {
+        hash = _confFileCacheHash (path);
+        _confMutexLock (&cache->lock);
+        size_t slot = cache->pathTable ? _includePathSlot (cache, path, hash) : 0;
+        if (cache->pathTable && cache->pathTable[slot])
+        {
+            *info = cache->paths[cache->pathTable[slot] - 1];
+            _confMutexUnlock (&cache->lock);
+            return info->exists;
+        }
+        _confMutexUnlock (&cache->lock);
+    }
+    // The file system is looked at without the lock, so other threads can use
+    // the cache meanwhile
+    memset (info, 0, sizeof (_confPathInfo_t));
+    struct stat st;
+    if (!stat (path, &st))
+    {
+        info->exists = true;
+        info->isDir = S_ISDIR (st.st_mode);
+    }
+    if (!cache)
+        return info->exists;
+    // Remember what was found. Failing to isn't an error, as the path just gets
+    // looked up again next time
+    const char* real = NULL;
+#if defined HAVE_REALPATH && defined PATH_MAX
+    char realBuf[PATH_MAX];
+    if (info->exists && !info->isDir)
+        real = realpath (path, realBuf);
+#endif
+    // The canonical path is kept in the same allocation as the path
+    size_t pathLen = strlen (path) + 1;
+    size_t realLen = real ? (strlen (real) + 1) : 0;
+    char* pathCopy = _confMalloc (pathLen + realLen);
+    if (!pathCopy)
+        return info->exists;
+    memcpy (pathCopy, path, pathLen);
+    char* canonical = real ? (pathCopy + pathLen) : NULL;
+    if (real)
+        memcpy (canonical, real, realLen);
+    _confMutexLock (&cache->lock);
+    if (cache->numPaths == cache->maxPaths && !_includeGrowPaths (cache))
+    {
+        _confMutexUnlock (&cache->lock);
+        _confFree (pathCopy);
+        return info->exists;
+    }
+    // Another thread may have looked the path up while this one did
+    size_t slot = _includePathSlot (cache, path, hash);
+    if (cache->pathTable[slot])
+    {
+        *info = cache->paths[cache->pathTable[slot] - 1];
+        _confMutexUnlock (&cache->lock);
+        _confFree (pathCopy);
+        return info->exists;
+    }
+    info->path = pathCopy;
+    info->hash = hash;
+    info->canonical = canonical;
+    cache->paths[cache->numPaths++] = *info;
+    cache->pathTable[slot] = cache->numPaths;
+    _confMutexUnlock (&cache->lock);
+    return info->exists;
+}
+
+// Checks if a path that an include statement may name is there. Paths with
+// wildcards are there if their directory is
+static bool _includeExists (_confFileCache_t* cache, const char* path)
+{
+    _confPathInfo_t info;
+#ifdef INCLUDE_CAN_SCAN
+    size_t dirLen = _includeDirLen (path);
+    const char* name = strrchr (path, '/');
+    name = name ? (name + 1) : path;
+    if (strpbrk (name, "*?["))
+    {
+        // The working directory is always there
+        if (!dirLen)
+            return true;
+        char* dir = _includeJoin (path, dirLen, "");
+        if (!dir)
+            return false;
+        bool res = _confFileCacheStat (cache, dir, &info) && info.isDir;
+        _confFree (dir);
+        return res;
+    }
+#endif
+    return _confFileCacheStat (cache, path, &info);
+}
+
+char* _confIncludeResolve (_confFileCache_t* cache,
+                           const char* from,
+                           const char* path,
+                           const char** dirs,
+                           size_t numDirs)
+{
+    // Absolute paths are used as they are
+    if (*path == '/')
+        return _includeJoin (NULL, 0, path);
+    size_t fromLen = _includeDirLen (from);
+    char* first = _includeJoin (from, fromLen, path);
+    if (!first || _includeExists (cache, first))
+        return first;
+    for (size_t i = 0; i < numDirs; ++i)
+    {
+        char* file = _includeJoin (dirs[i], strlen (dirs[i]), path);
+        if (!file || _includeExists (cache, file))
+        {
+            _confFree (first);
+            return file;
+        }
+        _confFree (file);
+    }
+    // Includes used to be found in the working directory only, so it is still
+    // searched last
+    if (fromLen)
+    {
+        char* file = _includeJoin (NULL, 0, path);
+        if (!file || _includeExists (cache, file))
+        {
+            _confFree (first);
+            return file;
+        }
+        _confFree (file);
+    }
+    return first;
+}
+
+bool _confIncludeExpand (_confFileCache_t* cache,
+                         const char* path,
+                         char*** files,
+                         size_t* numFiles)
+{
+    includeList_t list = {0};
+    bool res = true;
+#ifdef INCLUDE_CAN_SCAN
+    // Only the last component may have wildcards
+    size_t dirLen = _includeDirLen (path);
+    const char* name = strrchr (path, '/');
+    name = name ? (name + 1) : path;
+    _confPathInfo_t info;
+    if (strpbrk (name, "*?["))
+        res = _includeScan (&list, path, dirLen, name);
+    else if (_confFileCacheStat (cache, path, &info) && info.isDir)
+    {
+        // Trailing slashes would double up in the paths of the files
+        size_t len = strlen (path);
+        while (len > 1 && path[len - 1] == '/')
+            --len;
+        res = _includeScan (&list, path, len, NULL);
+    }
+    else
+#endif
+        res = _includeAdd (&list, NULL, 0, path);
+    if (!res)
+    {
+        int err = errno;
+        _confIncludeFree (list.files, list.numFiles);
+        errno = err;
+        return false;
+    }
+    *files = list.files;
+    *numFiles = list.numFiles;
+    return true;
+}
+
+void _confIncludeFree (char** files, size_t numFiles)
+{
+    for (size_t i = 0; i < numFiles; ++i)
+        _confFree (files[i]);
+    _confFree (files);
+}
@@ -24,39 +24,424 @@
 #include <libconf/libconf_config.h>
 #include <libnex/char32.h>
 #include <libnex/list.h>
+#include <libnex/safemalloc.h>
 #include <libnex/stringref.h>
 #include <libnex/textstream.h>
 #include <stdbool.h>
 #include <stdint.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#ifdef HAVE_PTHREAD
+typedef pthread_mutex_t _confMutex_t;
+#define CONF_MUTEX_INITIALIZER PTHREAD_MUTEX_INITIALIZER
+#else
+typedef int _confMutex_t;
+#define CONF_MUTEX_INITIALIZER 0
+#endif
+
+// Memory that libconf frees itself goes through these, so it comes from the
+// allocator of the parse and can be counted
+void* _confMalloc (size_t sz);
+void* _confCalloc (size_t sz);
+void* _confRealloc (void* ptr, size_t sz);
+void _confFree (void* ptr);
+
+// Gets and sets the allocator used by _confMalloc on this thread. NULL means
+// malloc
+const ConfAllocator_t* _confGetAllocator (void);
+const ConfAllocator_t* _confSetAllocator (const ConfAllocator_t* alloc);
+
+/// Resources used by a parse so far, to be checked against its limits
+typedef struct _confBudget
+{
+    const ConfLimits_t* limits;    ///< Limits of the parse
+    uint64_t bytes;                ///< Size of files read
+    uint64_t tokens;               ///< Tokens handed to the parser
+    uint64_t blocks;               ///< Blocks in the tree
+    uint64_t props;                ///< Properties in the tree
+    int64_t memory;                ///< Bytes allocated. Updated atomically
+    bool outOfMemory;              ///< Was an allocation refused?
+    bool exceeded;                 ///< Was any other limit hit?
+} _confBudget_t;
+
+// Gets and sets the budget allocations on this thread are charged to. NULL
+// means allocations aren't limited
+_confBudget_t* _confGetBudget (void);
+_confBudget_t* _confSetBudget (_confBudget_t* budget);
+
+// Reports a diagnostic, either by adding it to list or by printing it if list
+// is NULL
+void _confDiag (ConfDiagList_t* list, const ConfDiag_t* diag);
+
+// Creates a StringRef of a string from _confMalloc
+StringRef32_t* _confStrCreate (char32_t* str);
+
+// Drops a reference to a StringRef from _confStrCreate
+void _confStrRelease (StringRef32_t* ref);
+
+#ifdef LIBCONF_ENABLE_STATS
+/// Statistics of the parse running on this thread
+extern _Thread_local ConfStats_t _confStats;
+
+uint64_t _confStatsNow (void);
+void _confStatsReset (void);
+void _confStatsFinish (uint64_t start);
+void _confStatsAlloc (size_t sz);
+void _confStatsAdd (ConfStats_t* stats, const ConfStats_t* other);
+void _confStatsResetAlloc (void);
+
+#define STATS_ADD(field, n)   (_confStats.field += (n))
+#define STATS_ALLOC(sz)       _confStatsAlloc (sz)
+#define STATS_START(var)      uint64_t var = _confStatsNow()
+#define STATS_END(field, var) (_confStats.field += _confStatsNow() - (var))
+#define STATS_RESET()         _confStatsReset()
+#define STATS_FINISH(var)     _confStatsFinish (var)
+#else
+#define STATS_ADD(field, n)
+#define STATS_ALLOC(sz)
+#define STATS_START(var)
+#define STATS_END(field, var)
+#define STATS_RESET()
+#define STATS_FINISH(var)
+#endif
+
+// Static probes for tracing with tools like perf and bpftrace. They are all in
+// the libconf provider, and their arguments have to be cheap to compute
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#define PROBE0(name)             DTRACE_PROBE (libconf, name)
+#define PROBE1(name, a)          DTRACE_PROBE1 (libconf, name, a)
+#define PROBE2(name, a, b)       DTRACE_PROBE2 (libconf, name, a, b)
+#define PROBE3(name, a, b, c)    DTRACE_PROBE3 (libconf, name, a, b, c)
+#else
+#define PROBE0(name)
+#define PROBE1(name, a)
+#define PROBE2(name, a, b)
+#define PROBE3(name, a, b, c)
+#endif
+
+/// A character set detected for a file
+typedef struct _confCharset
+{
+    char* file;        ///< File that was detected
+    uint32_t hash;     ///< Hash of file
+    char* encoding;    ///< Name of encoding
+    bool bom;          ///< Does the file have a BOM?
+} _confCharset_t;
+
+/// What was found at a path
+typedef struct _confPathInfo
+{
+    char* path;         ///< Path that was looked up
+    uint32_t hash;      ///< Hash of path
+    char* canonical;    ///< Canonical path of a file. NULL if it isn't one
+    bool exists;        ///< Is anything there?
+    bool isDir;         ///< Is it a directory?
+} _confPathInfo_t;
+
+/// Caches what is known about files between files parsed together, so
+/// includes of the same files don't go to the file system again. Each array has
+/// a hash table twice its size, which is rebuilt when the array grows
+typedef struct _confFileCache
+{
+    _confMutex_t lock;           ///< Protects the cache
+    _confCharset_t* entries;     ///< Detected files, by canonical path if known
+    size_t numEntries;           ///< Number of entries
+    size_t maxEntries;           ///< Space in entries
+    size_t* entryTable;          ///< Entries plus one, by hash. 0 if a slot is empty
+    _confPathInfo_t* paths;      ///< Paths that were looked up
+    size_t numPaths;             ///< Number of paths
+    size_t maxPaths;             ///< Space in paths
+    size_t* pathTable;           ///< Paths plus one, by hash. 0 if a slot is empty
+} _confFileCache_t;
+
+/// A position in UTF-8 text. Lines and columns are counted forward from the
+/// last position, so each byte is only counted once
+typedef struct _confTextPos
+{
+    size_t pos;    ///< Offset in the text that this is the position of
+    int line;      ///< Line that pos is on
+    int col;       ///< Column of pos, in characters from 1
+    bool cr;       ///< Is the byte before pos a CR?
+} _confTextPos_t;
 
 /// Specifies a token that was parsed by the lexer
 typedef struct _confToken
 {
     int type;                 ///< The type of token that was parsed
     int line;                 ///< The line that this token is on
+    int col;                  ///< The column that this token starts at
     StringRef32_t* semVal;    ///< Semantic value of token
     int64_t num;              ///< Numeric value of token
     uint16_t base;            ///< Base of token
 } _confToken_t;
 
+#define LEX_RING_SZ     32    ///< Number of tokens in the lexer's token ring
+#define LEX_RING_RETAIN 2     ///< Number of consumed tokens kept valid in the ring
+
 /// The state of the lexer
 typedef struct _lexState
 {
-    TextStream_t* stream;    ///< Text stream object
+    const char* file;        ///< Name of the file being lexed
+    char enc;                ///< Text stream encoding of the file
+    char order;              ///< Text stream byte order of the file
+    bool isUtf8;             ///< Is the file UTF-8 or ASCII?
+    bool hasBom;             ///< Does the file start with a BOM?
+    uint8_t unitSz;          ///< Code unit size of UTF-16 or UTF-32 files, else 0
+    bool isBigEndian;        ///< Are the file's code units big endian?
+    // Memory buffer. Files are read into it before the first token is lexed
+    const uint8_t* buf;    ///< UTF-8 text to lex
+    size_t bufLen;         ///< Length of buf in bytes
+    size_t bufPos;         ///< Position in buf
+    size_t charPos;        ///< Where the last character read or peeked at starts
+    size_t bufLimit;       ///< No token may start at or past this. 0 = no limit
+    // Pushed input. buf holds the input that hasn't been lexed yet
+    size_t bufFill;    ///< Bytes in buf. bufLen stops before a partial character
+    size_t bufSz;      ///< Size of buf
+    bool checkBom;     ///< Is a BOM still to be skipped?
+    // Tokens lexed ahead of time. If set, these are used instead of the ring
+    _confToken_t* toks;    ///< Array of tokens
+    size_t numToks;        ///< Number of tokens in toks
+    // Token ring. Tokens are lexed into it in batches
+    _confToken_t ring[LEX_RING_SZ];    ///< Ring of tokens
+    size_t numLexed;                   ///< Number of tokens lexed into the ring
+    size_t numConsumed;                ///< Number of tokens handed to the parser
     // Base state of lexer
     bool isEof;           ///< Is the lexer at the end of the file?
     bool isAccepted;      ///< Is the current token accepted?
     _confToken_t* tok;    ///< Current token
-    // Diagnostic data
-    int line;            ///< Line number in lexer
-    char32_t curChar;    ///< Current character
+    // Diagnostic data. Lines are only counted up to where tokens start
+    _confTextPos_t textPos;    ///< Position lines have been counted to in buf
+    char32_t curChar;          ///< Current character
     // Peek releated information
-    char32_t nextChar;    ///< Contains the next character. If the read functions
-                          ///< find this set, then they use this
-                          /// instead
-    int loc;              ///< Location in states table
+    char32_t nextChar;        ///< Contains the next character. If the read functions
+                              ///< find this set, then they use this
+                              /// instead
+    int loc;                  ///< Location in states table
+    bool quiet;               ///< Don't report errors
+    // Block filter. Blocks of other types are skipped before their type becomes
+    // a token
+    const char32_t** blockTypes;    ///< Block types to keep. NULL = all
+    size_t numBlockTypes;           ///< Number of entries in blockTypes
+    int depth;                      ///< Depth of braces lexed so far
+    int prevType;                   ///< Type of the last token lexed
+    _confBudget_t* budget;    ///< Budget to charge input to. May be NULL
+    ConfDiagList_t* diags;    ///< List to report errors to. NULL prints them
 } lexState_t;
 
+/**
+ * @brief Decodes a UTF-8 character
+ *
+ * Invalid or truncated sequences decode to U+FFFD and consume one byte
+ *
+ * @param s the bytes to decode
+ * @param len the number of bytes available in s. Must be at least 1
+ * @param[out] c the decoded character
+ * @return The number of bytes consumed
+ */
+static inline size_t _confUtf8Decode (const uint8_t* s, size_t len, char32_t* c)
+{
+    size_t n = 0;
+    char32_t min = 0;
+    if (s[0] < 0x80)
+    {
+        *c = s[0];
+        return 1;
+    }
+    else if ((s[0] & 0xE0) == 0xC0)
+    {
+        n = 1;
+        min = 0x80;
+        *c = s[0] & 0x1F;
+    }
+    else if ((s[0] & 0xF0) == 0xE0)
+    {
+        n = 2;
+        min = 0x800;
+        *c = s[0] & 0x0F;
+    }
+    else if ((s[0] & 0xF8) == 0xF0)
+    {
+        n = 3;
+        min = 0x10000;
+        *c = s[0] & 0x07;
+    }
+    else
+        goto invalid;
+    if (n >= len)
+        goto invalid;
+    for (size_t i = 1; i <= n; ++i)
+    {
+        if ((s[i] & 0xC0) != 0x80)
+            goto invalid;
+        *c = (*c << 6) | (s[i] & 0x3F);
+    }
+    // Reject overlong forms, surrogates and out of range values
+    if (*c < min || *c > 0x10FFFF || (*c >= 0xD800 && *c <= 0xDFFF))
+        goto invalid;
+    return n + 1;
+invalid:
+    *c = 0xFFFD;
+    return 1;
+}
+
+/**
+ * @brief Encodes a character as UTF-8
+ * @param c the character to encode
+ * @param[out] s the buffer to write to. Must have room for 4 bytes
+ * @return The number of bytes written
+ */
+static inline size_t _confUtf8Encode (char32_t c, uint8_t* s)
+{
+    if (c < 0x80)
+    {
+        s[0] = (uint8_t) c;
+        return 1;
+    }
+    else if (c < 0x800)
+    {
+        s[0] = (uint8_t) (0xC0 | (c >> 6));
+        s[1] = (uint8_t) (0x80 | (c & 0x3F));
+        return 2;
+    }
+    else if (c < 0x10000)
+    {
+        s[0] = (uint8_t) (0xE0 | (c >> 12));
+        s[1] = (uint8_t) (0x80 | ((c >> 6) & 0x3F));
+        s[2] = (uint8_t) (0x80 | (c & 0x3F));
+        return 3;
+    }
+    s[0] = (uint8_t) (0xF0 | (c >> 18));
+    s[1] = (uint8_t) (0x80 | ((c >> 12) & 0x3F));
+    s[2] = (uint8_t) (0x80 | ((c >> 6) & 0x3F));
+    s[3] = (uint8_t) (0x80 | (c & 0x3F));
+    return 4;
+}
+
+/**
+ * @brief Converts a UTF-32 string to UTF-8 without regard to the locale
+ *
+ * Works like strlcpy. If out is too small, it is cut off before the first
+ * character that doesn't fit, and still null terminated
+ *
+ * @param[out] out the buffer to write to. May be NULL if outSz is 0
+ * @param outSz the size of out
+ * @param str the string to convert
+ * @return The length of the whole UTF-8 string, without the null terminator
+ */
+size_t _confC32ToUtf8 (char* out, size_t outSz, const char32_t* str);
+
+/**
+ * @brief Converts UTF-8 to UTF-32 without regard to the locale
+ *
+ * Invalid sequences become U+FFFD. Nothing is null terminated
+ *
+ * @param[out] out the buffer to write to. Characters past outLen are dropped
+ * @param outLen the number of characters out has room for
+ * @param str the UTF-8 text
+ * @param len the length of str in bytes
+ * @return The number of characters in str
+ */
+size_t _confUtf8ToC32 (char32_t* out, size_t outLen, const char* str, size_t len);
+
+/**
+ * @brief Converts UTF-16 text to UTF-8
+ *
+ * Surrogates that aren't part of a pair and a trailing half of a code unit
+ * become U+FFFD
+ *
+ * @param[out] out the buffer to write to. Must have room for len / 2 * 3 + 3
+ * bytes
+ * @param in the UTF-16 text, without a BOM
+ * @param len the length of in in bytes
+ * @param bigEndian is in big endian?
+ * @return The number of bytes written
+ */
+size_t _confUtf16ToUtf8 (uint8_t* out,
+                         const uint8_t* in,
+                         size_t len,
+                         bool bigEndian);
+
+/**
+ * @brief Converts UTF-32 text to UTF-8
+ *
+ * Surrogates, values past U+10FFFF and a trailing partial code unit become
+ * U+FFFD
+ *
+ * @param[out] out the buffer to write to. Must have room for len + 3 bytes
+ * @param in the UTF-32 text, without a BOM
+ * @param len the length of in in bytes
+ * @param bigEndian is in big endian?
+ * @return The number of bytes written
+ */
+size_t _confUtf32ToUtf8 (uint8_t* out,
+                         const uint8_t* in,
+                         size_t len,
+                         bool bigEndian);
+
+/**
+ * @brief Expands the path of an include statement into the files it names
+ *
+ * A directory names every file in it, and a path whose last component has
+ * wildcards names every file in its directory that matches them. Hidden files
+ * are left out of both, and the files are sorted by byte value. Any other path
+ * names itself
+ *
+ * @param[in] cache cache of paths looked up. May be NULL
+ * @param[in] path the path to expand
+ * @param[out] files set to an array of the paths, from _confMalloc
+ * @param[out] numFiles set to the number of paths. May be 0
+ * @return false if the directory can't be read, with errno saying why
+ */
+bool _confIncludeExpand (_confFileCache_t* cache,
+                         const char* path,
+                         char*** files,
+                         size_t* numFiles);
+
+/**
+ * @brief Looks up what is at a path, going to the file system only if the path
+ * isn't in the cache yet
+ *
+ * @param[in] cache the cache to look in. May be NULL
+ * @param[in] path the path to look up
+ * @param[out] info set to what is at path. Its strings belong to the cache, and
+ * are NULL if cache is NULL
+ * @return Whether anything is at path
+ */
+bool _confFileCacheStat (_confFileCache_t* cache,
+                         const char* path,
+                         _confPathInfo_t* info);
+
+/**
+ * @brief Finds the file an include statement names
+ *
+ * Relative paths are looked for next to the including file first, then in each
+ * directory of dirs, and last in the working directory. For paths with
+ * wildcards, the directory they are in is looked for
+ *
+ * @param cache cache of paths looked up. May be NULL
+ * @param from the including file
+ * @param path the path in the include statement
+ * @param dirs directories to search
+ * @param numDirs number of directories in dirs
+ * @return The path to include, from _confMalloc. If nothing was found, it is
+ * the path next to the including file. NULL if out of memory
+ */
+char* _confIncludeResolve (_confFileCache_t* cache,
+                           const char* from,
+                           const char* path,
+                           const char** dirs,
+                           size_t numDirs);
+
+/**
+ * @brief Frees paths from _confIncludeExpand
+ * @param files the paths to free
+ * @param numFiles the number of paths
+ */
+void _confIncludeFree (char** files, size_t numFiles);
+
 /**
  * @brief Internal parser function
  *
@@ -64,16 +449,125 @@ typedef struct _lexState
  * based on the tokens
  *
  * @param[in] file the file to parse
+ * @param[in] opts the options to parse with. May be NULL
+ * @param[in] cache character set cache shared with other parses. May be NULL
  * @return The list of blocks in the file
  */
-ListHead_t* _confParse (const char* file);
+ListHead_t* _confParse (const char* file,
+                        const ConfOptions_t* opts,
+                        _confFileCache_t* cache);
+
+/**
+ * @brief Creates an empty parse tree
+ * @return The tree, or NULL on error
+ */
+ListHead_t* _confParseCreateTree (void);
+
+/**
+ * @brief Parses the tokens a lexer was given ahead of time into a tree
+ *
+ * The tokens must hold whole blocks and includes, and end with LEX_TOKEN_NONE
+ * or LEX_TOKEN_ERROR. The lexer is not destroyed
+ *
+ * @param head the tree to add blocks to
+ * @param lex the lexer holding the tokens
+ * @param opts the options to parse with. May be NULL
+ * @param budget the budget of the parse. May be NULL
+ * @param cache cache to look up included files in. May be NULL
+ * @param lastTok the token before the first one, for diagnostics. May be NULL
+ * @return false if parsing has to stop
+ */
+bool _confParseTokens (ListHead_t* head,
+                       lexState_t* lex,
+                       const ConfOptions_t* opts,
+                       _confBudget_t* budget,
+                       _confFileCache_t* cache,
+                       _confToken_t* lastTok);
 
 /**
  * @brief Initializes the lexer
  * @param file the file to lex
+ * @param cache cache to look up the file in. May be NULL
+ * @param diags list to report errors to. NULL prints them
+ * @return The lexer's state
+ */
+lexState_t* _confLexInit (const char* file,
+                          _confFileCache_t* cache,
+                          ConfDiagList_t* diags);
+
+/**
+ * @brief Initializes a lexer for input that is pushed to it
+ *
+ * Input is UTF-8, and is passed in with _confLexPush as it arrives
+ *
+ * @param name the name to report errors with
+ * @param diags list to report errors to. NULL prints them
  * @return The lexer's state
  */
-lexState_t* _confLexInit (const char* file);
+lexState_t* _confLexInitPush (const char* name, ConfDiagList_t* diags);
+
+/**
+ * @brief Resets a lexer from _confLexInitPush for new input
+ *
+ * Its buffer and token ring are kept, so lexing the next input allocates
+ * nothing until the input outgrows the buffer
+ *
+ * @param state the lexer to reset
+ * @param name the name to report errors with
+ */
+void _confLexResetPush (lexState_t* state, const char* name);
+
+/**
+ * @brief Adds input to a lexer from _confLexInitPush
+ *
+ * Input that has been lexed is dropped, so only what is left is kept
+ *
+ * @param state the lexer to add to
+ * @param data the bytes to add
+ * @param len the number of bytes in data
+ * @return false on error, which is reported
+ */
+bool _confLexPush (lexState_t* state, const void* data, size_t len);
+
+/**
+ * @brief Lexes one token from pushed input
+ *
+ * If the token may go on in input that hasn't arrived yet, nothing is consumed,
+ * so it can be lexed again once there is more
+ *
+ * @param state the lexer to lex with
+ * @param[out] tok the token to lex into
+ * @param final is this all of the input?
+ * @return tok, or NULL if the token isn't complete yet
+ */
+_confToken_t* _confLexPartial (lexState_t* state, _confToken_t* tok, bool final);
+
+/**
+ * @brief Charges a lexer's input and tokens to a budget
+ * @param state the lexer
+ * @param budget the budget of the parse
+ * @return false if the input is over the budget's limit, which is reported
+ */
+bool _confLexSetBudget (lexState_t* state, _confBudget_t* budget);
+
+/**
+ * @brief Initializes a file cache
+ * @param cache the cache to initialize
+ */
+void _confFileCacheInit (_confFileCache_t* cache);
+
+/**
+ * @brief Frees everything in a file cache
+ * @param cache the cache to destroy
+ */
+void _confFileCacheDestroy (_confFileCache_t* cache);
+
+/**
+ * @brief Hashes a path for the tables of a file cache
+ * @param path the path to hash
+ * @return The FNV-1a hash of path
+ */
+uint32_t _confFileCacheHash (const char* path);
 
 /**
  * @brief Destroys the lexer
@@ -82,12 +576,144 @@ lexState_t* _confLexInit (const char* file);
 void _confLexDestroy (lexState_t* state);
 
 /**
- * @brief Lexes a token
+ * @brief Moves a text position forward, counting lines and columns
+ *
+ * CR, LF and CR LF each end a line. Text without line ends is skipped over a
+ * word at a time
+ *
+ * @param tp the position to move. tp->pos must not be past pos
+ * @param text the UTF-8 text tp is in
+ * @param pos the offset to move tp to
+ */
+void _confTextAdvance (_confTextPos_t* tp, const uint8_t* text, size_t pos);
+
+/**
+ * @brief Reads the rest of the lexer's stream into a memory buffer
+ *
+ * Afterwards, the lexer reads characters from the buffer. Lexers load their
+ * file before the first token is lexed
+ *
+ * @param state the lexer to load
+ * @return true on success, false on error
+ */
+bool _confLexLoad (lexState_t* state);
+
+/**
+ * @brief Lexes a file in parallel
+ *
+ * The file is loaded into memory and split into chunks, which are lexed
+ * concurrently. The tokens are then handed out by _confLex like normal. If an
+ * error occurs, this falls back to lexing the buffer sequentially so errors are
+ * reported in order
+ *
+ * @param state the lexer to lex with. No tokens may have been taken from it
+ * @param threads the maximum number of threads to use
+ * @return true on success, false on error
+ */
+bool _confLexParallel (lexState_t* state, int threads);
+
+/**
+ * @brief Lexes one token, bypassing the token ring
+ * @param state the lexer to lex with
+ * @param[out] tok the token to lex into
+ * @return tok
+ */
+_confToken_t* _confLexToken (lexState_t* state, _confToken_t* tok);
+
+/**
+ * @brief Runs a function on several threads at once
+ *
+ * Calls fn (arg, i) for every i in [0, n), and returns once all calls are done.
+ * If threads aren't available, the calls are made in order
+ *
+ * @param n the number of calls to make
+ * @param fn the function to call
+ * @param arg the argument to pass to fn
+ */
+void _confRunParallel (int n, void (*fn) (void*, int), void* arg);
+
+/**
+ * @brief Runs calls on a work-stealing thread pool
+ *
+ * Calls fn (arg, i) for every i in [0, n) using up to threads threads. Calls
+ * are split evenly between the threads at first, and threads that run out of
+ * calls steal half of the remaining calls of another thread
+ *
+ * @param n the number of calls to make
+ * @param threads the maximum number of threads to use
+ * @param fn the function to call
+ * @param arg the argument to pass to fn
+ */
+void _confRunPool (int n, int threads, void (*fn) (void*, int), void* arg);
+
+/**
+ * @brief Checks if the calling thread is running a call from _confRunPool
+ *
+ * Work started from inside a pool should be done on the calling thread, so
+ * that nested pools don't start threads of their own
+ *
+ * @return true if it is
+ */
+bool _confInPool (void);
+
+/**
+ * @brief Gets the number of CPUs that are online
+ * @return The number of CPUs, or 1 if it's unknown
+ */
+int _confNumCpus (void);
+
+void _confMutexInit (_confMutex_t* mutex);
+void _confMutexDestroy (_confMutex_t* mutex);
+void _confMutexLock (_confMutex_t* mutex);
+void _confMutexUnlock (_confMutex_t* mutex);
+
+/**
+ * @brief Gets the next token
+ *
+ * Tokens are owned by the lexer's ring. A token stays valid until
+ * LEX_RING_RETAIN more tokens have been taken with _confLex. If the caller needs
+ * a token's semantic value longer than that, it must take a reference to it
+ *
  * @param state the lexer to lex
- * @return The token. NULL if an error ocurred
+ * @return The token. Type is LEX_TOKEN_ERROR if an error ocurred
  */
 _confToken_t* _confLex (lexState_t* state);
 
+/**
+ * @brief Looks ahead at a token without consuming it
+ * @param state the lexer to peek with
+ * @param k the number of tokens to look past. 0 is the token _confLex returns
+ * next. Must be less than LEX_RING_SZ - LEX_RING_RETAIN
+ * @return The token
+ */
+_confToken_t* _confLexPeek (lexState_t* state, int k);
+
+/**
+ * @brief Skips over the rest of a block without creating tokens
+ *
+ * Called after the block type has been lexed. Skips the block name and body up
+ * to and including the closing brace. Strings and comments are honored so
+ * braces inside of them are not counted
+ *
+ * @param state the lexer to skip with
+ * @return true on success, false if the block wasn't terminated
+ */
+bool _confLexSkipBlock (lexState_t* state);
+
+/**
+ * @brief Skips blocks whose type isn't in a list while lexing
+ *
+ * Only for lexers from _confLexInit that lex tokens one at a time. Blocks that
+ * are skipped never become tokens, so the strings of their types aren't made
+ *
+ * @param state the lexer
+ * @param blockTypes the block types to keep. Must outlive the lexer
+ * @param numBlockTypes the number of entries in blockTypes
+ */
+void _confLexSetFilter (lexState_t* state,
+                        const char32_t** blockTypes,
+                        size_t numBlockTypes);
+
 /**
  * @brief Gets the symbolic name of tok
  * @param tok the token to get the name of
@@ -27,51 +27,32 @@
 #include <libnex/progname.h>
 #include <libnex/safemalloc.h>
 #include <libnex/textstream.h>
-#include <libnex/unicode.h>
 #include <limits.h>
 #include <stdlib.h>
+#include <sys/stat.h>
 
 #define LEX_FRAME_SZ 2048    // Size of lexing staging buffer
+#define VARMAX       32      // Longest identifier or number, in characters
+#define STRINGMAX    128     // Longest string, in characters
+
+#define LEX_FNV_BASIS 2166136261U    // Start of an FNV-1a hash
+#define LEX_FNV_PRIME 16777619U      // Multiplier of an FNV-1a hash
 
 // Valid error states for lexer
-#define LEX_ERROR_NONE             0
-#define LEX_ERROR_UNEXPECTED_TOKEN 1
-#define LEX_ERROR_UNKNOWN_TOKEN    2
-#define LEX_ERROR_UNEXPECTED_EOF   3
-#define LEX_ERROR_INTERNAL         4
-#define LEX_ERROR_INVALID_NUMBER   5
-#define LEX_ERROR_BUFFER_OVERFLOW  6
-#define LEX_ERROR_INVALID_VAR_ID   7
+#define LEX_ERROR_UNKNOWN_TOKEN   CONF_DIAG_UNKNOWN_TOKEN
+#define LEX_ERROR_UNEXPECTED_EOF  CONF_DIAG_UNEXPECTED_EOF
+#define LEX_ERROR_INTERNAL        CONF_DIAG_INTERNAL
+#define LEX_ERROR_INVALID_NUMBER  CONF_DIAG_INVALID_NUMBER
+#define LEX_ERROR_BUFFER_OVERFLOW CONF_DIAG_TOO_LONG
+#define LEX_ERROR_INVALID_VAR_ID  CONF_DIAG_INVALID_VAR
+#define LEX_ERROR_UNTERMINATED    CONF_DIAG_UNTERMINATED
 
 // Helper function macros
-#define CHECK_NEWLINE_BREAK               \
-    if (curChar == '\n')                  \
-    {                                     \
-        ++state->line;                    \
-        tok->type = LEX_TOKEN_NONE;       \
-        break;                            \
-    }                                     \
-    else if (curChar == '\r')             \
-    {                                     \
-        if (_lexPeekChar (state) == '\n') \
-            _lexSkipChar (state);         \
-        ++state->line;                    \
-        tok->type = LEX_TOKEN_NONE;       \
-        break;                            \
-    }
-
-#define CHECK_NEWLINE                     \
-    if (curChar == '\n')                  \
-    {                                     \
-        ++state->line;                    \
-        tok->type = LEX_TOKEN_NONE;       \
-    }                                     \
-    else if (curChar == '\r')             \
-    {                                     \
-        if (_lexPeekChar (state) == '\n') \
-            _lexSkipChar (state);         \
-        ++state->line;                    \
-        tok->type = LEX_TOKEN_NONE;       \
+#define CHECK_NEWLINE_BREAK                    \
+    if (curChar == '\n' || curChar == '\r')    \
+    {                                          \
+        tok->type = LEX_TOKEN_NONE;            \
+        break;                                 \
     }
 
 #define CHECK_EOF(c)              \
@@ -95,142 +76,613 @@
         goto _internalError;                               \
     }
 
-// Prints out an error condition
+// Gets the position of the next unread character in the memory buffer
+static inline size_t _lexBufTell (lexState_t* state)
+{
+    return state->nextChar ? state->charPos : state->bufPos;
+}
+
+// Reports an error condition. value is the limit for limit errors
+static void _lexDiag (lexState_t* state, int err, const char* extra, int64_t value)
+{
+    if (state->quiet)
+        return;
+    // Count lines up to the error without moving the lexer's count, since the
+    // token the error is in may still be located
+    _confTextPos_t textPos = state->textPos;
+    if (state->buf)
+        _confTextAdvance (&textPos, state->buf, _lexBufTell (state));
+    PROBE3 (lex__error, state->file, textPos.line, err);
+    ConfDiag_t diag = {0};
+    diag.file = state->file;
+    diag.line = textPos.line;
+    diag.column = textPos.col;
+    diag.code = err;
+    diag.token = -1;
+    diag.prevToken = -1;
+    diag.expected = -1;
+    diag.value = value;
+    diag.detail = extra;
+    if (err == LEX_ERROR_UNEXPECTED_EOF || err == LEX_ERROR_BUFFER_OVERFLOW)
+        diag.token = state->tok->type;
+    else if (err == LEX_ERROR_UNKNOWN_TOKEN)
+        diag.value = state->curChar;
+    _confDiag (state->diags, &diag);
+}
+
+// Reports an error condition
 static inline void _lexError (lexState_t* state, int err, const char* extra)
 {
-    mbstate_t mbState;
-    memset (&mbState, 0, sizeof (mbstate_t));
-    size_t mbBytesWritten = 0;
+    _lexDiag (state, err, extra, 0);
+}
 
-    char extraBuf[5];
-    char bufData[2048];
+void _confFileCacheInit (_confFileCache_t* cache)
+{
+    memset (cache, 0, sizeof (_confFileCache_t));
+    _confMutexInit (&cache->lock);
+}
 
-    char* obuf = bufData;
-    char* buf = bufData;
+void _confFileCacheDestroy (_confFileCache_t* cache)
+{
+    for (size_t i = 0; i < cache->numEntries; ++i)
+    {
+        _confFree (cache->entries[i].file);
+        _confFree (cache->entries[i].encoding);
+    }
+    _confFree (cache->entries);
+    _confFree (cache->entryTable);
+    // Canonical paths are allocated with their paths
+    for (size_t i = 0; i < cache->numPaths; ++i)
+        _confFree (cache->paths[i].path);
+    _confFree (cache->paths);
+    _confFree (cache->pathTable);
+    _confMutexDestroy (&cache->lock);
+}
 
-    if (err != LEX_ERROR_INTERNAL)
-        buf += snprintf (buf, 2048 - (buf - obuf), "error: %s:", ConfGetFileName());
+uint32_t _confFileCacheHash (const char* path)
+{
+    uint32_t hash = LEX_FNV_BASIS;
+    for (; *path; ++path)
+        hash = (hash ^ (uint8_t) *path) * LEX_FNV_PRIME;
+    return hash;
+}
 
-    if (state)
-        buf += snprintf (buf, 2048 - (buf - obuf), "%d: ", state->line);
-    // Decide how to handle the error
-    switch (err)
+// Checks if an encoding can be read straight into a UTF-8 buffer
+static inline bool _lexIsUtf8 (const char* encoding)
+{
+    return !strcmp (encoding, "UTF-8") || !strcmp (encoding, "ASCII");
+}
+
+// Finds the slot of a file in the character set table, or the empty slot it
+// would go in. The cache must be locked, and the table must exist
+static size_t _lexCacheSlot (_confFileCache_t* cache,
+                             const char* file,
+                             uint32_t hash)
+{
+    size_t mask = (cache->maxEntries * 2) - 1;
+    size_t idx = hash & mask;
+    while (cache->entryTable[idx])
     {
-        case LEX_ERROR_UNEXPECTED_TOKEN:
-            // Print out error string
-            buf += snprintf (buf, 2048 - (buf - obuf), "Unexpected token ");
-            buf += snprintf (buf,
-                             2048 - (buf - obuf),
-                             "%s",
-                             _confLexGetTokenName (state->tok));
-            break;
-        case LEX_ERROR_UNKNOWN_TOKEN:
-            // Convert current char to a char
-            mbBytesWritten = c32rtomb (extraBuf, state->curChar, &mbState);
-            if (mbBytesWritten == -1)
-                error ("internal error: %s", strerror (errno));
-            else
-            {
-                extraBuf[mbBytesWritten] = '\0';
-                // Add everything
-                buf += snprintf (buf,
-                                 2048 - (buf - obuf),
-                                 "Unknown token '%s'",
-                                 extraBuf);
-            }
-            break;
-        case LEX_ERROR_UNEXPECTED_EOF:
-            // Print out string
-            buf += snprintf (buf, 2048 - (buf - obuf), "Unexpected EOF");
-            buf += snprintf (buf,
-                             2048 - (buf - obuf),
-                             " on token %s",
-                             _confLexGetTokenName (state->tok));
-            break;
-        case LEX_ERROR_INVALID_NUMBER:
-            buf += snprintf (buf, 2048 - (buf - obuf), "Invalid numeric value");
-            break;
-        case LEX_ERROR_BUFFER_OVERFLOW:
-            buf += snprintf (buf,
-                             2048 - (buf - obuf),
-                             "Name too long on token %s",
-                             _confLexGetTokenName (state->tok));
-            break;
-        case LEX_ERROR_INVALID_VAR_ID:
-            buf +=
-                snprintf (buf, 2048 - (buf - obuf), "Invalid character in variable");
-            break;
-        case LEX_ERROR_INTERNAL:
-            printf ("%s\n", ConfGetFileName());
-            buf += snprintf (buf,
-                             2048 - (buf - obuf),
-                             "internal error: %s: %s",
-                             ConfGetFileName(),
-                             extra);
+        _confCharset_t* ent = &cache->entries[cache->entryTable[idx] - 1];
+        if (ent->hash == hash && !strcmp (ent->file, file))
             break;
+        idx = (idx + 1) & mask;
+    }
+    return idx;
+}
+
+// Looks up a file in the character set cache. Returns false if it isn't there
+static bool _lexCacheFind (_confFileCache_t* cache,
+                           const char* file,
+                           char* enc,
+                           char* order,
+                           bool* bom,
+                           bool* isUtf8)
+{
+    bool found = false;
+    uint32_t hash = _confFileCacheHash (file);
+    _confMutexLock (&cache->lock);
+    size_t slot = cache->entryTable ? _lexCacheSlot (cache, file, hash) : 0;
+    if (cache->entryTable && cache->entryTable[slot])
+    {
+        _confCharset_t* ent = &cache->entries[cache->entryTable[slot] - 1];
+        TextGetEncId (ent->encoding, enc, order);
+        *bom = ent->bom;
+        *isUtf8 = _lexIsUtf8 (ent->encoding);
+        found = true;
     }
-    // Silence clang-tidy warnings about buf being unused
-    (void) buf;
-    error (obuf);
+    _confMutexUnlock (&cache->lock);
+    return found;
 }
 
-lexState_t* _confLexInit (const char* file)
+// Makes room for another entry in the character set cache, rebuilding its
+// table. The cache must be locked
+static bool _lexCacheGrow (_confFileCache_t* cache)
+{
+    size_t maxEntries = cache->maxEntries ? (cache->maxEntries * 2) : 16;
+    size_t* table = _confCalloc (maxEntries * 2 * sizeof (size_t));
+    if (!table)
+        return false;
+    _confCharset_t* entries =
+        _confRealloc (cache->entries, maxEntries * sizeof (_confCharset_t));
+    if (!entries)
+    {
+        _confFree (table);
+        return false;
+    }
+    _confFree (cache->entryTable);
+    cache->entries = entries;
+    cache->maxEntries = maxEntries;
+    cache->entryTable = table;
+    for (size_t i = 0; i < cache->numEntries; ++i)
+    {
+        _confCharset_t* ent = &cache->entries[i];
+        table[_lexCacheSlot (cache, ent->file, ent->hash)] = i + 1;
+    }
+    return true;
+}
+
+// Adds a detected file to the character set cache. Failing to do so isn't an
+// error, as the file just gets detected again next time
+static void _lexCacheAdd (_confFileCache_t* cache,
+                          const char* file,
+                          DetectObj* obj)
+{
+    uint32_t hash = _confFileCacheHash (file);
+    char* fileCopy = _confMalloc (strlen (file) + 1);
+    char* encCopy = _confMalloc (strlen (obj->encoding) + 1);
+    if (!fileCopy || !encCopy)
+        goto error;
+    strcpy (fileCopy, file);
+    strcpy (encCopy, obj->encoding);
+    _confMutexLock (&cache->lock);
+    if (cache->numEntries == cache->maxEntries && !_lexCacheGrow (cache))
+    {
+        _confMutexUnlock (&cache->lock);
+        goto error;
+    }
+    // Another thread may have detected the file while this one did
+    size_t slot = _lexCacheSlot (cache, file, hash);
+    if (cache->entryTable[slot])
+    {
+        _confMutexUnlock (&cache->lock);
+        goto error;
+    }
+    _confCharset_t* ent = &cache->entries[cache->numEntries++];
+    ent->file = fileCopy;
+    ent->hash = hash;
+    ent->encoding = encCopy;
+    ent->bom = obj->bom;
+    cache->entryTable[slot] = cache->numEntries;
+    _confMutexUnlock (&cache->lock);
+    return;
+error:
+    _confFree (fileCopy);
+    _confFree (encCopy);
+}
+
+lexState_t* _confLexInit (const char* file,
+                          _confFileCache_t* cache,
+                          ConfDiagList_t* diags)
 {
     assert (file);
     // Create state
-    lexState_t* state = (lexState_t*) calloc_s (sizeof (lexState_t));
+    lexState_t* state = (lexState_t*) _confCalloc (sizeof (lexState_t));
     if (!state)
         return NULL;
-    // Detect character set
-    DetectObj* obj = detect_obj_init();
-    short res = 0;
-    if ((res = detect_file (file, 8192, &obj)) != CHARDET_SUCCESS)
+    state->file = file;
+    state->diags = diags;
+    char enc = 0, order = 0;
+    bool bom = false, isUtf8 = false;
+    // Files reached through different paths are only detected once
+    const char* key = file;
+    _confPathInfo_t info;
+    if (cache && _confFileCacheStat (cache, file, &info) && info.canonical)
+        key = info.canonical;
+    // Detect character set, unless another file in this batch already did
+    if (!cache || !_lexCacheFind (cache, key, &enc, &order, &bom, &isUtf8))
     {
-        if (res == CHARDET_IO_ERROR)
+        STATS_START (start);
+        DetectObj* obj = detect_obj_init();
+        short res = detect_file (file, 8192, &obj);
+        STATS_END (detectNs, start);
+        if (res != CHARDET_SUCCESS)
         {
-            free (state);
+            if (res == CHARDET_IO_ERROR)
+                _lexError (state, LEX_ERROR_INTERNAL, strerror (errno));
+            else
+            {
+                _lexError (state,
+                           LEX_ERROR_INTERNAL,
+                           "unable to detect character set");
+            }
+            _confFree (state);
             detect_obj_free (&obj);
-            _lexError (NULL, LEX_ERROR_INTERNAL, strerror (errno));
             return NULL;
         }
+        TextGetEncId (obj->encoding, &enc, &order);
+        bom = obj->bom;
+        isUtf8 = _lexIsUtf8 (obj->encoding);
+        if (cache)
+            _lexCacheAdd (cache, key, obj);
+        // Free stuff we're done with
+        detect_obj_free (&obj);
+    }
+#ifdef LIBCONF_ENABLE_STATS
+    struct stat st;
+    if (!stat (file, &st))
+        STATS_ADD (bytesRead, st.st_size);
+#endif
+    // Set up state
+    state->textPos.line = 1;
+    state->textPos.col = 1;
+    state->enc = enc;
+    state->order = order;
+    state->hasBom = bom;
+    state->isUtf8 = isUtf8;
+    // UTF-16 and UTF-32 are converted in bulk instead of through the stream
+    if (enc == TEXT_ENC_UTF16 || enc == TEXT_ENC_UTF32)
+    {
+        state->unitSz = (enc == TEXT_ENC_UTF16) ? 2 : 4;
+        state->isBigEndian = (order == TEXT_ORDER_BE);
+    }
+    return state;
+}
+
+bool _confLexSetBudget (lexState_t* state, _confBudget_t* budget)
+{
+    state->budget = budget;
+    uint64_t maxBytes = budget->limits->maxBytes;
+    if (!maxBytes)
+        return true;
+    struct stat st;
+    if (stat (state->file, &st))
+    {
+        _lexError (state, LEX_ERROR_INTERNAL, strerror (errno));
+        return false;
+    }
+    budget->bytes += st.st_size;
+    if (budget->bytes > maxBytes)
+    {
+        budget->exceeded = true;
+        _lexDiag (state, CONF_DIAG_BYTE_LIMIT, NULL, (int64_t) maxBytes);
+        return false;
+    }
+    return true;
+}
+
+lexState_t* _confLexInitPush (const char* name, ConfDiagList_t* diags)
+{
+    lexState_t* state = (lexState_t*) _confCalloc (sizeof (lexState_t));
+    if (!state)
+        return NULL;
+    state->file = name;
+    state->diags = diags;
+    state->buf = _confMalloc (LEX_FRAME_SZ);
+    if (!state->buf)
+    {
+        _confFree (state);
+        return NULL;
+    }
+    state->bufSz = LEX_FRAME_SZ;
+    state->textPos.line = 1;
+    state->textPos.col = 1;
+    state->isUtf8 = true;
+    state->checkBom = true;
+    return state;
+}
+
+void _confLexResetPush (lexState_t* state, const char* name)
+{
+    assert (!state->toks);
+    for (int i = 0; i < LEX_RING_SZ; ++i)
+    {
+        if (state->ring[i].semVal)
+            _confStrRelease (state->ring[i].semVal);
+    }
+    // Everything but the buffer starts over
+    const uint8_t* buf = state->buf;
+    size_t bufSz = state->bufSz;
+    _confBudget_t* budget = state->budget;
+    ConfDiagList_t* diags = state->diags;
+    memset (state, 0, sizeof (lexState_t));
+    state->file = name;
+    state->diags = diags;
+    state->budget = budget;
+    state->buf = buf;
+    state->bufSz = bufSz;
+    state->textPos.line = 1;
+    state->textPos.col = 1;
+    state->isUtf8 = true;
+    state->checkBom = true;
+}
+
+// Gets how much of a buffer ends on a whole UTF-8 character
+static inline size_t _lexUtf8Whole (const uint8_t* buf, size_t len)
+{
+    for (size_t i = 1; i <= 3 && i <= len; ++i)
+    {
+        uint8_t c = buf[len - i];
+        if ((c & 0xC0) != 0x80)
+        {
+            size_t n = (c >= 0xF0) ? 4 : (c >= 0xE0) ? 3 : (c >= 0xC0) ? 2 : 1;
+            return (n > i) ? (len - i) : len;
+        }
+    }
+    return len;
+}
+
+bool _confLexPush (lexState_t* state, const void* data, size_t len)
+{
+    _confBudget_t* budget = state->budget;
+    if (budget && budget->limits->maxBytes)
+    {
+        budget->bytes += len;
+        if (budget->bytes > budget->limits->maxBytes)
+        {
+            budget->exceeded = true;
+            _lexDiag (state,
+                      CONF_DIAG_BYTE_LIMIT,
+                      NULL,
+                      (int64_t) budget->limits->maxBytes);
+            return false;
+        }
+    }
+    STATS_ADD (bytesRead, len);
+    // Drop what has been lexed. A peeked character stays in nextChar, and keeps
+    // its bytes so it can still be located. Lines are counted up to there first,
+    // as the bytes are gone afterwards
+    uint8_t* buf = (uint8_t*) state->buf;
+    size_t drop = _lexBufTell (state);
+    _confTextAdvance (&state->textPos, buf, drop);
+    size_t left = state->bufFill - drop;
+    memmove (buf, buf + drop, left);
+    state->bufPos -= drop;
+    state->charPos = 0;
+    state->textPos.pos -= drop;
+    if ((left + len) > state->bufSz)
+    {
+        size_t bufSz = state->bufSz * 2;
+        if (bufSz < (left + len))
+            bufSz = left + len;
+        buf = _confRealloc (buf, bufSz);
+        if (!buf)
+        {
+            _lexError (state, LEX_ERROR_INTERNAL, strerror (ENOMEM));
+            return false;
+        }
+        state->buf = buf;
+        state->bufSz = bufSz;
+    }
+    memcpy (buf + left, data, len);
+    state->bufFill = left + len;
+    // A character cut off by the end of the input waits for the rest of it
+    state->bufLen = _lexUtf8Whole (buf, state->bufFill);
+    return true;
+}
+
+void _confLexDestroy (lexState_t* state)
+{
+    // Release tokens still in the ring
+    for (int i = 0; i < LEX_RING_SZ; ++i)
+    {
+        if (state->ring[i].semVal)
+            _confStrRelease (state->ring[i].semVal);
+    }
+    // Release tokens that were lexed ahead of time
+    for (size_t i = 0; i < state->numToks; ++i)
+    {
+        if (state->toks[i].semVal)
+            _confStrRelease (state->toks[i].semVal);
+    }
+    _confFree (state->toks);
+    _confFree ((void*) state->buf);
+    _confFree (state);
+}
+
+// Word at a time tests. TEXT_HAS_LESS is set if any byte of x is below n, and
+// TEXT_CONT marks the bytes of x that continue a UTF-8 character
+#define TEXT_ONES          0x0101010101010101ULL
+#define TEXT_HIGHS         0x8080808080808080ULL
+#define TEXT_HAS_LESS(x, n) (((x) - TEXT_ONES * (n)) & ~(x) & TEXT_HIGHS)
+#define TEXT_CONT(x)        ((x) & ~((x) << 1) & TEXT_HIGHS)
+
+void _confTextAdvance (_confTextPos_t* tp, const uint8_t* text, size_t pos)
+{
+    size_t i = tp->pos;
+    int line = tp->line;
+    int col = tp->col;
+    bool cr = tp->cr;
+    while (i < pos)
+    {
+        // Skip 8 bytes at once if none of them can end a line
+        if ((pos - i) >= 8)
+        {
+            uint64_t word;
+            memcpy (&word, text + i, 8);
+            if (!TEXT_HAS_LESS (word, '\r' + 1))
+            {
+                col += 8 - __builtin_popcountll (TEXT_CONT (word));
+                cr = false;
+                i += 8;
+                continue;
+            }
+        }
+        uint8_t c = text[i++];
+        if (c == '\n')
+        {
+            // The LF of a CR LF was counted with the CR
+            if (!cr)
+                ++line;
+            col = 1;
+            cr = false;
+        }
+        else if (c == '\r')
+        {
+            ++line;
+            col = 1;
+            cr = true;
+        }
         else
         {
-            free (state);
-            detect_obj_free (&obj);
-            _lexError (NULL, LEX_ERROR_INTERNAL, "unable to detect character set");
-            return NULL;
+            if ((c & 0xC0) != 0x80)
+                ++col;
+            cr = false;
         }
     }
-    char enc = 0, order = 0;
-    TextGetEncId (obj->encoding, &enc, &order);
-    // Open up the text stream
-    res = TextOpen (file, &state->stream, TEXT_MODE_READ, enc, obj->bom, order);
-    if (res != TEXT_SUCCESS)
+    tp->pos = i;
+    tp->line = line;
+    tp->col = col;
+    tp->cr = cr;
+}
+
+// Reads a whole file into a buffer from _confMalloc, with a byte to spare after
+// it. Returns NULL on error
+static uint8_t* _lexReadFile (const char* name, size_t* sz)
+{
+    FILE* file = fopen (name, "rb");
+    if (!file)
+        return NULL;
+    long fileSz = -1;
+    if (fseek (file, 0, SEEK_END) || (fileSz = ftell (file)) < 0 ||
+        fseek (file, 0, SEEK_SET))
     {
-        free (state);
-        detect_obj_free (&obj);
-        _lexError (NULL, LEX_ERROR_INTERNAL, TextError (res));
+        fclose (file);
         return NULL;
     }
-    // Set up state
-    state->line = 1;
-    // Free stuff we're done with
-    detect_obj_free (&obj);
-    return state;
+    *sz = (size_t) fileSz;
+    uint8_t* buf = _confMalloc (*sz + 1);
+    if (!buf || fread (buf, 1, *sz, file) != *sz)
+    {
+        _confFree (buf);
+        fclose (file);
+        return NULL;
+    }
+    fclose (file);
+    return buf;
 }
 
-void _confLexDestroy (lexState_t* state)
+bool _confLexLoad (lexState_t* state)
 {
-    if (state->stream)
-        TextClose (state->stream);
-    free (state);
+    assert (!state->buf);
+    STATS_START (start);
+    size_t sz = 0;
+    uint8_t* buf = NULL;
+    if (state->isUtf8)
+    {
+        // Read the file straight in
+        buf = _lexReadFile (state->file, &sz);
+        if (!buf)
+            goto error;
+        // Skip over the BOM
+        if (state->hasBom && sz >= 3)
+        {
+            sz -= 3;
+            memmove (buf, buf + 3, sz);
+        }
+    }
+    else if (state->unitSz)
+    {
+        // Read the file in and convert all of it at once
+        size_t rawSz = 0;
+        uint8_t* raw = _lexReadFile (state->file, &rawSz);
+        if (!raw)
+            goto error;
+        size_t bomSz = (state->hasBom && rawSz >= state->unitSz) ? state->unitSz : 0;
+        const uint8_t* text = raw + bomSz;
+        rawSz -= bomSz;
+        if (state->unitSz == 2)
+        {
+            buf = _confMalloc (rawSz / 2 * 3 + 3);
+            if (buf)
+                sz = _confUtf16ToUtf8 (buf, text, rawSz, state->isBigEndian);
+        }
+        else
+        {
+            buf = _confMalloc (rawSz + 3);
+            if (buf)
+                sz = _confUtf32ToUtf8 (buf, text, rawSz, state->isBigEndian);
+        }
+        _confFree (raw);
+        if (!buf)
+        {
+            errno = ENOMEM;
+            goto error;
+        }
+    }
+    else
+    {
+        // Other character sets are converted to UTF-8 through a text stream
+        TextStream_t* stream = NULL;
+        short res = TextOpen (state->file,
+                              &stream,
+                              TEXT_MODE_READ,
+                              state->enc,
+                              state->hasBom,
+                              state->order);
+        if (res != TEXT_SUCCESS)
+        {
+            _lexError (state, LEX_ERROR_INTERNAL, TextError (res));
+            return false;
+        }
+        assert (stream);
+        size_t bufSz = LEX_FRAME_SZ;
+        buf = _confMalloc (bufSz);
+        if (!buf)
+        {
+            TextClose (stream);
+            goto error;
+        }
+        while (1)
+        {
+            char32_t c = 0;
+            TextReadChar (stream, &c);
+            if (TextIsEof (stream))
+                break;
+            if ((sz + 4) >= bufSz)
+            {
+                bufSz *= 2;
+                uint8_t* newBuf = _confRealloc (buf, bufSz);
+                if (!newBuf)
+                {
+                    _confFree (buf);
+                    TextClose (stream);
+                    goto error;
+                }
+                buf = newBuf;
+            }
+            sz += _confUtf8Encode (c, buf + sz);
+        }
+        TextClose (stream);
+    }
+    state->buf = buf;
+    state->bufLen = sz;
+    state->bufPos = 0;
+    STATS_END (decodeNs, start);
+    return true;
+error:
+    _lexError (state, LEX_ERROR_INTERNAL, strerror (errno));
+    return false;
+}
+
+// Reads a character from the memory buffer
+static inline char32_t _lexBufRead (lexState_t* state)
+{
+    const uint8_t* s = state->buf + state->bufPos;
+    if (*s < 0x80)
+    {
+        ++state->bufPos;
+        return *s;
+    }
+    char32_t c = 0;
+    state->bufPos += _confUtf8Decode (s, state->bufLen - state->bufPos, &c);
+    return c;
 }
 
 // Reads a character from the file
 static inline char32_t _lexReadChar (lexState_t* state)
 {
     char32_t c = 0;
-    short res = 0;
     // Check if state.nextChar is set
     if (state->nextChar)
     {
@@ -240,14 +692,14 @@ static inline char32_t _lexReadChar (lexState_t* state)
     }
     else
     {
-        // Read in the character
-        TextReadChar (state->stream, &c);
-        // Check for end of file
-        if (TextIsEof (state->stream))
+        // Read from memory buffer
+        if (state->bufPos >= state->bufLen)
         {
             state->isEof = 1;
             return '\0';
         }
+        state->charPos = state->bufPos;
+        c = _lexBufRead (state);
     }
     state->curChar = c;
     return c;
@@ -257,20 +709,18 @@ static inline char32_t _lexReadChar (lexState_t* state)
 static inline char32_t _lexPeekChar (lexState_t* state)
 {
     char32_t __c = 0;
-    short __res = 0;
     // Check if nextChar is set
     if (state->nextChar)
         __c = state->nextChar;
     else
     {
-        // Read in a character, setting nextChar
-        TextReadChar (state->stream, &__c);
-        // Check for end of file
-        if (TextIsEof (state->stream))
+        if (state->bufPos >= state->bufLen)
         {
             state->isEof = 1;
             return '\0';
         }
+        state->charPos = state->bufPos;
+        __c = _lexBufRead (state);
         state->nextChar = __c;
     }
     return __c;
@@ -282,150 +732,250 @@ static inline char32_t _lexPeekChar (lexState_t* state)
 // Skips over a character that was peeked at
 #define _lexSkipChar(state) ((state)->nextChar = 0)
 
+// Classes of characters, looked up in _lexClasses
+#define LEX_CLASS_SPACE 1    // Whitespace
+#define LEX_CLASS_DIGIT 2    // Decimal digit
+#define LEX_CLASS_HEX   4    // Hexadecimal digit
+#define LEX_CLASS_ID    8    // May be part of an identifier
+
+// What to do with the first character of a token, looked up in _lexActions
+#define LEX_ACTION_UNKNOWN 0     // Not the start of any token
+#define LEX_ACTION_END     1     // End of the file
+#define LEX_ACTION_SPACE   2     // Whitespace to skip
+#define LEX_ACTION_POUND   3     // Pound comment
+#define LEX_ACTION_SLASH   4     // Slash or block comment
+#define LEX_ACTION_OBRACE  5     // Single character tokens
+#define LEX_ACTION_EBRACE  6
+#define LEX_ACTION_COLON   7
+#define LEX_ACTION_SEMI    8
+#define LEX_ACTION_COMMA   9
+#define LEX_ACTION_ID      10    // Identifier or keyword
+#define LEX_ACTION_ZERO    11    // Number with a base prefix
+#define LEX_ACTION_NUM     12    // Decimal number
+#define LEX_ACTION_SQUOTE  13    // Literal string
+#define LEX_ACTION_DQUOTE  14    // String with escapes and variables
+
+// Class of every character below 0x100. Everything past ASCII is left out, so
+// identifiers, numbers and whitespace are ASCII only
+#define SP LEX_CLASS_SPACE
+#define DG (LEX_CLASS_DIGIT | LEX_CLASS_HEX | LEX_CLASS_ID)
+#define HX (LEX_CLASS_HEX | LEX_CLASS_ID)
+#define ID LEX_CLASS_ID
+static const uint8_t _lexClasses[256] = {
+     0,  0,  0,  0,  0,  0,  0,  0,
+     0, SP, SP, SP, SP, SP,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,
+    SP,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0, ID,  0,  0,
+    DG, DG, DG, DG, DG, DG, DG, DG,
+    DG, DG,  0,  0,  0,  0,  0,  0,
+     0, HX, HX, HX, HX, HX, HX, ID,
+    ID, ID, ID, ID, ID, ID, ID, ID,
+    ID, ID, ID, ID, ID, ID, ID, ID,
+    ID, ID, ID,  0,  0,  0,  0, ID,
+     0, HX, HX, HX, HX, HX, HX, ID,
+    ID, ID, ID, ID, ID, ID, ID, ID,
+    ID, ID, ID, ID, ID, ID, ID, ID,
+    ID, ID, ID,  0,  0,  0,  0,  0,
+};
+#undef SP
+#undef DG
+#undef HX
+#undef ID
+
+// Action for the first character of a token, for every character below 0x100
+#define XX  LEX_ACTION_UNKNOWN
+#define END LEX_ACTION_END
+#define SP  LEX_ACTION_SPACE
+#define PND LEX_ACTION_POUND
+#define SLS LEX_ACTION_SLASH
+#define OBR LEX_ACTION_OBRACE
+#define EBR LEX_ACTION_EBRACE
+#define COL LEX_ACTION_COLON
+#define SEM LEX_ACTION_SEMI
+#define CMA LEX_ACTION_COMMA
+#define ID  LEX_ACTION_ID
+#define ZER LEX_ACTION_ZERO
+#define NUM LEX_ACTION_NUM
+#define SQT LEX_ACTION_SQUOTE
+#define DQT LEX_ACTION_DQUOTE
+static const uint8_t _lexActions[256] = {
+    END,  XX,  XX,  XX,  XX,  XX,  XX,  XX,
+     XX,  SP,  SP,  SP,  SP,  SP,  XX,  XX,
+     XX,  XX,  XX,  XX,  XX,  XX,  XX,  XX,
+     XX,  XX,  XX,  XX,  XX,  XX,  XX,  XX,
+     SP,  XX, DQT, PND,  XX,  XX,  XX, SQT,
+     XX,  XX,  XX,  XX, CMA, NUM,  XX, SLS,
+    ZER, NUM, NUM, NUM, NUM, NUM, NUM, NUM,
+    NUM, NUM, COL, SEM,  XX,  XX,  XX,  XX,
+     XX,  ID,  ID,  ID,  ID,  ID,  ID,  ID,
+     ID,  ID,  ID,  ID,  ID,  ID,  ID,  ID,
+     ID,  ID,  ID,  ID,  ID,  ID,  ID,  ID,
+     ID,  ID,  ID,  XX,  XX,  XX,  XX,  ID,
+     XX,  ID,  ID,  ID,  ID,  ID,  ID,  ID,
+     ID,  ID,  ID,  ID,  ID,  ID,  ID,  ID,
+     ID,  ID,  ID,  ID,  ID,  ID,  ID,  ID,
+     ID,  ID,  ID, OBR,  XX, EBR,  XX,  XX,
+};
+#undef XX
+#undef END
+#undef SP
+#undef PND
+#undef SLS
+#undef OBR
+#undef EBR
+#undef COL
+#undef SEM
+#undef CMA
+#undef ID
+#undef ZER
+#undef NUM
+#undef SQT
+#undef DQT
+
+// Gets the class of a character. Characters past the table have none
+#define _lexClassOf(c) (((c) < 0x100) ? _lexClasses[(c)] : 0)
+
 // Checks if the current character is whitespace
 static inline bool _lexIsSpace (char32_t c)
 {
-    switch (c)
-    {
-        case ' ':
-        case '\t':
-        case '\n':
-        case '\r':
-        case '\v':
-        case '\f':
-            return true;
-        default:
-            return false;
-    }
+    return _lexClassOf (c) & LEX_CLASS_SPACE;
 }
 
 // Checks if the current character is numeric
 static inline bool _lexIsNumeric (char32_t c, uint8_t base)
 {
-    switch (c)
-    {
-        case '0':
-        case '1':
-        case '2':
-        case '3':
-        case '4':
-        case '5':
-        case '6':
-        case '7':
-        case '8':
-        case '9':
-            return true;
-        case 'A':
-        case 'a':
-        case 'B':
-        case 'b':
-        case 'C':
-        case 'c':
-        case 'D':
-        case 'd':
-        case 'E':
-        case 'e':
-        case 'F':
-        case 'f':
-            return base == 16;
-        default:
-            return false;
-    }
+    return _lexClassOf (c) & ((base == 16) ? LEX_CLASS_HEX : LEX_CLASS_DIGIT);
 }
 
 // Checks if the current character is a valid ID character
 static inline bool _lexIsIdChar (char32_t c)
 {
-    switch (c)
-    {
-        case 'a':
-        case 'b':
-        case 'c':
-        case 'd':
-        case 'e':
-        case 'f':
-        case 'g':
-        case 'h':
-        case 'i':
-        case 'j':
-        case 'k':
-        case 'l':
-        case 'm':
-        case 'n':
-        case 'o':
-        case 'p':
-        case 'q':
-        case 'r':
-        case 's':
-        case 't':
-        case 'u':
-        case 'v':
-        case 'w':
-        case 'x':
-        case 'y':
-        case 'z':
-        case 'A':
-        case 'B':
-        case 'C':
-        case 'D':
-        case 'E':
-        case 'F':
-        case 'G':
-        case 'H':
-        case 'I':
-        case 'J':
-        case 'K':
-        case 'L':
-        case 'M':
-        case 'N':
-        case 'O':
-        case 'P':
-        case 'Q':
-        case 'R':
-        case 'S':
-        case 'T':
-        case 'U':
-        case 'V':
-        case 'W':
-        case 'X':
-        case 'Y':
-        case 'Z':
-        case '0':
-        case '1':
-        case '2':
-        case '3':
-        case '4':
-        case '5':
-        case '6':
-        case '7':
-        case '8':
-        case '9':
-        case '_':
-        case '-':
-            return true;
-        default:
+    return _lexClassOf (c) & LEX_CLASS_ID;
+}
+
+// Keywords are found with a perfect hash of their length and their first and
+// last characters. A new keyword goes in the slot its hash names. If that slot
+// is taken, -Woverride-init warns about it, and LEX_KEYWORDS_SZ or the hash has
+// to change
+#define LEX_KEYWORDS_SZ 8
+#define LEX_KEYWORD_HASH(len, first, last) \
+    (((len) + (first) + (last)) & (LEX_KEYWORDS_SZ - 1))
+
+// A keyword and the token it lexes to
+typedef struct _lexKeyword
+{
+    const char32_t* name;    // Text of the keyword
+    size_t len;              // Length of name
+    int type;                // Token type
+} lexKeyword_t;
+
+static const lexKeyword_t _lexKeywords[LEX_KEYWORDS_SZ] = {
+    [LEX_KEYWORD_HASH (7, 'i', 'e')] = {U"include", 7, LEX_TOKEN_INCLUDE},
+};
+
+// Gets the token type of an identifier, which is a keyword's if it is one
+static inline int _lexKeyword (const char32_t* id, size_t len)
+{
+    const lexKeyword_t* kw =
+        &_lexKeywords[LEX_KEYWORD_HASH (len, id[0], id[len - 1])];
+    if (kw->len == len && !memcmp (kw->name, id, len * sizeof (char32_t)))
+        return kw->type;
+    return LEX_TOKEN_ID;
+}
+
+// Copies a lexed string into one just big enough for it, so that short names
+// don't hold on to a whole STRINGMAX buffer for the life of the tree
+static inline StringRef32_t* _lexMakeStr (const char32_t* buf, size_t len)
+{
+    char32_t* str = _confMalloc ((len + 1) * sizeof (char32_t));
+    if (!str)
+        return NULL;
+    memcpy (str, buf, len * sizeof (char32_t));
+    str[len] = 0;
+    return _confStrCreate (str);
+}
+
+// Sets the line and column of a token from where it starts in the buffer. This
+// is done for every token, as the parse tree stores the position of every
+// block, property and value
+static inline void _lexLocate (lexState_t* state, _confToken_t* tok, size_t pos)
+{
+    _confTextAdvance (&state->textPos, state->buf, pos);
+    tok->line = state->textPos.line;
+    tok->col = state->textPos.col;
+}
+
+static bool _lexSkipBlock (lexState_t* state, int depth);
+
+// Checks if an identifier is the type of a block that is filtered out. c is the
+// character after it
+static bool _lexIsFiltered (lexState_t* state, const char32_t* id, char32_t c)
+{
+    // Only the first identifier of a block at the top level is its type
+    if (state->depth || state->prevType == LEX_TOKEN_ID ||
+        state->prevType == LEX_TOKEN_INCLUDE)
+    {
+        return false;
+    }
+    for (size_t i = 0; i < state->numBlockTypes; ++i)
+    {
+        if (!c32cmp (id, state->blockTypes[i]))
             return false;
     }
+    // Properties outside of a block are left for the parser to report
+    const uint8_t* buf = state->buf;
+    size_t pos = state->bufPos;
+    size_t len = state->bufLen;
+    while (1)
+    {
+        if (c == '#' || (c == '/' && pos < len && buf[pos] == '/'))
+        {
+            while (pos < len && buf[pos] != '\n' && buf[pos] != '\r')
+                ++pos;
+        }
+        else if (c == '/' && pos < len && buf[pos] == '*')
+        {
+            for (pos += 2; pos < len; ++pos)
+            {
+                if (buf[pos] == '/' && buf[pos - 1] == '*')
+                    break;
+            }
+            ++pos;
+        }
+        else if (!_lexIsSpace (c))
+            return c != ':';
+        if (pos >= len)
+            return true;
+        c = buf[pos++];
+    }
 }
 
 // Internal lexer. VERY performance critical, please try to keep additions to a
 // minimum
-_confToken_t* _lexInternal (lexState_t* state)
+static _confToken_t* _lexInternal (lexState_t* state, _confToken_t* tok)
 {
-    assert (state->stream);
     unsigned long bufPos = 0;
     int numBufPos = 0;
     int res = 0;
-    // Allocate token
-    _confToken_t* tok = (_confToken_t*) calloc_s (sizeof (_confToken_t));
-    if (!tok)
-        goto _internalError;
+    // Tokens are lexed here, and copied out once their length is known
+    char32_t semVal[STRINGMAX + 1];
+    // Prepare token slot
+    memset (tok, 0, sizeof (_confToken_t));
     state->tok = tok;
     tok->type = LEX_TOKEN_NONE;
+    // Files are lexed from memory, so tokens can be located by their offset
+    if (!state->buf && !_confLexLoad (state))
+    {
+        tok->type = LEX_TOKEN_ERROR;
+        return tok;
+    }
     // If we're at the end of the file, report it
+    size_t tokStart = _lexBufTell (state);
     if (state->isEof)
     {
-        tok->line = state->line;
+        _lexLocate (state, tok, tokStart);
         tok->type = LEX_TOKEN_EOF;
         return tok;
     }
@@ -433,35 +983,32 @@ _confToken_t* _lexInternal (lexState_t* state)
     state->isAccepted = false;
     while (!state->isAccepted)
     {
+        // Stop at the end of this lexer's chunk
+        tokStart = _lexBufTell (state);
+        if (state->bufLimit && tokStart >= state->bufLimit)
+        {
+            tok->type = LEX_TOKEN_NONE;
+            state->isEof = 1;
+            break;
+        }
         // Read in a character
         char32_t curChar = _lexReadChar (state);
         // Decide what to do with this character
-        switch (curChar)
+        switch ((curChar < 0x100) ? _lexActions[curChar] : LEX_ACTION_UNKNOWN)
         {
-            case '\0':
-                // Unconditionally accept on EOF
+            case LEX_ACTION_END:
+                // Unconditionally accept on EOF. A comment may come right before
+                tok->type = LEX_TOKEN_NONE;
                 state->isAccepted = true;
                 break;
-            case ' ':
-            case '\v':
-            case '\f':
-            case '\t':
+            case LEX_ACTION_SPACE:
+                // Lines are counted from token offsets, not here
                 break;
-            case '\r':
-                // Carriage return. Can be Mac style (CR alone) or DOS style (CR
-                // followed by LF) Look for an LF in case this is DOS style
-                if (_lexPeekChar (state) == '\n')
-                    _lexSkipChar (state);
-            // fall through
-            case '\n':
-                // Line feed. Increment current line
-                ++state->line;
-                break;
-            case '#':
+            case LEX_ACTION_POUND:
                 // Comment starting with a pound
                 tok->type = LEX_TOKEN_POUND_COMMENT;
                 goto lexComment;
-            case '/':
+            case LEX_ACTION_SLASH:
                 // Check for a single line comment
                 if (_lexPeekChar (state) == '/')
                 {
@@ -487,16 +1034,6 @@ _confToken_t* _lexInternal (lexState_t* state)
                             break;
                         }
                     }
-                    else if (curChar == '\r')
-                    {
-                        // Still increment line
-                        if (_lexPeekChar (state) == '\n')
-                            _lexSkipChar (state);
-                        ++state->line;
-                    }
-                    else if (curChar == '\n')
-                        ++state->line;
-
                     EXPECT_NO_EOF (curChar);
                     goto lexBlockComment;
                 }
@@ -507,105 +1044,46 @@ _confToken_t* _lexInternal (lexState_t* state)
                 // This is a comment
                 // Iterate through the comment
                 curChar = _lexReadChar (state);
-                CHECK_EOF (curChar);
+                if (curChar == '\0')
+                {
+                    tok->type = LEX_TOKEN_NONE;
+                    CHECK_EOF (curChar);
+                }
                 // Check for a newline
                 CHECK_NEWLINE_BREAK
                 goto lexComment;
             // Lex single character identifiers
-            case '{':
+            case LEX_ACTION_OBRACE:
                 // Prepare token
                 tok->type = LEX_TOKEN_OBRACE;
-                tok->line = state->line;
                 // Accept it
                 state->isAccepted = true;
                 break;
-            case '}':
+            case LEX_ACTION_EBRACE:
                 // Prepare it
                 tok->type = LEX_TOKEN_EBRACE;
-                tok->line = state->line;
                 // Accept
                 state->isAccepted = true;
                 break;
-            case ':':
+            case LEX_ACTION_COLON:
                 // Prepare it
                 tok->type = LEX_TOKEN_COLON;
-                tok->line = state->line;
                 // Accept
                 state->isAccepted = true;
                 break;
-            case ';':
+            case LEX_ACTION_SEMI:
                 // Prepare and accept
                 tok->type = LEX_TOKEN_SEMICOLON;
-                tok->line = state->line;
                 state->isAccepted = true;
                 break;
-            case ',':
+            case LEX_ACTION_COMMA:
                 // Same thing
                 tok->type = LEX_TOKEN_COMMA;
-                tok->line = state->line;
                 state->isAccepted = true;
                 break;
-            case 'a':
-            case 'b':
-            case 'c':
-            case 'd':
-            case 'e':
-            case 'f':
-            case 'g':
-            case 'h':
-            case 'i':
-            case 'j':
-            case 'k':
-            case 'l':
-            case 'm':
-            case 'n':
-            case 'o':
-            case 'p':
-            case 'q':
-            case 'r':
-            case 's':
-            case 't':
-            case 'u':
-            case 'v':
-            case 'w':
-            case 'x':
-            case 'y':
-            case 'z':
-            case 'A':
-            case 'B':
-            case 'C':
-            case 'D':
-            case 'E':
-            case 'F':
-            case 'G':
-            case 'H':
-            case 'I':
-            case 'J':
-            case 'K':
-            case 'L':
-            case 'M':
-            case 'N':
-            case 'O':
-            case 'P':
-            case 'Q':
-            case 'R':
-            case 'S':
-            case 'T':
-            case 'U':
-            case 'V':
-            case 'W':
-            case 'X':
-            case 'Y':
-            case 'Z':
-            case '_':
-            lexId:
+            case LEX_ACTION_ID:
                 // Prepare it
                 tok->type = LEX_TOKEN_ID;
-                tok->line = state->line;
-#define VARMAX 32
-                char32_t* semVal = malloc_s (VARMAX * sizeof (char32_t));
-                if (!semVal)
-                    goto _internalError;
                 // Add the rest of it
                 while (_lexIsIdChar (curChar))
                 {
@@ -624,13 +1102,25 @@ _confToken_t* _lexInternal (lexState_t* state)
                 // Return character to buffer
                 _lexReturnChar (state, curChar);
                 // Check if this is a keyword
-                if (!c32cmp (semVal, U"include"))
-                    tok->type = LEX_TOKEN_INCLUDE;
-                tok->semVal = StrRefCreate (semVal);
+                tok->type = _lexKeyword (semVal, bufPos);
+                // Skip blocks that were filtered out before making a string
+                if (state->blockTypes && tok->type == LEX_TOKEN_ID &&
+                    _lexIsFiltered (state, semVal, curChar))
+                {
+                    if (!_lexSkipBlock (state, 0))
+                        goto _internalError;
+                    tok->type = LEX_TOKEN_NONE;
+                    state->prevType = LEX_TOKEN_EBRACE;
+                    bufPos = 0;
+                    break;
+                }
+                tok->semVal = _lexMakeStr (semVal, bufPos);
+                if (!tok->semVal)
+                    goto _internalError;
                 // Accept
                 state->isAccepted = true;
                 break;
-            case '0':
+            case LEX_ACTION_ZERO:
                 // Figure out base when a number starts with 0
                 if (_lexPeekChar (state) == 'x')
                 {
@@ -649,29 +1139,17 @@ _confToken_t* _lexInternal (lexState_t* state)
                 curChar = _lexReadChar (state);
                 CHECK_EOF (curChar);
                 goto lexNum;
-            case '1':
-            case '2':
-            case '3':
-            case '4':
-            case '5':
-            case '6':
-            case '7':
-            case '8':
-            case '9':
-            case '-':
+            case LEX_ACTION_NUM:
                 tok->base = 10;
             lexNum:
                 // Prepare the token
                 tok->type = LEX_TOKEN_NUM;
-                tok->line = state->line;
-                semVal = malloc_s (VARMAX * sizeof (char32_t));
-                if (!semVal)
-                    goto _internalError;
                 // Add rest of value
                 while (_lexIsNumeric (curChar, tok->base) ||
                        (bufPos == 0 && curChar == '-'))
                 {
-                    if (bufPos >= VARMAX)
+                    // Leave room for the null terminator
+                    if (bufPos >= (VARMAX - 1))
                     {
                         _lexError (state, LEX_ERROR_BUFFER_OVERFLOW, NULL);
                         goto _internalError;
@@ -679,10 +1157,11 @@ _confToken_t* _lexInternal (lexState_t* state)
                     semVal[bufPos] = curChar;
                     ++bufPos;
                     curChar = _lexReadChar (state);
-                    CHECK_EOF (curChar);
+                    // A number may end the file
+                    CHECK_EOF_BREAK (curChar);
                 }
                 // Ensure the user didn't just pass '-'
-                if (bufPos <= 1 && semVal[0] == '-')
+                if (bufPos == 1 && semVal[0] == '-')
                 {
                     _lexError (state, LEX_ERROR_INVALID_NUMBER, NULL);
                     goto _internalError;
@@ -691,24 +1170,24 @@ _confToken_t* _lexInternal (lexState_t* state)
                 semVal[bufPos] = 0;
                 // Return first non-numeric character
                 _lexReturnChar (state, curChar);
-                // Convert the string to numeric
-                tok->num = strtoll (UnicodeToHost (semVal), NULL, tok->base);
+                // Convert the string to numeric. Digits are ASCII, so the locale
+                // doesn't come into it
+                char numStr[VARMAX];
+                for (unsigned long i = 0; i <= bufPos; ++i)
+                    numStr[i] = (char) semVal[i];
+                tok->num = strtoll (numStr, NULL, tok->base);
                 if (tok->num == LONG_MIN || tok->num == LONG_MAX)
                 {
                     _lexError (state, LEX_ERROR_INTERNAL, strerror (errno));
                     goto _internalError;
                 }
                 // Accept it
-                free (semVal);
                 state->isAccepted = true;
                 break;
-            case '\'':
+            case LEX_ACTION_SQUOTE:
                 // A literal string. Simply lex into semVal
                 tok->type = LEX_TOKEN_STR;
-                tok->line = state->line;
                 curChar = _lexReadChar (state);
-#define STRINGMAX 128
-                semVal = malloc_s (STRINGMAX * sizeof (char32_t));
                 while (curChar != '\'')
                 {
                     // Handle escape sequences
@@ -727,7 +1206,6 @@ _confToken_t* _lexInternal (lexState_t* state)
                             if (_lexPeekChar (state) == '\n' ||
                                 _lexPeekChar (state) == '\r')
                             {
-                                ++state->line;
                                 char32_t oc = _lexPeekChar (state);
                                 _lexSkipChar (state);
                                 // Skip over LF in case of CR
@@ -766,16 +1244,15 @@ _confToken_t* _lexInternal (lexState_t* state)
                     curChar = _lexReadChar (state);
                     EXPECT_NO_EOF (curChar);
                 }
-                semVal[bufPos] = 0;
-                tok->semVal = StrRefCreate (semVal);
+                tok->semVal = _lexMakeStr (semVal, bufPos);
+                if (!tok->semVal)
+                    goto _internalError;
                 state->isAccepted = true;
                 break;
-            case '"':
+            case LEX_ACTION_DQUOTE:
                 // A string potentially with variable references and other escapes.
                 // This is the hardest contsruct to lex
                 tok->type = LEX_TOKEN_STR;
-                tok->line = state->line;
-                semVal = malloc_s (STRINGMAX * sizeof (char32_t));
                 curChar = _lexReadChar (state);
                 while (curChar != '"')
                 {
@@ -795,7 +1272,6 @@ _confToken_t* _lexInternal (lexState_t* state)
                             if (_lexPeekChar (state) == '\n' ||
                                 _lexPeekChar (state) == '\r')
                             {
-                                ++state->line;
                                 char32_t oc = _lexPeekChar (state);
                                 _lexSkipChar (state);
                                 // Skip over LF in case of CR
@@ -868,41 +1344,18 @@ _confToken_t* _lexInternal (lexState_t* state)
                         char* var = getenv (varName);
                         if (var)
                         {
-                            size_t varLen = strlen (var);
-                            if (varLen > STRINGMAX)
-                            {
-                                _lexError (state, LEX_ERROR_BUFFER_OVERFLOW, NULL);
-                                goto _internalError;
-                            }
-                            // Convert to char32_t
-                            char32_t* var32 =
-                                (char32_t*) malloc_s (STRINGMAX * sizeof (char32_t));
-                            mbstate_t mbstate;
-                            memset (&mbstate, 0, sizeof (mbstate_t));
-                            if (mbstoc32s (var32,
-                                           var,
-                                           varLen,
-                                           STRINGMAX * sizeof (char32_t),
-                                           &mbstate) == -1)
-                            {
-                                free (var32);
-                                _lexError (state,
-                                           LEX_ERROR_INTERNAL,
-                                           strerror (errno));
-                                goto _internalError;
-                            }
-                            // Concatenate variable
-                            if (c32lcpy (semVal + bufPos,
-                                         var32,
-                                         STRINGMAX * sizeof (char32_t)) >=
-                                (STRINGMAX * sizeof (char32_t)))
+                            // Variables are taken to be UTF-8, whatever the
+                            // locale is
+                            size_t varLen = _confUtf8ToC32 (semVal + bufPos,
+                                                            STRINGMAX - bufPos,
+                                                            var,
+                                                            strlen (var));
+                            if (varLen > (STRINGMAX - bufPos))
                             {
-                                free (var32);
                                 _lexError (state, LEX_ERROR_BUFFER_OVERFLOW, NULL);
                                 goto _internalError;
                             }
                             bufPos += varLen;
-                            free (var32);
                         }
                         goto strEnd;
                     }
@@ -917,8 +1370,9 @@ _confToken_t* _lexInternal (lexState_t* state)
                     curChar = _lexReadChar (state);
                     EXPECT_NO_EOF (curChar);
                 }
-                semVal[bufPos] = 0;
-                tok->semVal = StrRefCreate (semVal);
+                tok->semVal = _lexMakeStr (semVal, bufPos);
+                if (!tok->semVal)
+                    goto _internalError;
                 state->isAccepted = true;
                 break;
             unkownToken:
@@ -929,12 +1383,132 @@ _confToken_t* _lexInternal (lexState_t* state)
         }
     }
 end:
+    // Keep track of where blocks start for the filter
+    if (tok->type == LEX_TOKEN_OBRACE)
+        ++state->depth;
+    else if (tok->type == LEX_TOKEN_EBRACE && state->depth)
+        --state->depth;
+    state->prevType = tok->type;
+    _lexLocate (state, tok, tokStart);
     return state->tok;
 _internalError:
+    _lexLocate (state, tok, tokStart);
     state->tok->type = LEX_TOKEN_ERROR;
     return state->tok;
 }
 
+// Skips a block at character level. Lines are counted from the offset of the
+// next token, so they don't have to be counted here
+static bool _lexSkipBlock (lexState_t* state, int depth)
+{
+    assert (state->buf);
+    char32_t curChar = 0;
+    char32_t quote = 0;
+    while (1)
+    {
+        curChar = _lexReadChar (state);
+        if (curChar == '\0')
+        {
+            _lexError (state, LEX_ERROR_UNTERMINATED, NULL);
+            return false;
+        }
+        // Strings. Escaped characters can't end them
+        if (quote)
+        {
+            if (curChar == '\\')
+                _lexReadChar (state);
+            else if (curChar == quote)
+                quote = 0;
+            continue;
+        }
+        switch (curChar)
+        {
+            case '\'':
+            case '"':
+                quote = curChar;
+                break;
+            case '#':
+            skipComment:
+                curChar = _lexReadChar (state);
+                if (curChar == '\r' || curChar == '\n')
+                    break;
+                else if (curChar == '\0')
+                {
+                    _lexError (state, LEX_ERROR_UNTERMINATED, NULL);
+                    return false;
+                }
+                goto skipComment;
+            case '/':
+                if (_lexPeekChar (state) == '/')
+                {
+                    _lexSkipChar (state);
+                    goto skipComment;
+                }
+                else if (_lexPeekChar (state) == '*')
+                {
+                    _lexSkipChar (state);
+                    while (1)
+                    {
+                        curChar = _lexReadChar (state);
+                        if (curChar == '*' && _lexPeekChar (state) == '/')
+                        {
+                            _lexSkipChar (state);
+                            break;
+                        }
+                        else if (curChar == '\0')
+                        {
+                            _lexError (state, LEX_ERROR_UNTERMINATED, NULL);
+                            return false;
+                        }
+                    }
+                }
+                break;
+            case '{':
+                ++depth;
+                break;
+            case '}':
+                // Check if this is the end of the block
+                if (--depth <= 0)
+                    return true;
+                break;
+        }
+    }
+}
+
+void _confLexSetFilter (lexState_t* state,
+                       const char32_t** blockTypes,
+                       size_t numBlockTypes)
+{
+    state->blockTypes = blockTypes;
+    state->numBlockTypes = numBlockTypes;
+}
+
+bool _confLexSkipBlock (lexState_t* state)
+{
+    // Tokens that are already in the ring have to be skipped as tokens
+    int depth = 0;
+    while (state->toks || state->numLexed != state->numConsumed)
+    {
+        _confToken_t* tok = _confLex (state);
+        if (tok->type == LEX_TOKEN_OBRACE)
+            ++depth;
+        else if (tok->type == LEX_TOKEN_EBRACE && --depth <= 0)
+            return true;
+        else if (tok->type == LEX_TOKEN_NONE || tok->type == LEX_TOKEN_EOF)
+        {
+            _lexError (state, LEX_ERROR_UNTERMINATED, NULL);
+            return false;
+        }
+        else if (tok->type == LEX_TOKEN_ERROR)
+            return false;
+    }
+    // Skip the rest of it without lexing
+    STATS_START (start);
+    bool res = _lexSkipBlock (state, depth);
+    STATS_END (lexNs, start);
+    return res;
+}
+
 const char* _confLexGetTokenName (_confToken_t* tok)
 {
     return _confLexGetTokenNameType (tok->type);
@@ -966,6 +1540,8 @@ const char* _confLexGetTokenNameType (int type)
             return "'number'";
         case LEX_TOKEN_STR:
             return "'string'";
+        case LEX_TOKEN_INCLUDE:
+            return "'include'";
         case LEX_TOKEN_EOF:
             return "'EOF'";
         default:
@@ -973,9 +1549,151 @@ const char* _confLexGetTokenNameType (int type)
     }
 }
 
+// Checks if tok ends the token stream
+#define LEX_IS_LAST(tok)                                              \
+    ((tok)->type == LEX_TOKEN_NONE || (tok)->type == LEX_TOKEN_EOF || \
+     (tok)->type == LEX_TOKEN_ERROR)
+
+// Lexes a batch of tokens into the ring
+static void _lexFill (lexState_t* state)
+{
+    // A slot can be reused once the token in it has been consumed, and is not
+    // one of the last LEX_RING_RETAIN tokens handed to the parser
+    size_t limit = state->numConsumed + LEX_RING_SZ;
+    if (state->numConsumed >= LEX_RING_RETAIN)
+        limit -= LEX_RING_RETAIN;
+    else
+        limit -= state->numConsumed;
+    STATS_START (start);
+    while (state->numLexed < limit)
+    {
+        _confToken_t* tok = &state->ring[state->numLexed % LEX_RING_SZ];
+        if (tok->semVal)
+            _confStrRelease (tok->semVal);
+        _lexInternal (state, tok);
+        ++state->numLexed;
+        STATS_ADD (tokens[tok->type], 1);
+        // Don't lex past the end of the stream
+        if (LEX_IS_LAST (tok))
+            break;
+    }
+    STATS_END (lexNs, start);
+}
+
 // Lexer entry points
+_confToken_t* _confLexToken (lexState_t* state, _confToken_t* tok)
+{
+    return _lexInternal (state, tok);
+}
+
+_confToken_t* _confLexPartial (lexState_t* state, _confToken_t* tok, bool final)
+{
+    if (final)
+        state->bufLen = state->bufFill;
+    if (state->checkBom)
+    {
+        // Wait until it's known if the input starts with a BOM
+        size_t avail = state->bufLen - state->bufPos;
+        size_t bomLen = (avail < 3) ? avail : 3;
+        if (!memcmp (state->buf + state->bufPos, "\xEF\xBB\xBF", bomLen))
+        {
+            if (bomLen < 3 && !final)
+                return NULL;
+            if (bomLen == 3)
+            {
+                state->bufPos += 3;
+                state->textPos.pos = state->bufPos;
+            }
+        }
+        state->checkBom = false;
+    }
+    if (final)
+        return _lexInternal (state, tok);
+    // Lex quietly, as hitting the end of the input isn't an error yet
+    size_t bufPos = state->bufPos;
+    size_t charPos = state->charPos;
+    char32_t nextChar = state->nextChar;
+    char32_t curChar = state->curChar;
+    _confTextPos_t textPos = state->textPos;
+    state->quiet = true;
+    _lexInternal (state, tok);
+    state->quiet = false;
+    if (!state->isEof && tok->type != LEX_TOKEN_ERROR)
+        return tok;
+    // Put the token back
+    if (tok->semVal)
+        _confStrRelease (tok->semVal);
+    bool isEof = state->isEof;
+    state->bufPos = bufPos;
+    state->charPos = charPos;
+    state->nextChar = nextChar;
+    state->curChar = curChar;
+    state->textPos = textPos;
+    state->isEof = false;
+    if (isEof)
+        return NULL;
+    // Lex it again to report the error
+    return _lexInternal (state, tok);
+}
+
+_confToken_t* _confLexPeek (lexState_t* state, int k)
+{
+    assert (k < (LEX_RING_SZ - LEX_RING_RETAIN));
+    // Tokens lexed ahead of time end with LEX_TOKEN_NONE, which is repeated
+    if (state->toks)
+    {
+        size_t idx = state->numConsumed + k;
+        if (idx >= state->numToks)
+            idx = state->numToks - 1;
+        return &state->toks[idx];
+    }
+    while ((state->numLexed - state->numConsumed) <= (size_t) k)
+    {
+        // Never lex past an error
+        if (state->numLexed != state->numConsumed)
+        {
+            _confToken_t* last = &state->ring[(state->numLexed - 1) % LEX_RING_SZ];
+            if (last->type == LEX_TOKEN_ERROR)
+                return last;
+        }
+        _lexFill (state);
+    }
+    return &state->ring[(state->numConsumed + k) % LEX_RING_SZ];
+}
+
+// Charges a token to the budget of the parse, turning it into an error if
+// there are too many. The end of the stream is free, as pushed input is parsed
+// in pieces that each end with it
+static _confToken_t* _lexCharge (lexState_t* state, _confToken_t* tok)
+{
+    uint64_t maxTokens = state->budget->limits->maxTokens;
+    if (maxTokens && tok->type != LEX_TOKEN_NONE &&
+        ++state->budget->tokens > maxTokens && tok->type != LEX_TOKEN_ERROR)
+    {
+        state->budget->exceeded = true;
+        _lexDiag (state, CONF_DIAG_TOKEN_LIMIT, NULL, (int64_t) maxTokens);
+        tok->type = LEX_TOKEN_ERROR;
+    }
+    return tok;
+}
+
 _confToken_t* _confLex (lexState_t* state)
 {
-    // Just lex and return
-    return _lexInternal (state);
+    _confToken_t* tok = NULL;
+    if (state->toks)
+    {
+        size_t idx = state->numConsumed;
+        if (idx < (state->numToks - 1))
+            ++state->numConsumed;
+        tok = &state->toks[idx];
+    }
+    else
+    {
+        if (state->numLexed == state->numConsumed)
+            _lexFill (state);
+        tok = &state->ring[state->numConsumed++ % LEX_RING_SZ];
+    }
+    if (state->budget)
+        return _lexCharge (state, tok);
+    return tok;
 }
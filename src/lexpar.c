@@ -0,0 +1,366 @@
+/*
+    lexpar.c - contains parallel lexer for confparse
+    Copyright 2022 The NexNix Project
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+         http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+/// @file lexpar.c
+
+/*
+ * The file is split into chunks right after newlines. Since a chunk may begin
+ * inside of a string or block comment, lexing happens in two passes.
+ *
+ * First, every chunk is scanned from each state it could start in. The scanner
+ * only tracks strings and comments, so this is much cheaper than lexing. This
+ * gives the state each chunk ends in for each start state, and where the first
+ * token boundary in the chunk is.
+ *
+ * The real start state of each chunk is then found by chaining the results
+ * together from the start of the file. Each chunk is then lexed from its first
+ * token boundary to the first token boundary of the next chunk. Lexers count
+ * lines from 0 at the start of their chunk, and the lines in each chunk are
+ * added up afterwards to get real line numbers.
+ */
+
+#include "internal.h"
+#include <assert.h>
+#include <libnex/safemalloc.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LEX_PAR_MIN_CHUNK 65536    // Smallest chunk worth giving to a thread
+
+// States a chunk can start in
+#define SCAN_NORMAL       0    // Between tokens
+#define SCAN_STRING       1    // In a literal string
+#define SCAN_STRING_ESCWS 2    // Skipping escaped whitespace in a literal string
+#define SCAN_VARSTRING    3    // In a string with variables
+#define SCAN_COMMENT      4    // In a block comment
+#define SCAN_NUM_STATES   5
+// Only valid inside of a chunk, as chunks begin after newlines
+#define SCAN_LINE_COMMENT 5
+
+#define SCAN_NO_BOUNDARY ((size_t) -1)
+
+// A chunk of the file
+typedef struct _lexChunk
+{
+    size_t start;                            // Start of chunk in buffer
+    size_t end;                              // End of chunk in buffer
+    int endState[SCAN_NUM_STATES];           // State at end for each start state
+    size_t boundary[SCAN_NUM_STATES];        // First token boundary for each state
+    size_t lexStart;                         // Where lexing starts
+    size_t lexEnd;                           // Where lexing ends
+    _confTextPos_t endPos;                   // End of chunk, counted from start
+    _confToken_t* toks;                      // Tokens lexed from this chunk
+    size_t numToks;                          // Number of tokens
+    bool failed;                             // Did lexing fail?
+} lexChunk_t;
+
+// State shared between threads
+typedef struct _lexPar
+{
+    lexState_t* state;     // Lexer we work for
+    lexChunk_t* chunks;    // Chunks of the file
+    int numChunks;         // Number of chunks
+} lexPar_t;
+
+// Checks if a character is whitespace
+static inline bool _scanIsSpace (uint8_t c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' ||
+           c == '\f';
+}
+
+// Scans buf from start to end, returning the state at the end. This must follow
+// _lexInternal's rules for strings and comments exactly
+static int _scanChunk (const uint8_t* buf,
+                       size_t start,
+                       size_t end,
+                       size_t len,
+                       int state,
+                       size_t* boundary)
+{
+    *boundary = (state == SCAN_NORMAL) ? start : SCAN_NO_BOUNDARY;
+    size_t pos = start;
+    while (pos < end)
+    {
+        uint8_t c = buf[pos];
+        uint8_t next = (pos + 1 < len) ? buf[pos + 1] : 0;
+        int oldState = state;
+        switch (state)
+        {
+            case SCAN_NORMAL:
+                if (c == '\'')
+                    state = SCAN_STRING;
+                else if (c == '"')
+                    state = SCAN_VARSTRING;
+                else if (c == '#')
+                    state = SCAN_LINE_COMMENT;
+                else if (c == '/' && next == '/')
+                {
+                    state = SCAN_LINE_COMMENT;
+                    ++pos;
+                }
+                else if (c == '/' && next == '*')
+                {
+                    state = SCAN_COMMENT;
+                    ++pos;
+                }
+                break;
+            case SCAN_LINE_COMMENT:
+                if (c == '\n' || c == '\r')
+                    state = SCAN_NORMAL;
+                break;
+            case SCAN_COMMENT:
+                if (c == '*' && next == '/')
+                {
+                    state = SCAN_NORMAL;
+                    ++pos;
+                }
+                break;
+            case SCAN_STRING:
+                if (c == '\\')
+                {
+                    if (next == '\\' || next == '\'')
+                        ++pos;
+                    else if (_scanIsSpace (next))
+                        state = SCAN_STRING_ESCWS;
+                }
+                else if (c == '\'')
+                    state = SCAN_NORMAL;
+                break;
+            case SCAN_STRING_ESCWS:
+                // The first character after the whitespace is always literal
+                if (!_scanIsSpace (c))
+                    state = SCAN_STRING;
+                break;
+            case SCAN_VARSTRING:
+                if (c == '\\')
+                {
+                    if (next == '\\' || next == '"' || next == '$' || next == 'n')
+                        ++pos;
+                }
+                else if (c == '"')
+                    state = SCAN_NORMAL;
+                break;
+        }
+        ++pos;
+        // Record the first point where a token can begin
+        if (state == SCAN_NORMAL && oldState != SCAN_NORMAL &&
+            oldState != SCAN_LINE_COMMENT && *boundary == SCAN_NO_BOUNDARY)
+        {
+            *boundary = pos;
+        }
+    }
+    return state;
+}
+
+// Scans a chunk from every start state
+static void _lexParScan (void* data, int idx)
+{
+    lexPar_t* par = data;
+    lexChunk_t* chunk = &par->chunks[idx];
+    for (int i = 0; i < SCAN_NUM_STATES; ++i)
+    {
+        chunk->endState[i] = _scanChunk (par->state->buf,
+                                         chunk->start,
+                                         chunk->end,
+                                         par->state->bufLen,
+                                         i,
+                                         &chunk->boundary[i]);
+    }
+}
+
+// Lexes a chunk
+static void _lexParLex (void* data, int idx)
+{
+    lexPar_t* par = data;
+    lexChunk_t* chunk = &par->chunks[idx];
+    bool isLast = (idx == (par->numChunks - 1));
+    lexState_t* state = _confCalloc (sizeof (lexState_t));
+    if (!state)
+    {
+        chunk->failed = true;
+        return;
+    }
+    state->file = par->state->file;
+    state->buf = par->state->buf;
+    state->bufLen = par->state->bufLen;
+    state->bufPos = chunk->lexStart;
+    state->bufLimit = isLast ? 0 : chunk->lexEnd;
+    state->textPos.pos = chunk->start;
+    state->textPos.col = 1;
+    state->quiet = true;
+    size_t maxToks = 64;
+    chunk->toks = _confMalloc (maxToks * sizeof (_confToken_t));
+    if (!chunk->toks)
+        goto error;
+    // An empty chunk still needs its terminating token if it's the last one
+    if (chunk->lexStart == chunk->lexEnd && !isLast)
+        goto done;
+    while (1)
+    {
+        if (chunk->numToks == maxToks)
+        {
+            maxToks *= 2;
+            _confToken_t* newToks =
+                _confRealloc (chunk->toks, maxToks * sizeof (_confToken_t));
+            if (!newToks)
+                goto error;
+            chunk->toks = newToks;
+        }
+        _confToken_t* tok = _confLexToken (state, &chunk->toks[chunk->numToks]);
+        if (tok->type == LEX_TOKEN_ERROR)
+        {
+            if (tok->semVal)
+                _confStrRelease (tok->semVal);
+            goto error;
+        }
+        // Only the last chunk keeps its end of file token
+        bool isEnd = (tok->type == LEX_TOKEN_NONE || tok->type == LEX_TOKEN_EOF);
+        if (isEnd && !isLast)
+            break;
+        ++chunk->numToks;
+        if (isEnd)
+            break;
+    }
+done:
+    // Chunks start after newlines, so they can be counted on their own
+    chunk->endPos.pos = chunk->start;
+    chunk->endPos.col = 1;
+    _confTextAdvance (&chunk->endPos, state->buf, chunk->end);
+    _confFree (state);
+    return;
+error:
+    chunk->failed = true;
+    _confFree (state);
+}
+
+// Releases tokens of all chunks
+static void _lexParFreeChunks (lexPar_t* par)
+{
+    for (int i = 0; i < par->numChunks; ++i)
+    {
+        lexChunk_t* chunk = &par->chunks[i];
+        for (size_t j = 0; j < chunk->numToks; ++j)
+        {
+            if (chunk->toks[j].semVal)
+                _confStrRelease (chunk->toks[j].semVal);
+        }
+        _confFree (chunk->toks);
+    }
+    _confFree (par->chunks);
+}
+
+bool _confLexParallel (lexState_t* state, int threads)
+{
+    assert (!state->numConsumed);
+    if (!state->buf && !_confLexLoad (state))
+        return false;
+    // Figure out how many chunks to make
+    size_t numChunks = state->bufLen / LEX_PAR_MIN_CHUNK;
+    if (numChunks > (size_t) threads)
+        numChunks = threads;
+    if (numChunks <= 1)
+        return true;
+    STATS_START (start);
+    lexPar_t par = {0};
+    par.state = state;
+    par.chunks = _confCalloc (numChunks * sizeof (lexChunk_t));
+    if (!par.chunks)
+        return false;
+    // Split the buffer after newlines
+    size_t chunkSz = state->bufLen / numChunks;
+    size_t pos = 0;
+    for (size_t i = 0; i < numChunks && pos < state->bufLen; ++i)
+    {
+        size_t end = state->bufLen;
+        if (i != (numChunks - 1) && (pos + chunkSz) < state->bufLen)
+        {
+            size_t from = pos + chunkSz;
+            const uint8_t* nl =
+                memchr (state->buf + from, '\n', state->bufLen - from);
+            if (nl)
+                end = (nl - state->buf) + 1;
+        }
+        par.chunks[par.numChunks].start = pos;
+        par.chunks[par.numChunks].end = end;
+        ++par.numChunks;
+        pos = end;
+    }
+    if (par.numChunks <= 1)
+    {
+        _confFree (par.chunks);
+        return true;
+    }
+    // Scan all chunks, then chain the results together
+    _confRunParallel (par.numChunks, _lexParScan, &par);
+    int scanState = SCAN_NORMAL;
+    for (int i = 0; i < par.numChunks; ++i)
+    {
+        lexChunk_t* chunk = &par.chunks[i];
+        chunk->lexStart = chunk->boundary[scanState];
+        scanState = chunk->endState[scanState];
+    }
+    // Chunks without a boundary are lexed by whichever chunk comes before them
+    par.chunks[par.numChunks - 1].lexEnd = state->bufLen;
+    for (int i = par.numChunks - 1; i >= 0; --i)
+    {
+        lexChunk_t* chunk = &par.chunks[i];
+        if (i != (par.numChunks - 1))
+            chunk->lexEnd = par.chunks[i + 1].lexStart;
+        if (chunk->lexStart == SCAN_NO_BOUNDARY)
+            chunk->lexStart = chunk->lexEnd;
+    }
+    // Unterminated strings and comments get reported by the sequential lexer
+    if (scanState != SCAN_NORMAL)
+        goto fallback;
+    _confRunParallel (par.numChunks, _lexParLex, &par);
+    // Stitch the tokens together
+    size_t numToks = 0;
+    for (int i = 0; i < par.numChunks; ++i)
+    {
+        if (par.chunks[i].failed)
+            goto fallback;
+        numToks += par.chunks[i].numToks;
+    }
+    state->toks = _confMalloc (numToks * sizeof (_confToken_t));
+    if (!state->toks)
+        goto fallback;
+    int line = state->textPos.line;
+    for (int i = 0; i < par.numChunks; ++i)
+    {
+        lexChunk_t* chunk = &par.chunks[i];
+        for (size_t j = 0; j < chunk->numToks; ++j)
+        {
+            STATS_ADD (tokens[chunk->toks[j].type], 1);
+            chunk->toks[j].line += line;
+            state->toks[state->numToks++] = chunk->toks[j];
+        }
+        line += chunk->endPos.line;
+        _confFree (chunk->toks);
+    }
+    state->textPos = par.chunks[par.numChunks - 1].endPos;
+    state->textPos.line = line;
+    _confFree (par.chunks);
+    state->isEof = true;
+    STATS_END (lexNs, start);
+    return true;
+fallback:
+    // Lex sequentially from the buffer instead
+    _lexParFreeChunks (&par);
+    STATS_END (lexNs, start);
+    return true;
+}
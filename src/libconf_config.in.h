@@ -21,6 +21,12 @@
 
 #cmakedefine HAVE_VISIBILITY
 #cmakedefine HAVE_DECLSPEC_EXPORT
+#cmakedefine HAVE_PTHREAD
+#cmakedefine LIBCONF_ENABLE_STATS
+#cmakedefine HAVE_SYS_SDT_H
+#cmakedefine HAVE_DIRENT_H
+#cmakedefine HAVE_FNMATCH_H
+#cmakedefine HAVE_REALPATH
 
 // Get visibility stuff right
 #ifdef HAVE_VISIBILITY
@@ -0,0 +1,418 @@
+/*
+    overlay.c - contains parse tree merging
+    Copyright 2022 The NexNix Project
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+         http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+/// @file overlay.c
+
+/*
+ * Overlays are merged in two passes. The first finds every block with the same
+ * type and name, using a hash table keyed on both. The second builds the merged
+ * tree. A block that only appears once is put in it as it is, with its
+ * properties shared. Blocks that appear more than once get a new property list,
+ * which is merged with a hash table keyed on property names. Each property
+ * remembers the slots it is in, so replacing it doesn't have to search the
+ * list. Everything is done in time linear in the size of the trees
+ */
+
+#include "internal.h"
+#include <libconf.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define OVERLAY_FNV_BASIS 2166136261U    // Start of an FNV-1a hash
+#define OVERLAY_FNV_PRIME 16777619U      // Multiplier of an FNV-1a hash
+#define OVERLAY_NONE      SIZE_MAX       // Ends a chain of slots
+
+// A block in the merged tree
+typedef struct _overlayBlock
+{
+    ConfBlock_t block;        // Block that is in the tree. Must be first
+    bool merged;              // Was block.props made by the overlay?
+    ConfProperty_t** made;    // Properties made by appending values
+    size_t numMade;           // Number of properties in made
+} overlayBlock_t;
+
+// A place a block appears in the trees
+typedef struct _overlayUse
+{
+    ConfBlock_t* block;    // The block
+    size_t layer;          // Index of the tree it is in
+    size_t next;           // Next use of the same type and name. OVERLAY_NONE
+} overlayUse_t;
+
+// All blocks with the same type and name
+typedef struct _overlayKey
+{
+    uint32_t hash;      // Hash of type and name
+    size_t firstUse;    // First use of the key
+    size_t lastUse;     // Last use of the key
+    size_t numUses;     // Number of uses
+    size_t numProps;    // Properties in all uses
+} overlayKey_t;
+
+// A property name in a block being merged
+typedef struct _overlayName
+{
+    uint32_t hash;          // Hash of the name
+    const char32_t* str;    // The name
+    size_t layer;           // Tree that last set the property
+    size_t first;           // First slot the property is in
+    size_t last;            // Last slot the property is in
+} overlayName_t;
+
+// State of an overlay
+typedef struct _overlay
+{
+    int policy;                // How to merge properties
+    ConfDiagList_t* diags;     // List to report errors to. NULL prints them
+    overlayUse_t* uses;        // Every block in the trees
+    size_t numUses;            // Number of blocks
+    overlayKey_t* keys;        // Every type and name, in order of appearance
+    size_t numKeys;            // Number of keys
+    size_t* table;             // Keys plus one, by hash. 0 if a slot is empty
+    size_t tableSz;            // Slots in table. A power of 2
+    ConfProperty_t** slots;    // Properties of the block being merged
+    size_t* next;              // Next slot with the same name. OVERLAY_NONE
+    overlayName_t* names;      // Names in the block being merged
+    size_t* nameTable;         // Names plus one, by hash
+    size_t maxProps;           // Properties in the biggest merged block
+    ListHead_t* head;          // The merged tree
+} overlay_t;
+
+// Adds a string to an FNV-1a hash
+static inline uint32_t _overlayHash (uint32_t hash, const char32_t* s)
+{
+    for (; *s; ++s)
+        hash = (hash ^ (uint32_t) *s) * OVERLAY_FNV_PRIME;
+    return hash;
+}
+
+// Gets the size of a hash table for num entries, which is kept half full
+static inline size_t _overlayTableSize (size_t num)
+{
+    size_t sz = 16;
+    while (sz < (num * 2))
+        sz *= 2;
+    return sz;
+}
+
+// Destroys a block of a merged tree
+static void _overlayDestroyBlock (const void* data)
+{
+    overlayBlock_t* block = (overlayBlock_t*) data;
+    // The properties in the list belong to other trees, except for made ones
+    if (block->merged)
+        ListDestroy (block->block.props);
+    for (size_t i = 0; i < block->numMade; ++i)
+        _confFree (block->made[i]);
+    _confFree (block->made);
+    _confFree (block);
+}
+
+// Reports a property that can't be merged
+static void _overlayDiag (overlay_t* overlay,
+                          int code,
+                          size_t layer,
+                          ConfProperty_t* prop)
+{
+    // Trees don't know which file they came from
+    char file[32];
+    snprintf (file, sizeof (file), "<tree %zu>", layer);
+    ConfDiag_t diag = {0};
+    diag.file = file;
+    diag.line = prop->lineNo;
+    diag.column = prop->colNo;
+    diag.code = code;
+    diag.token = -1;
+    diag.prevToken = -1;
+    diag.expected = -1;
+    if (code == CONF_DIAG_TOO_MANY_VALUES)
+        diag.value = MAX_PROPVAR;
+    _confDiag (overlay->diags, &diag);
+}
+
+// Finds the key of a block, adding it if it's new
+static overlayKey_t* _overlayFindKey (overlay_t* overlay, ConfBlock_t* block)
+{
+    const char32_t* type = StrRefGet (block->blockType);
+    const char32_t* name = block->blockName ? StrRefGet (block->blockName) : NULL;
+    uint32_t hash = _overlayHash (OVERLAY_FNV_BASIS, type);
+    if (name)
+        hash = _overlayHash (hash * OVERLAY_FNV_PRIME, name);
+    size_t mask = overlay->tableSz - 1;
+    size_t idx = hash & mask;
+    while (overlay->table[idx])
+    {
+        overlayKey_t* key = &overlay->keys[overlay->table[idx] - 1];
+        ConfBlock_t* other = overlay->uses[key->firstUse].block;
+        if (key->hash == hash && !c32cmp (StrRefGet (other->blockType), type))
+        {
+            if (!name && !other->blockName)
+                return key;
+            if (name && other->blockName &&
+                !c32cmp (StrRefGet (other->blockName), name))
+            {
+                return key;
+            }
+        }
+        idx = (idx + 1) & mask;
+    }
+    overlayKey_t* key = &overlay->keys[overlay->numKeys++];
+    overlay->table[idx] = overlay->numKeys;
+    key->hash = hash;
+    key->firstUse = OVERLAY_NONE;
+    key->lastUse = OVERLAY_NONE;
+    key->numUses = 0;
+    key->numProps = 0;
+    return key;
+}
+
+// Finds the name of a property in the block being merged, adding it if it's
+// new. isNew is set if it was added
+static overlayName_t* _overlayFindName (overlay_t* overlay,
+                                        size_t numNames,
+                                        size_t tableSz,
+                                        ConfProperty_t* prop,
+                                        bool* isNew)
+{
+    const char32_t* str = StrRefGet (prop->name);
+    uint32_t hash = _overlayHash (OVERLAY_FNV_BASIS, str);
+    size_t mask = tableSz - 1;
+    size_t idx = hash & mask;
+    while (overlay->nameTable[idx])
+    {
+        overlayName_t* name = &overlay->names[overlay->nameTable[idx] - 1];
+        if (name->hash == hash && !c32cmp (name->str, str))
+        {
+            *isNew = false;
+            return name;
+        }
+        idx = (idx + 1) & mask;
+    }
+    overlay->nameTable[idx] = numNames + 1;
+    overlayName_t* name = &overlay->names[numNames];
+    name->hash = hash;
+    name->str = str;
+    *isNew = true;
+    return name;
+}
+
+// Merges the properties of every use of a key into block
+static bool _overlayMerge (overlay_t* overlay,
+                           overlayKey_t* key,
+                           overlayBlock_t* block)
+{
+    size_t tableSz = _overlayTableSize (key->numProps);
+    memset (overlay->nameTable, 0, tableSz * sizeof (size_t));
+    size_t numSlots = 0, numNames = 0;
+    for (size_t use = key->firstUse; use != OVERLAY_NONE;
+         use = overlay->uses[use].next)
+    {
+        size_t layer = overlay->uses[use].layer;
+        ListEntry_t* propEnt = ListFront (overlay->uses[use].block->props);
+        while (propEnt)
+        {
+            ConfProperty_t* prop = ListEntryData (propEnt);
+            propEnt = ListIterate (propEnt);
+            size_t slot = numSlots++;
+            overlay->slots[slot] = prop;
+            overlay->next[slot] = OVERLAY_NONE;
+            bool isNew = false;
+            overlayName_t* name =
+                _overlayFindName (overlay, numNames, tableSz, prop, &isNew);
+            if (isNew)
+                ++numNames;
+            // Properties repeated in one tree are all kept
+            if (isNew || name->layer == layer)
+            {
+                if (isNew)
+                    name->first = slot;
+                else
+                    overlay->next[name->last] = slot;
+                name->last = slot;
+                name->layer = layer;
+                continue;
+            }
+            if (overlay->policy == CONF_OVERLAY_ERROR)
+            {
+                _overlayDiag (overlay, CONF_DIAG_CONFLICT, layer, prop);
+                return false;
+            }
+            if (overlay->policy == CONF_OVERLAY_APPEND)
+            {
+                // Add the values to a copy of the last property with the name
+                ConfProperty_t* last = overlay->slots[name->last];
+                if ((last->nextVal + prop->nextVal) >= MAX_PROPVAR)
+                {
+                    _overlayDiag (overlay, CONF_DIAG_TOO_MANY_VALUES, layer, prop);
+                    return false;
+                }
+                if (!block->made)
+                {
+                    block->made = _confMalloc (key->numProps *
+                                               sizeof (ConfProperty_t*));
+                    if (!block->made)
+                        return false;
+                }
+                ConfProperty_t* res = _confMalloc (sizeof (ConfProperty_t));
+                if (!res)
+                    return false;
+                block->made[block->numMade++] = res;
+                memcpy (res, last, sizeof (ConfProperty_t));
+                memcpy (&res->vals[res->nextVal],
+                        prop->vals,
+                        prop->nextVal * sizeof (ConfPropVal_t));
+                res->nextVal += prop->nextVal;
+                overlay->slots[name->last] = res;
+                overlay->slots[slot] = NULL;
+                name->layer = layer;
+                continue;
+            }
+            // Drop every property the name was set by before
+            for (size_t i = name->first; i != OVERLAY_NONE; i = overlay->next[i])
+                overlay->slots[i] = NULL;
+            name->first = slot;
+            name->last = slot;
+            name->layer = layer;
+        }
+    }
+    for (size_t i = 0; i < numSlots; ++i)
+    {
+        ConfProperty_t* prop = overlay->slots[i];
+        if (prop && !ListAddBack (block->block.props, prop, 0))
+            return false;
+    }
+    return true;
+}
+
+// Finds every block with the same type and name
+static bool _overlayFindKeys (overlay_t* overlay, ListHead_t** trees, size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (!trees[i])
+            return false;
+        ListEntry_t* blockEnt = ListFront (trees[i]);
+        while (blockEnt)
+        {
+            ++overlay->numUses;
+            blockEnt = ListIterate (blockEnt);
+        }
+    }
+    overlay->tableSz = _overlayTableSize (overlay->numUses);
+    overlay->uses = _confMalloc ((overlay->numUses + 1) * sizeof (overlayUse_t));
+    overlay->keys = _confMalloc ((overlay->numUses + 1) * sizeof (overlayKey_t));
+    overlay->table = _confCalloc (overlay->tableSz * sizeof (size_t));
+    if (!overlay->uses || !overlay->keys || !overlay->table)
+        return false;
+    size_t curUse = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        ListEntry_t* blockEnt = ListFront (trees[i]);
+        while (blockEnt)
+        {
+            ConfBlock_t* block = ListEntryData (blockEnt);
+            blockEnt = ListIterate (blockEnt);
+            overlayUse_t* use = &overlay->uses[curUse];
+            use->block = block;
+            use->layer = i;
+            use->next = OVERLAY_NONE;
+            overlayKey_t* key = _overlayFindKey (overlay, block);
+            if (key->lastUse == OVERLAY_NONE)
+                key->firstUse = curUse;
+            else
+                overlay->uses[key->lastUse].next = curUse;
+            key->lastUse = curUse;
+            ++key->numUses;
+            ListEntry_t* propEnt = ListFront (block->props);
+            while (propEnt)
+            {
+                ++key->numProps;
+                propEnt = ListIterate (propEnt);
+            }
+            if (key->numUses > 1 && key->numProps > overlay->maxProps)
+                overlay->maxProps = key->numProps;
+            ++curUse;
+        }
+    }
+    return true;
+}
+
+// Builds the merged tree
+static bool _overlayBuild (overlay_t* overlay)
+{
+    // Scratch space is shared by every merged block
+    size_t nameTableSz = _overlayTableSize (overlay->maxProps);
+    size_t maxProps = overlay->maxProps + 1;
+    overlay->slots = _confMalloc (maxProps * sizeof (ConfProperty_t*));
+    overlay->next = _confMalloc (maxProps * sizeof (size_t));
+    overlay->names = _confMalloc (maxProps * sizeof (overlayName_t));
+    overlay->nameTable = _confMalloc (nameTableSz * sizeof (size_t));
+    if (!overlay->slots || !overlay->next || !overlay->names || !overlay->nameTable)
+        return false;
+    for (size_t i = 0; i < overlay->numKeys; ++i)
+    {
+        overlayKey_t* key = &overlay->keys[i];
+        ConfBlock_t* first = overlay->uses[key->firstUse].block;
+        overlayBlock_t* block = _confCalloc (sizeof (overlayBlock_t));
+        if (!block)
+            return false;
+        block->block = *first;
+        if (!ListAddBack (overlay->head, block, 0))
+        {
+            _confFree (block);
+            return false;
+        }
+        if (key->numUses == 1)
+            continue;
+        block->block.props = ListCreate ("ConfProperty", false, 0);
+        if (!block->block.props)
+            return false;
+        block->merged = true;
+        if (!_overlayMerge (overlay, key, block))
+            return false;
+    }
+    return true;
+}
+
+LIBCONF_PUBLIC ListHead_t* ConfOverlay (ListHead_t** trees,
+                                        size_t count,
+                                        int policy,
+                                        ConfDiagList_t* diags)
+{
+    overlay_t overlay = {0};
+    overlay.policy = policy;
+    overlay.diags = diags;
+    overlay.head = ListCreate ("ConfBlock", false, 0);
+    if (!overlay.head)
+        return NULL;
+    ListSetDestroy (overlay.head, _overlayDestroyBlock);
+    bool res = _overlayFindKeys (&overlay, trees, count) && _overlayBuild (&overlay);
+    _confFree (overlay.uses);
+    _confFree (overlay.keys);
+    _confFree (overlay.table);
+    _confFree (overlay.slots);
+    _confFree (overlay.next);
+    _confFree (overlay.names);
+    _confFree (overlay.nameTable);
+    if (!res)
+    {
+        ListDestroy (overlay.head);
+        return NULL;
+    }
+    return overlay.head;
+}
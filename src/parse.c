@@ -18,30 +18,60 @@
 /// @file parse.c
 
 #include "internal.h"
-#include <errno.h>
 #include <libconf.h>
 #include <libnex/error.h>
 #include <libnex/list.h>
 #include <libnex/safemalloc.h>
 #include <libnex/safestring.h>
+#include <errno.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
 
 // State of the parser
 typedef struct _parser
 {
-    lexState_t* lex;            // Underlying lexer of this parser
-    ListHead_t* head;           // Linked list for configuration block
-    _confToken_t* lastToken;    // So we can backtrack a little during errors
+    lexState_t* lex;               // Underlying lexer of this parser
+    ListHead_t* head;              // Linked list for configuration block
+    _confToken_t* lastToken;       // So we can backtrack a little during errors
+    _confToken_t* curToken;        // Last token read, to resynchronize from
+    const ConfOptions_t* opts;     // Options for this parse. May be NULL
+    _confFileCache_t* cache;       // File cache. May be NULL
+    _confFileCache_t* ownCache;    // Cache to start at the first include, if any
+    _confBudget_t* budget;         // Budget of the parse. NULL if unlimited
+    ConfDiagList_t* diags;         // List to report errors to. NULL prints them
+    int depth;                     // Number of includes this file is nested in
+    bool recover;                  // Go on after syntax errors?
+    bool lexFailed;                // Did the lexer report an error?
 } parseState_t;
 
-// Parser error states
-#define PARSE_ERROR_UNEXPECTED_TOKEN 1
-#define PARSE_ERROR_INTERNAL         2
-#define PARSE_ERROR_OVERFLOW         3
-#define PARSE_ERROR_TOO_MANY_PROPS   4
+// A file of an include statement that names several. Each is parsed into a list
+// of its own, so they can be parsed at once
+typedef struct _parseFragment
+{
+    const char* file;         // File to parse
+    ListHead_t* head;         // Blocks of the file
+    ConfDiagList_t diags;     // Errors of the file, reported in order later
+    bool res;                 // Did the file parse?
+#ifdef LIBCONF_ENABLE_STATS
+    ConfStats_t stats;        // Statistics of the file
+#endif
+} parseFragment_t;
 
-void _confSetFileName (const char* file);
+// Files of an include statement being parsed at once
+typedef struct _parseFragments
+{
+    parseState_t* parent;       // Parser of the include statement
+    parseFragment_t* frags;     // Files, in the order they are included in
+} parseFragments_t;
+
+// Parser error states
+#define PARSE_ERROR_UNEXPECTED_TOKEN  CONF_DIAG_UNEXPECTED_TOKEN
+#define PARSE_ERROR_INTERNAL          CONF_DIAG_INTERNAL
+#define PARSE_ERROR_TOO_MANY_PROPS    CONF_DIAG_TOO_MANY_VALUES
+#define PARSE_ERROR_MISSING_SEMICOLON CONF_DIAG_MISSING_SEMICOLON
+#define PARSE_ERROR_PROP_NO_BLOCK     CONF_DIAG_PROP_NO_BLOCK
+#define PARSE_ERROR_UNTERMINATED      CONF_DIAG_UNTERMINATED
 
 static inline _confToken_t* _parseInclude (parseState_t*, _confToken_t*);
 
@@ -49,138 +79,181 @@ static inline _confToken_t* _parseInclude (parseState_t*, _confToken_t*);
 static void _parseDestroyBlock (const void* data)
 {
     ConfBlock_t* block = (ConfBlock_t*) data;
-    StrRefDestroy (block->blockType);
+    _confStrRelease (block->blockType);
     if (block->blockName)
-        StrRefDestroy (block->blockName);
+        _confStrRelease (block->blockName);
     ListDestroy (block->props);
-    free (block);
+    _confFree (block);
 }
 
 // Destroys a property
 static void _parseDestroyProp (const void* data)
 {
     ConfProperty_t* prop = (ConfProperty_t*) data;
-    StrRefDestroy (prop->name);
+    _confStrRelease (prop->name);
     for (int i = 0; i < prop->nextVal; ++i)
     {
         if (prop->vals[i].type == DATATYPE_STRING)
-            StrRefDestroy (prop->vals[i].str);
+            _confStrRelease (prop->vals[i].str);
         else if (prop->vals[i].type == DATATYPE_IDENTIFIER)
-            StrRefDestroy (prop->vals[i].id);
+            _confStrRelease (prop->vals[i].id);
     }
-    free (prop);
+    _confFree (prop);
+}
+
+// Reports a diagnostic message. expected is the token type that should have
+// been found, or -1. value is the limit for limit errors
+static void _parseDiag (parseState_t* parser,
+                        _confToken_t* tok,
+                        int err,
+                        int expected,
+                        int64_t value,
+                        const char* extra)
+{
+    PROBE3 (parse__error, parser->lex->file, tok->line, err);
+    ConfDiag_t diag = {0};
+    diag.file = parser->lex->file;
+    diag.line = tok->line;
+    diag.column = tok->col;
+    diag.code = err;
+    // The end of the stream is reported as EOF
+    diag.token = (tok->type == LEX_TOKEN_NONE) ? LEX_TOKEN_EOF : tok->type;
+    diag.prevToken = -1;
+    if (err == PARSE_ERROR_UNEXPECTED_TOKEN && parser->lastToken)
+        diag.prevToken = parser->lastToken->type;
+    diag.expected = expected;
+    diag.value = value;
+    diag.detail = extra;
+    _confDiag (parser->diags, &diag);
 }
 
 // Reports a diagnostic message
-static void _parseError (parseState_t* parser,
-                         _confToken_t* tok,
-                         int err,
-                         void* extra)
+static inline void _parseError (parseState_t* parser, _confToken_t* tok, int err)
 {
-    // Prepare error buffer
-    char bufData[2048];
-
-    char* obuf = bufData;
-    char* buf = bufData;
-    buf += snprintf (buf, 2048 - (buf - obuf), "error: %s:", ConfGetFileName());
-    buf += snprintf (buf, 2048 - (buf - obuf), "%d: ", tok->line);
-    // Decide how to handle the error
-    switch (err)
-    {
-        case PARSE_ERROR_UNEXPECTED_TOKEN:
-            if (parser->lastToken)
-            {
-                buf += snprintf (buf,
-                                 2048 - (buf - obuf),
-                                 "unexpected token %s after token %s",
-                                 _confLexGetTokenName (tok),
-                                 _confLexGetTokenName (parser->lastToken));
-            }
-            else
-                buf += snprintf (buf,
-                                 2048 - (buf - obuf),
-                                 "unexpected token %s",
-                                 _confLexGetTokenName (tok));
-            // Add some context
-            if (extra)
-            {
-                buf += snprintf (buf,
-                                 2048 - (buf - obuf),
-                                 " (expected %s)",
-                                 _confLexGetTokenNameType (*((int*) extra)));
-            }
-            break;
-        case PARSE_ERROR_OVERFLOW:
-            buf += snprintf (buf,
-                             2048 - (buf - obuf),
-                             "string too long on token %s",
-                             _confLexGetTokenName (tok));
-            break;
-        case PARSE_ERROR_TOO_MANY_PROPS:
-            buf += snprintf (buf,
-                             2048 - (buf - obuf),
-                             "too many values on property '%s'",
-                             (char*) extra);
-            break;
-        case PARSE_ERROR_INTERNAL:
-            buf += snprintf (buf,
-                             2048 - (buf - obuf),
-                             "internal error: %s",
-                             (char*) extra);
-            break;
-    }
-    // Silence clang-tidy warnings about buf being unused
-    (void) buf;
-    error (obuf);
+    _parseDiag (parser, tok, err, -1, 0, NULL);
 }
 
-// Accepts a new token, saving last one
+// Reports a token other than the one that was expected
+static inline void _parseExpected (parseState_t* parser,
+                                   _confToken_t* tok,
+                                   int expected)
+{
+    _parseDiag (parser, tok, PARSE_ERROR_UNEXPECTED_TOKEN, expected, 0, NULL);
+}
+
+// Accepts a new token, saving last one. Tokens belong to the lexer's ring, which
+// keeps the last one valid for us
 _confToken_t* _parseToken (parseState_t* state, _confToken_t* lastTok)
 {
-    // Free token
-    if (state->lastToken)
-    {
-        if (state->lastToken->semVal)
-            StrRefDestroy (state->lastToken->semVal);
-        free (state->lastToken);
-    }
     state->lastToken = lastTok;
     _confToken_t* tok = _confLex (state->lex);
+    state->curToken = tok;
     if (tok->type == LEX_TOKEN_ERROR)
+    {
+        state->lexFailed = true;
         return NULL;
+    }
     return tok;
 }
 
-// Expects a specified token to exist
-_confToken_t* _parseExpect (parseState_t* state, _confToken_t* lastTok, int tokType)
+// Checks if the parse went over one of its limits
+static inline bool _parseOverBudget (parseState_t* state)
 {
-    _confToken_t* tok = _parseToken (state, lastTok);
-    // Ensure this token is the one expected
-    if (!tok)
-        return NULL;
-    else if (tok->type != tokType)
+    return state->budget && (state->budget->exceeded || state->budget->outOfMemory);
+}
+
+// Adds one to a counter of the budget. Returns false if that goes over max
+static bool _parseCharge (parseState_t* state,
+                          _confToken_t* tok,
+                          uint64_t* count,
+                          uint64_t max,
+                          int err)
+{
+    if (!max || ++*count <= max)
+        return true;
+    state->budget->exceeded = true;
+    _parseDiag (state, tok, err, -1, (int64_t) max, NULL);
+    return false;
+}
+
+// Skips to the next ';' or '}' after a syntax error, so parsing can go on from
+// there. Returns the token it stopped at, which is the end of the stream if
+// there is none, or NULL if the lexer failed
+static _confToken_t* _parseSync (parseState_t* state)
+{
+    _confToken_t* tok = state->curToken;
+    while (tok->type != LEX_TOKEN_SEMICOLON && tok->type != LEX_TOKEN_EBRACE &&
+           tok->type != LEX_TOKEN_NONE && tok->type != LEX_TOKEN_EOF)
     {
-        _parseError (state, tok, PARSE_ERROR_UNEXPECTED_TOKEN, &tokType);
-        return NULL;
+        tok = _parseToken (state, tok);
+        if (!tok)
+            return NULL;
     }
     return tok;
 }
 
+// Adds a value to a property. Returns false if there is no room for it
+static inline bool _parseAddValue (parseState_t* state,
+                                   ConfProperty_t* prop,
+                                   _confToken_t* tok)
+{
+    ConfPropVal_t* val = &prop->vals[prop->nextVal];
+    val->lineNo = tok->line;
+    val->colNo = tok->col;
+    val->base = 0;
+    if (tok->type == LEX_TOKEN_STR)
+    {
+        val->type = DATATYPE_STRING;
+        val->str = StrRefNew (tok->semVal);
+    }
+    else if (tok->type == LEX_TOKEN_ID)
+    {
+        val->type = DATATYPE_IDENTIFIER;
+        val->id = StrRefNew (tok->semVal);
+    }
+    else
+    {
+        val->type = DATATYPE_NUMBER;
+        val->numVal = tok->num;
+        val->base = tok->base;
+    }
+    ++prop->nextVal;
+    if (prop->nextVal >= MAX_PROPVAR)
+    {
+        _parseError (state, tok, PARSE_ERROR_TOO_MANY_PROPS);
+        return false;
+    }
+    return true;
+}
+
 // Parses a block in the configuration file
 static _confToken_t* _parseBlock (parseState_t* state, _confToken_t* tok)
 {
+    _confBudget_t* budget = state->budget;
+    if (budget && !_parseCharge (state,
+                                 tok,
+                                 &budget->blocks,
+                                 budget->limits->maxBlocks,
+                                 CONF_DIAG_BLOCK_LIMIT))
+    {
+        return NULL;
+    }
     // Create a new block and add it to list
-    ConfBlock_t* block = (ConfBlock_t*) malloc_s (sizeof (ConfBlock_t));
+    ConfBlock_t* block = (ConfBlock_t*) _confMalloc (sizeof (ConfBlock_t));
     if (!block)
         return NULL;
     if (!ListAddBack (state->head, block, 0))
         return NULL;
+    STATS_ADD (blocks, 1);
+    PROBE2 (block__begin, tok->line, StrRefGet (tok->semVal));
     // Initialize it
     block->lineNo = tok->line;
+    block->colNo = tok->col;
     block->props = ListCreate ("ConfProperty", false, 0);
     ListSetDestroy (block->props, _parseDestroyProp);
     // Set type of block
     block->blockType = StrRefNew (tok->semVal);
+    block->blockName = NULL;
     // Check if block has a name
     tok = _parseToken (state, tok);
     if (!tok)
@@ -190,16 +263,19 @@ static _confToken_t* _parseBlock (parseState_t* state, _confToken_t* tok)
         // Set name of block
         block->blockName = StrRefNew (tok->semVal);
         // Get a opening brace
-        tok = _parseExpect (state, tok, LEX_TOKEN_OBRACE);
+        tok = _parseToken (state, tok);
         if (!tok)
             return NULL;
+        if (tok->type != LEX_TOKEN_OBRACE)
+        {
+            _parseExpected (state, tok, LEX_TOKEN_OBRACE);
+            goto recover;
+        }
     }
-    else if (tok->type == LEX_TOKEN_OBRACE)
-        block->blockName = NULL;
-    else
+    else if (tok->type != LEX_TOKEN_OBRACE)
     {
-        _parseError (state, tok, PARSE_ERROR_UNEXPECTED_TOKEN, NULL);
-        return NULL;
+        _parseError (state, tok, PARSE_ERROR_UNEXPECTED_TOKEN);
+        goto recover;
     }
 
     // Begin reading in tokens for properties
@@ -208,113 +284,126 @@ static _confToken_t* _parseBlock (parseState_t* state, _confToken_t* tok)
         tok = _parseToken (state, tok);
         if (!tok)
             return NULL;
+    property:
         // Is this the end of the block?
         if (tok->type == LEX_TOKEN_EBRACE)
             break;
-        // Or a property ID?
-        if (tok->type == LEX_TOKEN_ID)
+        if (tok->type == LEX_TOKEN_NONE || tok->type == LEX_TOKEN_EOF)
         {
-            // Create a new property
-            ConfProperty_t* prop =
-                (ConfProperty_t*) malloc_s (sizeof (ConfProperty_t));
-            if (!prop)
-                return NULL;
-            ListAddBack (block->props, prop, 0);
-            prop->lineNo = tok->line;
-            prop->name = StrRefNew (tok->semVal);
-            prop->nextVal = 0;
-            // Expect a colon
-            tok = _parseExpect (state, tok, LEX_TOKEN_COLON);
+            _parseError (state, tok, PARSE_ERROR_UNTERMINATED);
+            return state->recover ? tok : NULL;
+        }
+        // Or it has to be a property ID
+        if (tok->type != LEX_TOKEN_ID)
+        {
+            _parseError (state, tok, PARSE_ERROR_UNEXPECTED_TOKEN);
+            goto recover;
+        }
+        if (budget && !_parseCharge (state,
+                                     tok,
+                                     &budget->props,
+                                     budget->limits->maxProps,
+                                     CONF_DIAG_PROP_LIMIT))
+        {
+            return NULL;
+        }
+        // Create a new property
+        ConfProperty_t* prop =
+            (ConfProperty_t*) _confMalloc (sizeof (ConfProperty_t));
+        if (!prop)
+            return NULL;
+        ListAddBack (block->props, prop, 0);
+        STATS_ADD (props, 1);
+        prop->lineNo = tok->line;
+        prop->colNo = tok->col;
+        prop->name = StrRefNew (tok->semVal);
+        prop->nextVal = 0;
+        // Expect a colon
+        tok = _parseToken (state, tok);
+        if (!tok)
+            return NULL;
+        if (tok->type != LEX_TOKEN_COLON)
+        {
+            _parseExpected (state, tok, LEX_TOKEN_COLON);
+            goto recover;
+        }
+        // Now parse all the values
+        while (1)
+        {
+            tok = _parseToken (state, tok);
             if (!tok)
                 return NULL;
-            // Now parse all the values
-            while (1)
+            // Values are strings, identifiers or numbers
+            if (tok->type != LEX_TOKEN_STR && tok->type != LEX_TOKEN_ID &&
+                tok->type != LEX_TOKEN_NUM)
             {
-                tok = _parseToken (state, tok);
-                if (!tok)
-                    return NULL;
-                // It this a string?
-                if (tok->type == LEX_TOKEN_STR)
-                {
-                    // Initialize values
-                    int valLoc = prop->nextVal;
-                    prop->vals[valLoc].lineNo = tok->line;
-                    prop->vals[valLoc].type = DATATYPE_STRING;
-                    // Copy string value
-                    prop->vals[valLoc].str = StrRefNew (tok->semVal);
-                    ++prop->nextVal;
-                    if (prop->nextVal >= MAX_PROPVAR)
-                    {
-                        _parseError (state,
-                                     tok,
-                                     PARSE_ERROR_TOO_MANY_PROPS,
-                                     prop->name);
-                        return NULL;
-                    }
-                }
-                // .. or an identifier?
-                else if (tok->type == LEX_TOKEN_ID)
-                {
-                    // Same thing
-                    int valLoc = prop->nextVal;
-                    prop->vals[valLoc].lineNo = tok->line;
-                    prop->vals[valLoc].type = DATATYPE_IDENTIFIER;
-                    // Copy string value
-                    prop->vals[valLoc].id = StrRefNew (tok->semVal);
-                    ++prop->nextVal;
-                    if (prop->nextVal >= MAX_PROPVAR)
-                    {
-                        _parseError (state,
-                                     tok,
-                                     PARSE_ERROR_TOO_MANY_PROPS,
-                                     prop->name);
-                        return NULL;
-                    }
-                }
-                // ... or a number?
-                else if (tok->type == LEX_TOKEN_NUM)
-                {
-                    int valLoc = prop->nextVal;
-                    prop->vals[valLoc].lineNo = tok->line;
-                    prop->vals[valLoc].type = DATATYPE_NUMBER;
-                    prop->vals[valLoc].numVal = tok->num;
-                    ++prop->nextVal;
-                    if (prop->nextVal >= MAX_PROPVAR)
-                    {
-                        _parseError (state,
-                                     tok,
-                                     PARSE_ERROR_TOO_MANY_PROPS,
-                                     prop->name);
-                        return NULL;
-                    }
-                }
-                else
-                {
-                    _parseError (state, tok, PARSE_ERROR_UNEXPECTED_TOKEN, NULL);
-                    return NULL;
-                }
+                _parseError (state, tok, PARSE_ERROR_UNEXPECTED_TOKEN);
+                goto recover;
+            }
+            if (!_parseAddValue (state, prop, tok))
+                goto recover;
 
-                // Check if there is another property
-                tok = _parseToken (state, tok);
-                if (!tok)
-                    return NULL;
-                // Should we continue?
-                if (tok->type == LEX_TOKEN_COMMA)
-                    continue;
-                // Should we stop?
-                else if (tok->type == LEX_TOKEN_SEMICOLON)
-                    break;
-                else
-                {
-                    _parseError (state, tok, PARSE_ERROR_UNEXPECTED_TOKEN, NULL);
+            // Check if there is another property
+            tok = _parseToken (state, tok);
+            if (!tok)
+                return NULL;
+            // Should we continue?
+            if (tok->type == LEX_TOKEN_COMMA)
+                continue;
+            // Should we stop?
+            else if (tok->type == LEX_TOKEN_SEMICOLON)
+                break;
+            // Look ahead to see if the user forgot a semicolon. If so, the
+            // token after the value starts what comes next
+            else if (tok->type == LEX_TOKEN_EBRACE ||
+                     (tok->type == LEX_TOKEN_ID &&
+                      _confLexPeek (state->lex, 0)->type == LEX_TOKEN_COLON))
+            {
+                _parseError (state, tok, PARSE_ERROR_MISSING_SEMICOLON);
+                if (!state->recover)
                     return NULL;
-                }
+                goto property;
             }
+            else
+            {
+                _parseError (state, tok, PARSE_ERROR_UNEXPECTED_TOKEN);
+                goto recover;
+            }
+        }
+        continue;
+    recover:
+        if (!state->recover)
+            return NULL;
+        // Go on with the next property, or after the end of the block
+        tok = _parseSync (state);
+        if (!tok)
+            return NULL;
+        if (tok->type == LEX_TOKEN_EBRACE)
+            break;
+        if (tok->type == LEX_TOKEN_NONE || tok->type == LEX_TOKEN_EOF)
+        {
+            _parseError (state, tok, PARSE_ERROR_UNTERMINATED);
+            return tok;
         }
     }
+    PROBE2 (block__end, block->lineNo, tok->line);
     return tok;
 }
 
+// Checks if the caller wants blocks of the type in tok
+static inline bool _parseIsBlockWanted (parseState_t* state, _confToken_t* tok)
+{
+    const ConfOptions_t* opts = state->opts;
+    if (!opts || !opts->blockTypes)
+        return true;
+    for (size_t i = 0; i < opts->numBlockTypes; ++i)
+    {
+        if (!c32cmp (StrRefGet (tok->semVal), opts->blockTypes[i]))
+            return true;
+    }
+    return false;
+}
+
 #define ERROR_OUT_MAYBE \
     if (!tok)           \
     {                   \
@@ -322,18 +411,25 @@ static _confToken_t* _parseBlock (parseState_t* state, _confToken_t* tok)
         goto end;       \
     }
 
-// Internal parser. Performance critical
-static bool _parseInternal (parseState_t* parser)
+// Recovers from a syntax error at the top level of a file, by skipping to the
+// next ';' or '}'
+#define RECOVER_MAYBE                                              \
+    if (!parser->recover)                                          \
+    {                                                              \
+        res = false;                                               \
+        goto end;                                                  \
+    }                                                              \
+    tok = _parseSync (parser);                                     \
+    ERROR_OUT_MAYBE                                                \
+    if (tok->type == LEX_TOKEN_NONE || tok->type == LEX_TOKEN_EOF) \
+        break;
+
+// Parses blocks and includes until the end of the lexer's tokens. Performance
+// critical
+static bool _parseItems (parseState_t* parser, _confToken_t* tok)
 {
     bool res = true;
-    // Start parsing
-    _confToken_t* tok = _parseToken (parser, NULL);
-    if (!tok)
-    {
-        res = false;
-        goto end;
-    }
-    while (tok->type != LEX_TOKEN_NONE)
+    while (tok->type != LEX_TOKEN_NONE && tok->type != LEX_TOKEN_EOF)
     {
         // Is it an include statement?
         if (tok->type == LEX_TOKEN_INCLUDE)
@@ -344,76 +440,369 @@ static bool _parseInternal (parseState_t* parser)
         // ... or it has to be a block
         else if (tok->type == LEX_TOKEN_ID)
         {
-            tok = _parseBlock (parser, tok);
-            ERROR_OUT_MAYBE
+            // Catch properties that aren't in a block
+            if (_confLexPeek (parser->lex, 0)->type == LEX_TOKEN_COLON)
+            {
+                _parseError (parser, tok, PARSE_ERROR_PROP_NO_BLOCK);
+                RECOVER_MAYBE
+            }
+            // Skip over blocks that were filtered out, if the lexer couldn't
+            else if (!_parseIsBlockWanted (parser, tok))
+            {
+                if (!_confLexSkipBlock (parser->lex))
+                {
+                    parser->lexFailed = true;
+                    res = false;
+                    goto end;
+                }
+            }
+            else
+            {
+                tok = _parseBlock (parser, tok);
+                ERROR_OUT_MAYBE
+            }
         }
         else
         {
-            _parseError (parser, tok, PARSE_ERROR_UNEXPECTED_TOKEN, NULL);
-            res = false;
-            goto end;
+            _parseError (parser, tok, PARSE_ERROR_UNEXPECTED_TOKEN);
+            RECOVER_MAYBE
         }
         tok = _parseToken (parser, tok);
         ERROR_OUT_MAYBE
     }
+end:
+    // A lexer error stops the file it is in, but what was parsed before it is
+    // kept when recovering
+    if (!res && parser->recover && parser->lexFailed && !_parseOverBudget (parser))
+        res = true;
+    return res;
+}
+
+// Internal parser
+static bool _parseInternal (parseState_t* parser)
+{
+    _confToken_t* tok = _parseToken (parser, NULL);
+    bool res = false;
+    if (tok)
+        res = _parseItems (parser, tok);
+    else if (parser->recover && !_parseOverBudget (parser))
+        res = true;
     // Destroy the lexer
     _confLexDestroy (parser->lex);
-// Free up unfreed tokens
-end:
-    free (parser->lastToken);
-    free (tok);
+    return res;
+}
+
+// Creates the lexer for a file
+static lexState_t* _parseLexInit (parseState_t* state, const char* file)
+{
+    lexState_t* lex = _confLexInit (file, state->cache, state->diags);
+    if (!lex)
+        return NULL;
+    if (state->budget && !_confLexSetBudget (lex, state->budget))
+    {
+        _confLexDestroy (lex);
+        return NULL;
+    }
+    // Large files can be lexed on several threads. Otherwise, the lexer skips
+    // blocks that were filtered out itself
+    const ConfOptions_t* opts = state->opts;
+    if (opts && opts->lexThreads > 1 && !_confLexParallel (lex, opts->lexThreads))
+    {
+        _confLexDestroy (lex);
+        return NULL;
+    }
+    if (opts && opts->blockTypes && !lex->toks)
+        _confLexSetFilter (lex, opts->blockTypes, opts->numBlockTypes);
+    return lex;
+}
+
+// Parses a file that is included into head
+static bool _parseIncludeFile (parseState_t* state,
+                               const char* file,
+                               ListHead_t* head,
+                               ConfDiagList_t* diags)
+{
+    STATS_ADD (includes, 1);
+    STATS_START (start);
+    PROBE2 (include__enter, state->lex->file, file);
+    // Create a new parser context
+    parseState_t newState = {0};
+    newState.head = head;
+    newState.opts = state->opts;
+    newState.cache = state->cache;
+    newState.budget = state->budget;
+    newState.diags = diags;
+    newState.depth = state->depth + 1;
+    newState.recover = state->recover;
+    newState.lex = _parseLexInit (&newState, file);
+    bool res = false;
+    if (newState.lex)
+        res = _parseInternal (&newState);
+    // Files that can't be read are skipped when recovering
+    else if (state->recover && !_parseOverBudget (state))
+        res = true;
+    PROBE2 (include__exit, file, res);
+    STATS_END (includeNs, start);
+    return res;
+}
+
+// Parses one file of an include statement that names several
+static void _parseFragment (void* data, int idx)
+{
+    parseFragments_t* frags = data;
+    parseFragment_t* frag = &frags->frags[idx];
+#ifdef LIBCONF_ENABLE_STATS
+    // The calling thread runs some of the files too, so its own statistics are
+    // put aside
+    ConfStats_t saved = _confStats;
+    memset (&_confStats, 0, sizeof (ConfStats_t));
+#endif
+    frag->res =
+        _parseIncludeFile (frags->parent, frag->file, frag->head, &frag->diags);
+#ifdef LIBCONF_ENABLE_STATS
+    frag->stats = _confStats;
+    _confStats = saved;
+#endif
+}
+
+// Keeps blocks when the list of a fragment is destroyed, as they were moved
+static void _parseKeepBlock (const void* data)
+{
+    (void) data;
+}
+
+// Parses the files of an include statement at once. The results are merged in
+// the order of the files, as if they had been parsed one after another
+static bool _parseIncludeMany (parseState_t* state,
+                               char** files,
+                               size_t numFiles,
+                               int threads)
+{
+    parseFragments_t frags = {0};
+    frags.parent = state;
+    frags.frags = _confCalloc (numFiles * sizeof (parseFragment_t));
+    if (!frags.frags)
+        return false;
+    bool res = true;
+    for (size_t i = 0; i < numFiles; ++i)
+    {
+        frags.frags[i].file = files[i];
+        frags.frags[i].head = ListCreate ("ConfBlock", false, 0);
+        if (!frags.frags[i].head)
+            res = false;
+    }
+    if (res)
+        _confRunPool ((int) numFiles, threads, _parseFragment, &frags);
+    // Files after one that failed would never have been parsed
+    bool stopped = !res;
+    for (size_t i = 0; i < numFiles; ++i)
+    {
+        parseFragment_t* frag = &frags.frags[i];
+        bool keep = !stopped;
+        if (keep)
+        {
+            for (size_t j = 0; j < frag->diags.numDiags; ++j)
+                _confDiag (state->diags, &frag->diags.diags[j]);
+#ifdef LIBCONF_ENABLE_STATS
+            _confStatsAdd (&_confStats, &frag->stats);
+#endif
+            if (!frag->res)
+            {
+                res = false;
+                stopped = true;
+            }
+        }
+        ConfFreeDiags (&frag->diags);
+        if (!frag->head)
+            continue;
+        ListEntry_t* entry = ListFront (frag->head);
+        for (; entry; entry = ListIterate (entry))
+        {
+            if (keep && ListAddBack (state->head, ListEntryData (entry), 0))
+                continue;
+            if (keep)
+                res = false;
+            _parseDestroyBlock (ListEntryData (entry));
+        }
+        ListSetDestroy (frag->head, _parseKeepBlock);
+        ListDestroy (frag->head);
+    }
+    _confFree (frags.frags);
     return res;
 }
 
 // Includes another file to parse
 static inline _confToken_t* _parseInclude (parseState_t* state, _confToken_t* tok)
 {
-    _confToken_t* pathTok = _parseExpect (state, tok, LEX_TOKEN_STR);
+    _confToken_t* pathTok = _parseToken (state, tok);
     if (!pathTok)
         return NULL;
-    // Convert string value to multibyte
-    size_t len = c32len (StrRefGet (pathTok->semVal));
-    char* mbPath = malloc_s ((len * MB_CUR_MAX) + 1);
-    mbstate_t mbState = {0};
-    if (c32stombs (mbPath, StrRefGet (pathTok->semVal), len, &mbState) < 0)
+    if (pathTok->type != LEX_TOKEN_STR)
     {
-        _parseError (state, pathTok, PARSE_ERROR_INTERNAL, strerror (errno));
+        _parseExpected (state, pathTok, LEX_TOKEN_STR);
+        // Include statements have no end to skip to, so just drop the token
+        return state->recover ? pathTok : NULL;
+    }
+    // Includes that include themselves would otherwise recurse forever
+    const ConfLimits_t* limits = state->budget ? state->budget->limits : NULL;
+    int maxDepth = (limits && limits->maxIncludeDepth) ? limits->maxIncludeDepth
+                                                       : CONF_MAX_INCLUDE_DEPTH;
+    if (state->depth >= maxDepth)
+    {
+        if (state->budget)
+            state->budget->exceeded = true;
+        _parseDiag (state, pathTok, CONF_DIAG_DEPTH_LIMIT, -1, maxDepth, NULL);
         return NULL;
     }
-    // Set file name
-    const char* oldFile = ConfGetFileName();
-    _confSetFileName (mbPath);
-    // Create a new parser context
-    parseState_t newState;
-    newState.lex = _confLexInit (mbPath);
-    if (!newState.lex)
+    // Paths are UTF-8, whatever the locale is
+    const char32_t* path = StrRefGet (pathTok->semVal);
+    size_t len = _confC32ToUtf8 (NULL, 0, path);
+    char* mbPath = _confMalloc (len + 1);
+    if (!mbPath)
         return NULL;
-    newState.lastToken = NULL;
-    newState.head = state->head;
-    // Start parsing the include
-    if (!_parseInternal (&newState))
+    _confC32ToUtf8 (mbPath, len + 1, path);
+    // Parses that include files look them up through a cache, even if they
+    // weren't given one
+    if (!state->cache && state->ownCache)
+    {
+        _confFileCacheInit (state->ownCache);
+        state->cache = state->ownCache;
+    }
+    const ConfOptions_t* opts = state->opts;
+    char* file = _confIncludeResolve (state->cache,
+                                      state->lex->file,
+                                      mbPath,
+                                      opts ? opts->includeDirs : NULL,
+                                      opts ? opts->numIncludeDirs : 0);
+    _confFree (mbPath);
+    if (!file)
+        return NULL;
+    // Directories and wildcards name any number of files
+    char** files = NULL;
+    size_t numFiles = 0;
+    if (!_confIncludeExpand (state->cache, file, &files, &numFiles))
+    {
+        _parseDiag (state, pathTok, PARSE_ERROR_INTERNAL, -1, 0, strerror (errno));
+        _confFree (file);
+        return (state->recover && !_parseOverBudget (state)) ? pathTok : NULL;
+    }
+    _confFree (file);
+    int threads = (opts && opts->parseThreads > 0) ? opts->parseThreads
+                                                    : _confNumCpus();
+    bool res = true;
+    // Budgets are only charged from one thread, so parses with limits include
+    // files one at a time. So do parses that are already on a pool's thread,
+    // as only the outermost parse starts threads
+    if (numFiles > 1 && numFiles <= INT_MAX && threads > 1 && !state->budget &&
+        !_confInPool())
+        res = _parseIncludeMany (state, files, numFiles, threads);
+    else
+    {
+        for (size_t i = 0; res && i < numFiles; ++i)
+            res = _parseIncludeFile (state, files[i], state->head, state->diags);
+    }
+    _confIncludeFree (files, numFiles);
+    if (!res)
         return NULL;
-    _confSetFileName (oldFile);
-    free (mbPath);
     return pathTok;
 }
 
-ListHead_t* _confParse (const char* file)
+ListHead_t* _confParseCreateTree (void)
 {
+    ListHead_t* head = ListCreate ("ConfBlock", false, 0);
+    if (head)
+        ListSetDestroy (head, _parseDestroyBlock);
+    return head;
+}
+
+bool _confParseTokens (ListHead_t* head,
+                       lexState_t* lex,
+                       const ConfOptions_t* opts,
+                       _confBudget_t* budget,
+                       _confFileCache_t* cache,
+                       _confToken_t* lastTok)
+{
+    parseState_t state = {0};
+    state.lex = lex;
+    state.head = head;
+    state.opts = opts;
+    state.budget = budget;
+    state.cache = cache;
+    if (opts)
+    {
+        state.diags = opts->diags;
+        state.recover = opts->recover;
+    }
+    _confToken_t* tok = _parseToken (&state, lastTok);
+    if (!tok)
+        return state.recover && !_parseOverBudget (&state);
+    return _parseItems (&state, tok);
+}
+
+ListHead_t* _confParse (const char* file,
+                        const ConfOptions_t* opts,
+                        _confFileCache_t* cache)
+{
+    PROBE1 (parse__start, file);
+    parseState_t state = {0};
+    _confFileCache_t ownCache;
+    state.opts = opts;
+    state.cache = cache;
+    if (!cache)
+        state.ownCache = &ownCache;
+    if (opts)
+    {
+        state.diags = opts->diags;
+        state.recover = opts->recover;
+    }
+    // Everything allocated from here on is charged to the parse
+    _confBudget_t budget = {0};
+    _confBudget_t* prevBudget = NULL;
+    if (opts && opts->limits)
+    {
+        budget.limits = opts->limits;
+        state.budget = &budget;
+        prevBudget = _confSetBudget (&budget);
+    }
     // Initialize the lexer
-    lexState_t* lexState = _confLexInit (file);
-    if (!lexState)
-        return NULL;
+    state.lex = _parseLexInit (&state, file);
+    if (!state.lex)
+        goto error;
     // Start parsing
-    ConfBlock_t* block = NULL;
-    parseState_t state = {0};
-    state.lex = lexState;
-    state.head = ListCreate ("ConfBlock", false, 0);
-    ListSetDestroy (state.head, _parseDestroyBlock);
-    if (!_parseInternal (&state))
+    state.head = _confParseCreateTree();
+    if (!state.head)
+    {
+        _confLexDestroy (state.lex);
+        goto error;
+    }
+    bool res = _parseInternal (&state);
+    if (state.cache == &ownCache)
+        _confFileCacheDestroy (&ownCache);
+    if (!res)
     {
         ConfFreeParseTree (state.head);
-        return NULL;
+        goto error;
     }
+    if (state.budget)
+        _confSetBudget (prevBudget);
+    PROBE2 (parse__end, file, 1);
     return state.head;
+error:
+    if (state.budget)
+    {
+        _confSetBudget (prevBudget);
+        if (budget.outOfMemory)
+        {
+            ConfDiag_t diag = {0};
+            diag.file = file;
+            diag.code = CONF_DIAG_MEMORY_LIMIT;
+            diag.token = -1;
+            diag.prevToken = -1;
+            diag.expected = -1;
+            diag.value = (int64_t) opts->limits->maxMemory;
+            _confDiag (state.diags, &diag);
+        }
+    }
+    PROBE2 (parse__end, file, 0);
+    return NULL;
 }
@@ -0,0 +1,316 @@
+/*
+    push.c - contains parser for pushed input
+    Copyright 2022 The NexNix Project
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+         http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+/// @file push.c
+
+/*
+ * Pushed input is lexed as it arrives. A token that runs into the end of the
+ * input is put back, and lexed again once more input is there. Tokens are
+ * collected until they hold a whole block or include, which is then handed to
+ * the parser like tokens that were lexed ahead of time. A block is whole once
+ * the brace that ends it has arrived, so the parser never has to stop and wait
+ * for input in the middle of one.
+ */
+
+#include "internal.h"
+#include <libconf.h>
+#include <libnex/safemalloc.h>
+#include <stdlib.h>
+#include <string.h>
+
+// A push parser
+struct tagConfParser
+{
+    char* name;                   // Name to report diagnostics with
+    const ConfOptions_t* opts;    // Options of the parse. May be NULL
+    lexState_t* lex;              // Lexer of the input
+    ListHead_t* head;             // Tree being built
+    _confBudget_t budget;         // Budget of the parse
+    _confFileCache_t cache;       // Included files. Kept between parses
+    _confToken_t* toks;           // Tokens of the item being collected
+    size_t numToks;               // Number of tokens in toks
+    size_t maxToks;               // Space in toks
+    bool hasLast;                 // Is toks[0] the last token of the last item?
+    int depth;                    // Depth of braces in the item
+    bool isPath;                  // Is the next token the path of an include?
+    bool failed;                  // Did parsing fail?
+    bool stopped;                 // Has the input ended, or a lexer error?
+    bool finished;                // Was ConfParserFinish called?
+};
+
+// Gets the budget of a parser. NULL if it has no limits
+static inline _confBudget_t* _pushBudget (ConfParser_t* parser)
+{
+    return parser->budget.limits ? &parser->budget : NULL;
+}
+
+// Marks a parse as failed, reporting it if it ran out of memory
+static void _pushFail (ConfParser_t* parser)
+{
+    parser->failed = true;
+    if (!parser->budget.outOfMemory)
+        return;
+    ConfDiag_t diag = {0};
+    diag.file = parser->name;
+    diag.code = CONF_DIAG_MEMORY_LIMIT;
+    diag.token = -1;
+    diag.prevToken = -1;
+    diag.expected = -1;
+    diag.value = (int64_t) parser->budget.limits->maxMemory;
+    _confDiag (parser->opts->diags, &diag);
+}
+
+// Parses the collected tokens. The last one must end the stream
+static bool _pushParse (ConfParser_t* parser)
+{
+    lexState_t* lex = parser->lex;
+    size_t first = parser->hasLast ? 1 : 0;
+    lex->toks = parser->toks;
+    lex->numToks = parser->numToks;
+    lex->numConsumed = first;
+    bool res = _confParseTokens (parser->head,
+                                 lex,
+                                 parser->opts,
+                                 _pushBudget (parser),
+                                 &parser->cache,
+                                 parser->hasLast ? &parser->toks[0] : NULL);
+    lex->toks = NULL;
+    lex->numToks = 0;
+    lex->numConsumed = 0;
+    // Keep the token before the end, as it comes before the next item. Its
+    // value isn't needed
+    _confToken_t last = parser->toks[0];
+    if ((parser->numToks - first) > 1)
+    {
+        last = parser->toks[parser->numToks - 2];
+        parser->hasLast = true;
+    }
+    for (size_t i = first; i < parser->numToks; ++i)
+    {
+        if (parser->toks[i].semVal)
+            _confStrRelease (parser->toks[i].semVal);
+    }
+    last.semVal = NULL;
+    parser->toks[0] = last;
+    parser->numToks = parser->hasLast ? 1 : 0;
+    return res;
+}
+
+// Lexes and parses as much of the input as possible
+static bool _pushRun (ConfParser_t* parser, bool final)
+{
+    while (1)
+    {
+        // Leave room for the token that ends the item
+        if ((parser->numToks + 2) > parser->maxToks)
+        {
+            size_t maxToks = parser->maxToks ? (parser->maxToks * 2) : 64;
+            _confToken_t* toks =
+                _confRealloc (parser->toks, maxToks * sizeof (_confToken_t));
+            if (!toks)
+                return false;
+            parser->toks = toks;
+            parser->maxToks = maxToks;
+        }
+        STATS_START (start);
+        _confToken_t* tok =
+            _confLexPartial (parser->lex, &parser->toks[parser->numToks], final);
+        STATS_END (lexNs, start);
+        if (!tok)
+            return true;
+        STATS_ADD (tokens[tok->type], 1);
+        ++parser->numToks;
+        if (tok->type == LEX_TOKEN_NONE || tok->type == LEX_TOKEN_EOF ||
+            tok->type == LEX_TOKEN_ERROR)
+        {
+            // Nothing after a lexer error is lexed
+            parser->stopped = true;
+            return _pushParse (parser);
+        }
+        // Items end with the brace that closes them, or with an include's path.
+        // Braces that don't match up are sorted out by the parser
+        bool isEnd = false;
+        if (parser->isPath)
+        {
+            parser->isPath = false;
+            isEnd = true;
+        }
+        else if (tok->type == LEX_TOKEN_INCLUDE && !parser->depth)
+            parser->isPath = true;
+        else if (tok->type == LEX_TOKEN_OBRACE)
+            ++parser->depth;
+        else if (tok->type == LEX_TOKEN_EBRACE)
+        {
+            if (parser->depth)
+                --parser->depth;
+            isEnd = !parser->depth;
+        }
+        if (isEnd)
+        {
+            _confToken_t* end = &parser->toks[parser->numToks++];
+            memset (end, 0, sizeof (_confToken_t));
+            end->type = LEX_TOKEN_NONE;
+            end->line = tok->line;
+            end->col = tok->col;
+            if (!_pushParse (parser))
+                return false;
+        }
+    }
+}
+
+LIBCONF_PUBLIC ConfParser_t* ConfParserCreate (const char* name,
+                                               const ConfOptions_t* opts)
+{
+    STATS_RESET();
+    const ConfAllocator_t* prevAlloc =
+        _confSetAllocator (opts ? opts->alloc : NULL);
+    ConfParser_t* parser = _confCalloc (sizeof (ConfParser_t));
+    if (!parser)
+        goto error;
+    _confFileCacheInit (&parser->cache);
+    parser->opts = opts;
+    parser->budget.limits = opts ? opts->limits : NULL;
+    parser->name = _confMalloc (strlen (name) + 1);
+    if (!parser->name)
+        goto error;
+    strcpy (parser->name, name);
+    parser->lex = _confLexInitPush (parser->name, opts ? opts->diags : NULL);
+    if (!parser->lex)
+        goto error;
+    parser->lex->budget = _pushBudget (parser);
+    parser->head = _confParseCreateTree();
+    if (!parser->head)
+        goto error;
+    _confSetAllocator (prevAlloc);
+    return parser;
+error:
+    if (parser)
+        ConfParserDestroy (parser);
+    _confSetAllocator (prevAlloc);
+    return NULL;
+}
+
+LIBCONF_PUBLIC bool ConfParserReset (ConfParser_t* parser, const char* name)
+{
+    STATS_RESET();
+    const ConfAllocator_t* prevAlloc =
+        _confSetAllocator (parser->opts ? parser->opts->alloc : NULL);
+    for (size_t i = 0; i < parser->numToks; ++i)
+    {
+        if (parser->toks[i].semVal)
+            _confStrRelease (parser->toks[i].semVal);
+    }
+    parser->numToks = 0;
+    parser->hasLast = false;
+    parser->depth = 0;
+    parser->isPath = false;
+    parser->stopped = false;
+    parser->finished = false;
+    parser->failed = true;
+    // A tree that wasn't taken is only kept if nothing was added to it
+    if (parser->head && parser->head->size)
+    {
+        ConfFreeParseTree (parser->head);
+        parser->head = NULL;
+    }
+    if (!parser->head)
+        parser->head = _confParseCreateTree();
+    // The name is only copied again if it changed
+    if (parser->head && name && strcmp (name, parser->name))
+    {
+        char* newName = _confMalloc (strlen (name) + 1);
+        if (newName)
+        {
+            strcpy (newName, name);
+            _confFree (parser->name);
+            parser->name = newName;
+        }
+        else
+        {
+            ConfFreeParseTree (parser->head);
+            parser->head = NULL;
+        }
+    }
+    _confSetAllocator (prevAlloc);
+    if (!parser->head)
+        return false;
+    _confLexResetPush (parser->lex, parser->name);
+    // Memory kept from earlier parses isn't charged to this one
+    memset (&parser->budget, 0, sizeof (_confBudget_t));
+    parser->budget.limits = parser->opts ? parser->opts->limits : NULL;
+    parser->failed = false;
+    return true;
+}
+
+LIBCONF_PUBLIC bool ConfParserFeed (ConfParser_t* parser,
+                                    const void* data,
+                                    size_t len)
+{
+    if (parser->failed || parser->finished)
+        return false;
+    if (parser->stopped)
+        return true;
+    const ConfAllocator_t* prevAlloc =
+        _confSetAllocator (parser->opts ? parser->opts->alloc : NULL);
+    _confBudget_t* prevBudget = _confSetBudget (_pushBudget (parser));
+    bool res = _confLexPush (parser->lex, data, len) && _pushRun (parser, false);
+    _confSetBudget (prevBudget);
+    _confSetAllocator (prevAlloc);
+    if (!res)
+        _pushFail (parser);
+    return res;
+}
+
+LIBCONF_PUBLIC ListHead_t* ConfParserFinish (ConfParser_t* parser)
+{
+    if (parser->finished)
+        return NULL;
+    parser->finished = true;
+    if (!parser->failed && !parser->stopped)
+    {
+        const ConfAllocator_t* prevAlloc =
+            _confSetAllocator (parser->opts ? parser->opts->alloc : NULL);
+        _confBudget_t* prevBudget = _confSetBudget (_pushBudget (parser));
+        bool res = _pushRun (parser, true);
+        _confSetBudget (prevBudget);
+        _confSetAllocator (prevAlloc);
+        if (!res)
+            _pushFail (parser);
+    }
+    if (parser->failed)
+        return NULL;
+    ListHead_t* head = parser->head;
+    parser->head = NULL;
+    return head;
+}
+
+LIBCONF_PUBLIC void ConfParserDestroy (ConfParser_t* parser)
+{
+    for (size_t i = 0; i < parser->numToks; ++i)
+    {
+        if (parser->toks[i].semVal)
+            _confStrRelease (parser->toks[i].semVal);
+    }
+    _confFree (parser->toks);
+    if (parser->lex)
+        _confLexDestroy (parser->lex);
+    if (parser->head)
+        ConfFreeParseTree (parser->head);
+    _confFileCacheDestroy (&parser->cache);
+    _confFree (parser->name);
+    _confFree (parser);
+}
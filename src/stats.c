@@ -0,0 +1,87 @@
+/*
+    stats.c - contains parser statistics
+    Copyright 2022 The NexNix Project
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+         http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+/// @file stats.c
+
+#include "internal.h"
+#include <libconf.h>
+#include <libnex/safemalloc.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef LIBCONF_ENABLE_STATS
+// Statistics of the parse running on this thread
+_Thread_local ConfStats_t _confStats;
+
+uint64_t _confStatsNow (void)
+{
+    struct timespec ts;
+#ifdef CLOCK_MONOTONIC
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+#else
+    timespec_get (&ts, TIME_UTC);
+#endif
+    return ((uint64_t) ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+
+void _confStatsReset (void)
+{
+    memset (&_confStats, 0, sizeof (ConfStats_t));
+    _confStatsResetAlloc();
+}
+
+void _confStatsFinish (uint64_t start)
+{
+    _confStats.totalNs = _confStatsNow() - start;
+    // Whatever wasn't spent elsewhere was spent in the parser
+    uint64_t other = _confStats.detectNs + _confStats.decodeNs + _confStats.lexNs;
+    if (other < _confStats.totalNs)
+        _confStats.parseNs = _confStats.totalNs - other;
+}
+
+void _confStatsAlloc (size_t sz)
+{
+    ++_confStats.allocs;
+    _confStats.allocBytes += sz;
+}
+
+void _confStatsAdd (ConfStats_t* stats, const ConfStats_t* other)
+{
+    // Everything is a counter, so it can be added up field by field
+    uint64_t* dest = (uint64_t*) stats;
+    const uint64_t* src = (const uint64_t*) other;
+    for (size_t i = 0; i < (sizeof (ConfStats_t) / sizeof (uint64_t)); ++i)
+        dest[i] += src[i];
+}
+#endif
+
+LIBCONF_PUBLIC bool ConfGetStats (ConfStats_t* stats)
+{
+#ifdef LIBCONF_ENABLE_STATS
+    memcpy (stats, &_confStats, sizeof (ConfStats_t));
+    return true;
+#else
+    memset (stats, 0, sizeof (ConfStats_t));
+    return false;
+#endif
+}
+
+LIBCONF_PUBLIC const char* ConfGetTokenName (int type)
+{
+    return _confLexGetTokenNameType (type);
+}
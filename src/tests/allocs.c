@@ -0,0 +1,164 @@
+/*
+    allocs.c - contains allocation regression tests
+    Copyright 2022 The NexNix Project
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+         http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+/// @file allocs.c
+
+#include "../bench/alloc.h"
+#include "../internal.h"
+#include <locale.h>
+#include <stdio.h>
+#define NEXTEST_NAME "allocs"
+#include <libnex/progname.h>
+#include <nextest.h>
+
+// How far over budget a fixture may go, in percent. This leaves room for
+// differences between allocators and libnex versions
+#define ALLOC_SLACK 10
+
+// Budgets recorded for the test fixtures. When a change makes libconf allocate
+// less, lower these to the numbers this test prints
+#define LEX_PARSE_ALLOCS     53
+#define LEX_PARSE_PEAK       13976
+#define LEX_FILTER_ALLOCS    15
+#define LEX_FILTER_PEAK      14344
+#define PARSE_PARSE_ALLOCS   129
+#define PARSE_PARSE_PEAK     21656
+#define PARSE_INCLUDE_ALLOCS 41
+#define PARSE_INCLUDE_PEAK   13976
+#define PUSH_REUSE_ALLOCS    34
+#define PUSH_REUSE_PEAK      4632
+
+// Checks if a count is within its budget
+#define WITHIN_BUDGET(val, budget) \
+    ((val) <= ((uint64_t) (budget) + ((uint64_t) (budget) * ALLOC_SLACK) / 100))
+
+// Lexes a whole file, keeping only blocks of the given types if there are any
+static void _lexFile (const char* file,
+                      const char32_t** blockTypes,
+                      size_t numBlockTypes)
+{
+    lexState_t* state = _confLexInit (file, NULL, NULL);
+    if (!state)
+        return;
+    if (blockTypes)
+        _confLexSetFilter (state, blockTypes, numBlockTypes);
+    _confToken_t* tok = _confLex (state);
+    while (tok->type != LEX_TOKEN_NONE && tok->type != LEX_TOKEN_EOF &&
+           tok->type != LEX_TOKEN_ERROR)
+    {
+        tok = _confLex (state);
+    }
+    _confLexDestroy (state);
+}
+
+// Parses and frees a file
+static void _parseFile (const char* file)
+{
+    ListHead_t* list = ConfInit (file);
+    if (list)
+        ConfFreeParseTree (list);
+}
+
+// Pushes a file to a parser that is reused, and frees the tree
+static void _pushFile (ConfParser_t* parser, const char* file)
+{
+    char buf[4096];
+    FILE* fp = fopen (file, "rb");
+    if (!fp)
+        return;
+    size_t len = fread (buf, 1, sizeof (buf), fp);
+    fclose (fp);
+    ConfParserFeed (parser, buf, len);
+    ListHead_t* list = ConfParserFinish (parser);
+    if (list)
+        ConfFreeParseTree (list);
+}
+
+int main()
+{
+    setlocale (LC_ALL, "");
+    setprogname ("allocs");
+    if (!benchAllocSupported())
+    {
+        printf ("allocations can't be counted here, skipping\n");
+        return 0;
+    }
+    // Warm up anything that allocates once per process, like locale data
+    _parseFile ("testParse.testxt");
+    benchAllocs_t allocs;
+    // Lexing the parser's fixture
+    benchAllocStart();
+    _lexFile ("testParse.testxt", NULL, 0);
+    benchAllocStop (&allocs);
+    printf ("lex testParse.testxt: %llu allocations, %llu bytes peak\n",
+            (unsigned long long) allocs.allocs,
+            (unsigned long long) allocs.peak);
+    TEST_BOOL (WITHIN_BUDGET (allocs.allocs, LEX_PARSE_ALLOCS), "lex allocations");
+    TEST_BOOL (allocs.frees == allocs.allocs, "lex leaks");
+    TEST_BOOL (WITHIN_BUDGET (allocs.peak, LEX_PARSE_PEAK), "lex peak");
+    // Lexing it with every block filtered out, which makes no strings for them
+    const char32_t* noTypes[] = {U"none"};
+    benchAllocStart();
+    _lexFile ("testParse.testxt", noTypes, 1);
+    benchAllocStop (&allocs);
+    printf ("filtered lex testParse.testxt: %llu allocations, %llu bytes peak\n",
+            (unsigned long long) allocs.allocs,
+            (unsigned long long) allocs.peak);
+    TEST_BOOL (WITHIN_BUDGET (allocs.allocs, LEX_FILTER_ALLOCS),
+               "filtered lex allocations");
+    TEST_BOOL (allocs.frees == allocs.allocs, "filtered lex leaks");
+    TEST_BOOL (WITHIN_BUDGET (allocs.peak, LEX_FILTER_PEAK), "filtered lex peak");
+    // Parsing the parser's fixture, which includes another file
+    benchAllocStart();
+    _parseFile ("testParse.testxt");
+    benchAllocStop (&allocs);
+    printf ("parse testParse.testxt: %llu allocations, %llu bytes peak\n",
+            (unsigned long long) allocs.allocs,
+            (unsigned long long) allocs.peak);
+    TEST_BOOL (WITHIN_BUDGET (allocs.allocs, PARSE_PARSE_ALLOCS),
+               "parse allocations");
+    TEST_BOOL (allocs.frees == allocs.allocs, "parse leaks");
+    TEST_BOOL (WITHIN_BUDGET (allocs.peak, PARSE_PARSE_PEAK), "parse peak");
+    // Parsing the include fixture on its own
+    benchAllocStart();
+    _parseFile ("testInclude.testxt");
+    benchAllocStop (&allocs);
+    printf ("parse testInclude.testxt: %llu allocations, %llu bytes peak\n",
+            (unsigned long long) allocs.allocs,
+            (unsigned long long) allocs.peak);
+    TEST_BOOL (WITHIN_BUDGET (allocs.allocs, PARSE_INCLUDE_ALLOCS),
+               "include allocations");
+    TEST_BOOL (allocs.frees == allocs.allocs, "include leaks");
+    TEST_BOOL (WITHIN_BUDGET (allocs.peak, PARSE_INCLUDE_PEAK), "include peak");
+    // Parsing it again with a parser that was reset
+    ConfParser_t* parser = ConfParserCreate ("testInclude.testxt", NULL);
+    TEST_BOOL_ANON (parser);
+    _pushFile (parser, "testInclude.testxt");
+    benchAllocStart();
+    TEST_BOOL_ANON (ConfParserReset (parser, NULL));
+    _pushFile (parser, "testInclude.testxt");
+    benchAllocStop (&allocs);
+    ConfParserDestroy (parser);
+    printf ("reused parser testInclude.testxt: %llu allocations, %llu bytes peak\n",
+            (unsigned long long) allocs.allocs,
+            (unsigned long long) allocs.peak);
+    TEST_BOOL (WITHIN_BUDGET (allocs.allocs, PUSH_REUSE_ALLOCS),
+               "reused parser allocations");
+    TEST_BOOL (allocs.frees == allocs.allocs, "reused parser leaks");
+    TEST_BOOL (WITHIN_BUDGET (allocs.peak, PUSH_REUSE_PEAK), "reused parser peak");
+    return 0;
+}
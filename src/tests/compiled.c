@@ -0,0 +1,101 @@
+/*
+    compiled.c - contains compiled configuration test cases
+    Copyright 2022 The NexNix Project
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+         http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+/// @file compiled.c
+
+#include <locale.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <testParseView.h>
+#define NEXTEST_NAME "compiled"
+#include <libnex/progname.h>
+#include <nextest.h>
+
+// Compares two strings, either of which may be NULL
+static bool _testStrEqual (const char32_t* left, const char32_t* right)
+{
+    if (!left || !right)
+        return left == right;
+    for (; *left && *left == *right; ++left, ++right)
+        ;
+    return *left == *right;
+}
+
+// Compares a view made by confc with one made by ConfFreeze
+static bool _testViewEqual (const ConfView_t* left, const ConfView_t* right)
+{
+    if (left->numBlocks != right->numBlocks || left->numProps != right->numProps ||
+        left->numVals != right->numVals)
+        return false;
+    for (size_t i = 0; i < left->numBlocks; ++i)
+    {
+        const ConfViewBlock_t* l = &left->blocks[i];
+        const ConfViewBlock_t* r = &right->blocks[i];
+        if (l->lineNo != r->lineNo || l->colNo != r->colNo ||
+            !_testStrEqual (l->blockType, r->blockType) ||
+            !_testStrEqual (l->blockName, r->blockName) ||
+            l->propStart != r->propStart || l->numProps != r->numProps)
+            return false;
+    }
+    for (size_t i = 0; i < left->numProps; ++i)
+    {
+        const ConfViewProp_t* l = &left->props[i];
+        const ConfViewProp_t* r = &right->props[i];
+        if (l->lineNo != r->lineNo || l->colNo != r->colNo ||
+            !_testStrEqual (l->name, r->name) ||
+            l->valStart != r->valStart || l->numVals != r->numVals)
+            return false;
+    }
+    for (size_t i = 0; i < left->numVals; ++i)
+    {
+        const ConfViewVal_t* l = &left->vals[i];
+        const ConfViewVal_t* r = &right->vals[i];
+        if (l->lineNo != r->lineNo || l->colNo != r->colNo ||
+            l->type != r->type || l->base != r->base)
+            return false;
+        if (l->type == DATATYPE_NUMBER && l->numVal != r->numVal)
+            return false;
+        if (l->type != DATATYPE_NUMBER && !_testStrEqual (l->str, r->str))
+            return false;
+    }
+    return true;
+}
+
+int main()
+{
+    // Set up locale stuff
+    setlocale (LC_ALL, "");
+    setprogname ("compiled");
+    ListHead_t* list = ConfInit ("testParse.testxt");
+    TEST_BOOL_ANON (list);
+    ConfView_t* view = ConfFreeze (list);
+    TEST_BOOL_ANON (view);
+    TEST_BOOL (_testViewEqual (&testParseView, view), "compiled view");
+    // The compiled view is read like any other
+    const ConfViewBlock_t* block = ConfViewGetBlock (&testParseView, 0);
+    TEST_BOOL_ANON (block);
+    const ConfViewProp_t* prop = ConfViewGetProp (&testParseView, block, 0);
+    TEST_BOOL_ANON (prop);
+    const ConfViewVal_t* val = ConfViewGetVal (&testParseView, prop, 0);
+    TEST_BOOL (val && val->type == DATATYPE_STRING, "value");
+    TEST_BOOL (!ConfViewGetBlock (&testParseView, testParseView.numBlocks),
+               "out of range");
+    ConfFreeView (view);
+    ConfFreeParseTree (list);
+    return 0;
+}
@@ -0,0 +1,170 @@
+/*
+    cxx.cpp - contains C++ binding test cases
+    Copyright 2022 The NexNix Project
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+         http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+/// @file cxx.cpp
+
+#include <clocale>
+#include <cstdint>
+#include <cstring>
+#include <libconf.hpp>
+#include <string>
+#include <utility>
+#include <vector>
+#define NEXTEST_NAME "cxx"
+#include <nextest.h>
+
+using namespace std::literals;
+
+// What a server block is bound to
+struct Server
+{
+    int port = 0;
+    std::string host;
+    std::vector<std::u32string_view> aliases;
+    bool verbose = false;
+    double ratio = 0;
+};
+
+static constexpr auto serverSchema =
+    libconf::schema (U"server",
+                     libconf::field (U"port", &Server::port),
+                     libconf::field (U"host", &Server::host),
+                     libconf::field (U"aliases", &Server::aliases),
+                     libconf::field (U"verbose", &Server::verbose),
+                     libconf::field (U"ratio", &Server::ratio));
+
+// The perfect hash is built by the compiler
+static_assert (serverSchema.find (U"aliases") == 2);
+static_assert (serverSchema.find (U"ratio") == 4);
+static_assert (serverSchema.find (U"colour") == serverSchema.numFields);
+
+// Binds the blocks of testSchema.testxt
+static int _testSchema()
+{
+    libconf::Tree tree = libconf::Tree::parse ("testSchema.testxt");
+    TEST_BOOL_ANON (tree);
+    libconf::Tree::iterator iter = tree.begin();
+    libconf::Block block = *iter++;
+    TEST_BOOL (serverSchema.matches (block), "schema type");
+    Server server;
+    ConfDiagList_t diags = {};
+    TEST_BOOL (serverSchema.bind (block, server, &diags), "bind");
+    TEST (diags.numDiags, 0u, "bind diagnostics");
+    TEST (server.port, 8080, "bound number");
+    TEST_BOOL (server.host == "example.org", "bound string");
+    TEST (server.aliases.size(), 2u, "bound values");
+    TEST_BOOL (server.aliases[1] == U"web", "bound value");
+    TEST_BOOL (server.verbose, "bound bool");
+    TEST_BOOL (server.ratio == 3.0, "bound floating point number");
+    // Every bad property is reported, and good ones are still bound
+    block = *iter;
+    TEST_BOOL (!serverSchema.bind (block, server, &diags, "testSchema.testxt"),
+               "bad block");
+    TEST (diags.numDiags, 3u, "bad block diagnostics");
+    TEST (diags.diags[0].code, CONF_DIAG_BAD_VALUE, "bad value");
+    TEST (diags.diags[0].line, 12, "bad value line");
+    TEST (diags.diags[1].code, CONF_DIAG_UNKNOWN_PROPERTY, "unknown property");
+    TEST_BOOL (!strcmp (diags.diags[1].detail, "colour"), "unknown property name");
+    TEST (diags.diags[2].code, CONF_DIAG_BAD_VALUE, "bad bool");
+    char msg[256];
+    ConfFormatDiag (&diags.diags[1], msg, sizeof (msg));
+    const char* expected = "error: testSchema.testxt:13:5: unknown property 'colour'";
+    TEST_BOOL (!strcmp (msg, expected), "unknown property message");
+    ConfFreeDiags (&diags);
+    TEST (server.port, 8080, "port kept");
+    // Schemas whose names clash still find every name
+    auto clashSchema = libconf::schema (U"server",
+                                        libconf::field (U"port", &Server::port),
+                                        libconf::field (U"host", &Server::host),
+                                        libconf::field (U"port", &Server::port));
+    TEST (clashSchema.find (U"host"), 1u, "clashing names");
+    TEST (clashSchema.find (U"colour"), clashSchema.numFields, "missing name");
+    server = Server();
+    clashSchema.bind (*tree.begin(), server, &diags);
+    TEST (diags.numDiags, 3u, "unknown with clashing names");
+    TEST_BOOL (server.host == "example.org", "bound with clashing names");
+    ConfFreeDiags (&diags);
+    return 0;
+}
+
+int main()
+{
+    // Set up locale stuff
+    setlocale (LC_ALL, "");
+    libconf::Tree tree = libconf::Tree::parse ("testParse.testxt");
+    TEST_BOOL_ANON (tree);
+    // Ownership moves with the tree
+    libconf::Tree moved = std::move (tree);
+    TEST_BOOL (!tree && moved, "move");
+    int numBlocks = 0;
+    libconf::Block last;
+    for (libconf::Block block : moved)
+    {
+        last = block;
+        TEST_BOOL (block.hasName() && block.name() == U"test"sv, "block name");
+        int numProps = 0;
+        for (libconf::Property prop : block)
+        {
+            (void) prop;
+            ++numProps;
+        }
+        TEST (numProps, 4, "properties");
+        libconf::Property prop = block.find (U"test");
+        TEST_BOOL_ANON (prop);
+        TEST (prop.size(), 3u, "values");
+        TEST_BOOL (prop.get<std::u32string_view>() == U"test"sv, "string");
+        TEST_BOOL (prop.get<int> (1) == 3, "number");
+        TEST_BOOL (prop.get<double> (1) == 3.0, "floating point number");
+        TEST_BOOL (!prop.get<int> (0), "string as number");
+        TEST_BOOL (!prop.get<std::u32string_view> (1), "number as string");
+        TEST_BOOL (!prop.get<int> (3), "missing value");
+        TEST_BOOL (prop[2].isIdentifier() && prop[2].utf8() == "one", "identifier");
+        int numVals = 0;
+        for (libconf::Value val : prop)
+        {
+            TEST (val.line(), prop.line(), "value line");
+            ++numVals;
+        }
+        TEST (numVals, 3, "value iteration");
+        TEST_BOOL (block.find (U"prop").get<uint8_t>() == std::nullopt,
+                   "identifier as number");
+        TEST_BOOL (!block.find (U"none"), "missing property");
+        ++numBlocks;
+    }
+    TEST (numBlocks, 3, "blocks");
+    // Numbers only convert to types that can hold them
+    libconf::Property hex;
+    for (libconf::Property prop : last)
+        hex = prop;
+    TEST_BOOL (hex.get<int8_t>() == 0x20, "hex");
+    ConfPropVal_t num = {};
+    num.type = DATATYPE_NUMBER;
+    num.numVal = 300;
+    TEST_BOOL (!libconf::Value (&num).get<uint8_t>(), "too big");
+    TEST_BOOL (libconf::Value (&num).get<int16_t>() == 300, "big enough");
+    num.numVal = -1;
+    TEST_BOOL (!libconf::Value (&num).get<unsigned>(), "negative");
+    TEST_BOOL (libconf::toUtf8 (U"é€\U0001F600") ==
+                   "\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80",
+               "UTF-8");
+    // Released trees are freed by the caller
+    ListHead_t* list = moved.release();
+    TEST_BOOL (!moved && list, "release");
+    moved.reset (list);
+    TEST_BOOL (!libconf::Tree::parse ("noSuchFile.testxt"), "failed parse");
+    return _testSchema();
+}
@@ -28,70 +28,100 @@
 #include <nextest.h>
 #include <stdlib.h>
 
-void _confSetFileName (const char* file);
-
 int main()
 {
     // Set up locale stuff
     setlocale (LC_ALL, "");
     setprogname ("lex");
-    _confSetFileName ("testLex.testxt");
-    lexState_t* state = _confLexInit ("testLex.testxt");
+    lexState_t* state = _confLexInit ("testLex.testxt", NULL, NULL);
     _confToken_t* tok = NULL;
     tok = _confLex (state);
     TEST_ANON (tok->type, 4);
     TEST_ANON (tok->line, 10);
-    free (tok);
+    // Look ahead before taking the next tokens
+    TEST_ANON (_confLexPeek (state, 0)->type, 5);
+    TEST_ANON (_confLexPeek (state, 2)->type, 6);
     tok = _confLex (state);
     TEST_ANON (tok->type, 5);
-    free (tok);
     tok = _confLex (state);
     TEST_ANON (tok->type, 7);
-    free (tok);
     tok = _confLex (state);
     TEST_ANON (tok->type, 6);
-    free (tok);
     tok = _confLex (state);
     TEST_ANON (tok->type, 14);
-    free (tok);
     tok = _confLex (state);
     TEST_ANON (tok->type, 9);
     TEST_ANON (tok->num, 25);
     TEST_ANON (tok->line, 12);
-    free (tok);
     tok = _confLex (state);
     TEST_ANON (tok->type, 9);
     TEST_ANON (tok->num, 0xAD8B2);
     TEST_ANON (tok->line, 14);
-    free (tok);
     tok = _confLex (state);
     TEST_ANON (tok->type, 9);
     TEST_ANON (tok->num, -34);
     TEST_ANON (tok->line, 16);
-    free (tok);
     tok = _confLex (state);
     TEST_ANON (tok->type, 8);
     TEST_ANON (tok->line, 18);
     TEST_BOOL_ANON (!c32cmp (StrRefGet (tok->semVal), U"test2-test3_"));
-    StrRefDestroy (tok->semVal);
-    free (tok);
     tok = _confLex (state);
     TEST_ANON (tok->type, 11);
     TEST_ANON (tok->line, 20);
     TEST_BOOL_ANON (!c32cmp (StrRefGet (tok->semVal), U"test t \\ '"));
-    StrRefDestroy (tok->semVal);
-    free (tok);
     tok = _confLex (state);
     TEST_ANON (tok->type, 11);
     TEST_ANON (tok->line, 22);
     TEST_BOOL_ANON (
         !c32cmp (StrRefGet (tok->semVal), U"test string en_US.UTF-8 $ \" \ntest"));
-    StrRefDestroy (tok->semVal);
-    free (tok);
     tok = _confLex (state);
     TEST_ANON (tok->type, 12);
-    StrRefDestroy (tok->semVal);
-    free (tok);
+    _confLexDestroy (state);
+    // Variables and paths are UTF-8, even in the C locale
+    setlocale (LC_ALL, "C");
+    setenv ("LIBCONF_TEST_VAR", "\xc3\xa9\xe2\x82\xac", 1);
+    state = _confLexInitPush ("<push>", NULL);
+    const char* text = "\"a $LIBCONF_TEST_VAR$ b\"";
+    TEST_BOOL_ANON (_confLexPush (state, text, strlen (text)));
+    _confToken_t pushTok = {0};
+    tok = _confLexPartial (state, &pushTok, true);
+    TEST_ANON (tok->type, 11);
+    TEST_BOOL (!c32cmp (StrRefGet (tok->semVal), U"a \u00e9\u20ac b"), "variable");
+    char buf[6];
+    TEST (ConfStrToUtf8 (StrRefGet (tok->semVal), buf, sizeof (buf)), 9, "length");
+    TEST_BOOL (!strcmp (buf, "a \xc3\xa9"), "cut off before a character");
+    _confStrRelease (tok->semVal);
+    // Only whole keywords are keywords, and characters past ASCII only go in
+    // strings
+    _confLexResetPush (state, "<push>");
+    text = "include includes Include e \xc3\xa9";
+    TEST_BOOL_ANON (_confLexPush (state, text, strlen (text)));
+    const char32_t* ids[] = {U"include", U"includes", U"Include", U"e"};
+    for (size_t i = 0; i < 4; ++i)
+    {
+        tok = _confLexPartial (state, &pushTok, true);
+        TEST (tok->type, i ? 8 : 12, "keyword");
+        TEST_BOOL (!c32cmp (StrRefGet (tok->semVal), ids[i]), "identifier");
+        _confStrRelease (tok->semVal);
+    }
+    tok = _confLexPartial (state, &pushTok, true);
+    TEST (tok->type, 15, "character past ASCII");
+    // A lone 0 after a negative number isn't taken for a lone '-'
+    _confLexResetPush (state, "<push>");
+    text = "block a { p: -5, 0; }";
+    TEST_BOOL_ANON (_confLexPush (state, text, strlen (text)));
+    const int types[] = {8, 8, 4, 8, 6, 9, 14, 9, 7, 5};
+    for (size_t i = 0; i < 10; ++i)
+    {
+        tok = _confLexPartial (state, &pushTok, true);
+        TEST (tok->type, types[i], "number after negative number");
+        if (tok->type == 9)
+        {
+            TEST (tok->num, (i == 5) ? -5 : 0, "number value");
+        }
+        else if (tok->type == 8)
+            _confStrRelease (tok->semVal);
+    }
     _confLexDestroy (state);
     return 0;
 }
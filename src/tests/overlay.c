@@ -0,0 +1,145 @@
+/*
+    overlay.c - contains overlay test cases
+    Copyright 2022 The NexNix Project
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+         http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+/// @file overlay.c
+
+#include "../internal.h"
+#include <locale.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#define NEXTEST_NAME "overlay"
+#include <libnex/progname.h>
+#include <nextest.h>
+
+// What the host file on top of the base file gives with CONF_OVERLAY_REPLACE
+static const char* replaced = "server main\n"
+                              "{\n"
+                              "    host: 'example';\n"
+                              "    port: 8080;\n"
+                              "    alias: c;\n"
+                              "    timeout: 30;\n"
+                              "}\n"
+                              "\n"
+                              "logging\n"
+                              "{\n"
+                              "    level: 1;\n"
+                              "}\n"
+                              "\n"
+                              "server backup\n"
+                              "{\n"
+                              "    port: 81;\n"
+                              "}\n";
+
+// ... and with CONF_OVERLAY_APPEND
+static const char* appended = "server main\n"
+                              "{\n"
+                              "    port: 80, 8080;\n"
+                              "    host: 'example';\n"
+                              "    alias: a;\n"
+                              "    alias: b, c;\n"
+                              "    timeout: 30;\n"
+                              "}\n"
+                              "\n"
+                              "logging\n"
+                              "{\n"
+                              "    level: 1;\n"
+                              "}\n"
+                              "\n"
+                              "server backup\n"
+                              "{\n"
+                              "    port: 81;\n"
+                              "}\n";
+
+// Checks what an overlay writes as
+static bool _testOverlay (ListHead_t** trees, int policy, const char* expected)
+{
+    ListHead_t* list = ConfOverlay (trees, 2, policy, NULL);
+    if (!list)
+        return false;
+    char* buf = ConfWriteBuffer (list, NULL, NULL);
+    bool res = buf && !strcmp (buf, expected);
+    free (buf);
+    ConfFreeParseTree (list);
+    return res;
+}
+
+int main()
+{
+    // Set up locale stuff
+    setlocale (LC_ALL, "");
+    setprogname ("overlay");
+    ListHead_t* trees[MAX_PROPVAR + 1];
+    trees[0] = ConfInit ("testOverlayBase.testxt");
+    trees[1] = ConfInit ("testOverlayHost.testxt");
+    TEST_BOOL_ANON (trees[0] && trees[1]);
+    TEST_BOOL (_testOverlay (trees, CONF_OVERLAY_REPLACE, replaced), "replace");
+    TEST_BOOL (_testOverlay (trees, CONF_OVERLAY_APPEND, appended), "append");
+    // Blocks that are only in one tree aren't copied
+    ListHead_t* list = ConfOverlay (trees, 2, CONF_OVERLAY_REPLACE, NULL);
+    TEST_BOOL_ANON (list);
+    ConfBlock_t* base = ListEntryData (ListIterate (ListFront (trees[0])));
+    ConfBlock_t* block = ListEntryData (ListIterate (ListFront (list)));
+    TEST_BOOL (block->props == base->props, "shared properties");
+    ConfFreeParseTree (list);
+    // One tree comes back as it is
+    list = ConfOverlay (trees, 1, CONF_OVERLAY_ERROR, NULL);
+    TEST_BOOL_ANON (list);
+    char* left = ConfWriteBuffer (list, NULL, NULL);
+    char* right = ConfWriteBuffer (trees[0], NULL, NULL);
+    TEST_BOOL (left && right && !strcmp (left, right), "one tree");
+    free (left);
+    free (right);
+    ConfFreeParseTree (list);
+    // Conflicts are reported at the property of the later tree
+    ConfDiagList_t diags = {0};
+    TEST_BOOL (!ConfOverlay (trees, 2, CONF_OVERLAY_ERROR, &diags), "conflict");
+    TEST_ANON (diags.numDiags, 1);
+    TEST_ANON (diags.diags[0].code, CONF_DIAG_CONFLICT);
+    TEST_ANON (diags.diags[0].line, 3);
+    TEST_BOOL_ANON (!strcmp (diags.diags[0].file, "<tree 1>"));
+    ConfFreeDiags (&diags);
+    // Appending can't make a property bigger than the parser allows, so what is
+    // written can be parsed again
+    ConfFreeParseTree (trees[1]);
+    for (int i = 1; i <= MAX_PROPVAR; ++i)
+        trees[i] = trees[0];
+    list = ConfOverlay (trees, MAX_PROPVAR - 1, CONF_OVERLAY_APPEND, &diags);
+    TEST_BOOL (list, "full property");
+    TEST_ANON (diags.numDiags, 0);
+    char* full = list ? ConfWriteBuffer (list, NULL, NULL) : NULL;
+    TEST_BOOL_ANON (full);
+    ConfParser_t* parser = ConfParserCreate ("<full>", NULL);
+    TEST_BOOL_ANON (parser);
+    bool fed = ConfParserFeed (parser, full, strlen (full));
+    ListHead_t* reparsed = ConfParserFinish (parser);
+    TEST_BOOL (fed && reparsed, "full property parses again");
+    ConfFreeParseTree (reparsed);
+    ConfParserDestroy (parser);
+    free (full);
+    ConfFreeParseTree (list);
+    list = ConfOverlay (trees, MAX_PROPVAR, CONF_OVERLAY_APPEND, &diags);
+    TEST_BOOL (!list, "too many values");
+    TEST_ANON (diags.numDiags, 1);
+    TEST_ANON (diags.diags[0].code, CONF_DIAG_TOO_MANY_VALUES);
+    ConfFreeDiags (&diags);
+    // A tree that failed to parse can't be merged
+    trees[1] = NULL;
+    TEST_BOOL (!ConfOverlay (trees, 2, CONF_OVERLAY_REPLACE, NULL), "NULL tree");
+    ConfFreeParseTree (trees[0]);
+    return 0;
+}
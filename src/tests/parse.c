@@ -20,12 +20,162 @@
 #include "../internal.h"
 #include <locale.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #define NEXTEST_NAME "parse"
 #include <libnex/progname.h>
 #include <libnex/stringref.h>
 #include <nextest.h>
 
+// Blocks allocated and freed by the test allocator
+static int numAllocs = 0;
+static int numFrees = 0;
+
+static void* _testAlloc (size_t sz, void* userData)
+{
+    ++*((int*) userData);
+    ++numAllocs;
+    return malloc (sz);
+}
+
+static void* _testRealloc (void* ptr, size_t oldSz, size_t sz, void* userData)
+{
+    (void) oldSz;
+    (void) userData;
+    return realloc (ptr, sz);
+}
+
+static void _testFree (void* ptr, size_t sz, void* userData)
+{
+    (void) sz;
+    (void) userData;
+    ++numFrees;
+    free (ptr);
+}
+
+// Checks if two parse trees hold the same blocks, properties and values
+static bool _testSameTree (ListHead_t* left, ListHead_t* right)
+{
+    if (left->size != right->size)
+        return false;
+    ListEntry_t* leftEnt = ListFront (left);
+    ListEntry_t* rightEnt = ListFront (right);
+    for (; leftEnt; leftEnt = ListIterate (leftEnt))
+    {
+        ConfBlock_t* leftBlock = ListEntryData (leftEnt);
+        ConfBlock_t* rightBlock = ListEntryData (rightEnt);
+        if (c32cmp (StrRefGet (leftBlock->blockType),
+                    StrRefGet (rightBlock->blockType)) ||
+            leftBlock->lineNo != rightBlock->lineNo ||
+            leftBlock->colNo != rightBlock->colNo ||
+            leftBlock->props->size != rightBlock->props->size)
+        {
+            return false;
+        }
+        ListEntry_t* leftPropEnt = ListFront (leftBlock->props);
+        ListEntry_t* rightPropEnt = ListFront (rightBlock->props);
+        for (; leftPropEnt; leftPropEnt = ListIterate (leftPropEnt))
+        {
+            ConfProperty_t* leftProp = ListEntryData (leftPropEnt);
+            ConfProperty_t* rightProp = ListEntryData (rightPropEnt);
+            if (c32cmp (StrRefGet (leftProp->name), StrRefGet (rightProp->name)) ||
+                leftProp->nextVal != rightProp->nextVal)
+            {
+                return false;
+            }
+            for (int i = 0; i < leftProp->nextVal; ++i)
+            {
+                ConfPropVal_t* leftVal = &leftProp->vals[i];
+                ConfPropVal_t* rightVal = &rightProp->vals[i];
+                if (leftVal->type != rightVal->type ||
+                    leftVal->lineNo != rightVal->lineNo ||
+                    leftVal->colNo != rightVal->colNo)
+                {
+                    return false;
+                }
+                if (leftVal->type == DATATYPE_NUMBER &&
+                    leftVal->numVal != rightVal->numVal)
+                {
+                    return false;
+                }
+                if (leftVal->type != DATATYPE_NUMBER &&
+                    c32cmp (StrRefGet (leftVal->str), StrRefGet (rightVal->str)))
+                {
+                    return false;
+                }
+            }
+            rightPropEnt = ListIterate (rightPropEnt);
+        }
+        rightEnt = ListIterate (rightEnt);
+    }
+    return true;
+}
+
+// Records that a call ran on a pool's thread
+static void _testInPool (void* data, int idx)
+{
+    ((bool*) data)[idx] = _confInPool();
+}
+
+// Looks up the same paths in a shared file cache from every thread
+static void _testCacheStat (void* data, int idx)
+{
+    (void) idx;
+    char path[32];
+    for (int i = 0; i < 40; ++i)
+    {
+        snprintf (path, sizeof (path), "testMissing%d.testxt", i);
+        _confPathInfo_t info;
+        _confFileCacheStat (data, path, &info);
+    }
+}
+
+// Writes a file big enough to be lexed in several chunks, then tail. Most lines
+// are in strings and block comments, so chunks start inside of them
+static bool _testWriteBig (const char* file, const char* tail)
+{
+    FILE* fp = fopen (file, "wb");
+    if (!fp)
+        return false;
+    for (int i = 0; i < 1550; ++i)
+    {
+        fprintf (fp, "/* comment %d\r\n   with 'quotes' and \"more\"\r\n", i);
+        fprintf (fp, "   # and { braces }\r\n*/\r\n");
+        fprintf (fp, "block%d name%d\r\n{\r\n", i % 4, i);
+        fprintf (fp, "    text: 'a string \\\r\n        that // goes on', ");
+        fprintf (fp, "\"with \\$ \\\" and /* \\\r\n    \";\r\n");
+        fprintf (fp, "    num: %d, 0x%x; # a \"comment\r\n}\r\n", i, i);
+    }
+    fputs (tail, fp);
+    return !fclose (fp);
+}
+
+// Pushes a file to a parser in pieces of a given size
+static ListHead_t* _testFeed (ConfParser_t* parser, const char* file, size_t pieceSz)
+{
+    FILE* fp = fopen (file, "rb");
+    if (!fp)
+        return NULL;
+    char buf[64];
+    size_t len = 0;
+    while ((len = fread (buf, 1, pieceSz, fp)))
+    {
+        if (!ConfParserFeed (parser, buf, len))
+            break;
+    }
+    fclose (fp);
+    return ConfParserFinish (parser);
+}
+
+// Parses a file by pushing it to a new parser in pieces of a given size
+static ListHead_t* _testPush (const char* file, size_t pieceSz, ConfOptions_t* opts)
+{
+    ConfParser_t* parser = ConfParserCreate (file, opts);
+    ListHead_t* list = _testFeed (parser, file, pieceSz);
+    ConfParserDestroy (parser);
+    return list;
+}
+
 int main()
 {
     // Set up locale stuff
@@ -139,5 +289,371 @@ int main()
     TEST_BOOL_ANON (!c32cmp (StrRefGet (prop->name), U"prop"));
     TEST_ANON (prop->vals[0].numVal, 0x20);
     ConfFreeParseTree (list);
+    // Test filtering out block types
+    const char32_t* types[] = {U"block"};
+    ConfOptions_t opts = {0};
+    opts.blockTypes = types;
+    opts.numBlockTypes = 1;
+    list = ConfInitEx ("testParse.testxt", &opts);
+    TEST_BOOL_ANON (list);
+    entry = ListFront (list);
+    TEST_BOOL_ANON (!ListIterate (entry));
+    block = ListEntryData (entry);
+    TEST_BOOL_ANON (!c32cmp (StrRefGet (block->blockType), U"block"));
+    TEST_ANON (block->lineNo, 16);
+    TEST_ANON (block->colNo, 1);
+    entry = ListFront (block->props);
+    prop = ListEntryData (entry);
+    TEST_BOOL_ANON (!c32cmp (StrRefGet (prop->name), U"test"));
+    TEST_ANON (prop->nextVal, 3);
+    TEST (prop->colNo, 5, "property column");
+    TEST (prop->vals[1].colNo, 19, "value column");
+    ConfFreeParseTree (list);
+    // Blocks are filtered out before their types become tokens, and properties
+    // outside of blocks are still reported
+    const char32_t* keptTypes[] = {U"kept"};
+    ConfDiagList_t filterDiags = {0};
+    ConfOptions_t filterOpts = {0};
+    filterOpts.blockTypes = keptTypes;
+    filterOpts.numBlockTypes = 1;
+    filterOpts.recover = true;
+    filterOpts.diags = &filterDiags;
+    list = ConfInitEx ("testFilter.testxt", &filterOpts);
+    TEST_BOOL (list, "filter");
+    TEST (list->size, 2, "filtered blocks");
+    block = ListEntryData (ListFront (list));
+    TEST_BOOL (!c32cmp (StrRefGet (block->blockName), U"block"), "kept name");
+    TEST (block->lineNo, 8, "kept line");
+    block = ListEntryData (ListIterate (ListFront (list)));
+    TEST (block->lineNo, 15, "line after skipped block");
+    TEST (filterDiags.numDiags, 1u, "filtered diagnostics");
+    TEST (filterDiags.diags[0].code, CONF_DIAG_PROP_NO_BLOCK, "stray property");
+    TEST (filterDiags.diags[0].line, 20, "stray property line");
+    ConfFreeDiags (&filterDiags);
+    ConfFreeParseTree (list);
+    // CR LF ends one line, and columns count characters, not bytes
+    ConfParser_t* parser = ConfParserCreate ("crlf", NULL);
+    const char crlf[] = "a\r\n{\r\n  b: \"\xc3\xa9\", 1;\r\n}\r\n";
+    TEST_BOOL_ANON (ConfParserFeed (parser, crlf, sizeof (crlf) - 1));
+    list = ConfParserFinish (parser);
+    ConfParserDestroy (parser);
+    TEST_BOOL_ANON (list);
+    block = ListEntryData (ListFront (list));
+    prop = ListEntryData (ListFront (block->props));
+    TEST (prop->lineNo, 3, "CR LF line");
+    TEST (prop->vals[1].colNo, 11, "UTF-8 column");
+    ConfFreeParseTree (list);
+    // Test including wildcards and directories, which skip hidden files and
+    // include files sorted by name
+    const char32_t* globTypes[] =
+        {U"first", U"second", U"first", U"second", U"third"};
+    ConfOptions_t parOpts = {0};
+    parOpts.parseThreads = 4;
+    list = ConfInitEx ("testGlob.testxt", &parOpts);
+    TEST_BOOL (list, "include wildcards");
+    TEST (list->size, 5, "included files");
+    entry = ListFront (list);
+    for (int i = 0; entry; entry = ListIterate (entry), ++i)
+    {
+        block = ListEntryData (entry);
+        TEST_BOOL (!c32cmp (StrRefGet (block->blockType), globTypes[i]),
+                   "include order");
+    }
+    ConfOptions_t seqOpts = {0};
+    seqOpts.parseThreads = 1;
+    ListHead_t* seq = ConfInitEx ("testGlob.testxt", &seqOpts);
+    TEST_BOOL (seq && _testSameTree (list, seq), "include in parallel");
+    // Includes in files parsed on a pool's threads don't start pools of their
+    // own
+    const char* globFiles[] = {"testGlob.testxt", "testGlob.testxt"};
+    ListHead_t** globTrees = ConfInitMany (globFiles, 2, &parOpts);
+    TEST_BOOL_ANON (globTrees);
+    for (int i = 0; i < 2; ++i)
+    {
+        TEST_BOOL (globTrees[i] && _testSameTree (seq, globTrees[i]),
+                   "include in pool");
+    }
+    ConfFreeMany (globTrees, 2);
+    // Only ConfInit and ConfInitEx set the file being worked on
+    ListHead_t* named = ConfInit ("testParse.testxt");
+    ConfFreeMany (ConfInitMany (globFiles, 2, &parOpts), 2);
+    TEST_BOOL (!strcmp (ConfGetFileName(), "testParse.testxt"), "file name");
+    ConfFreeParseTree (named);
+    bool inPool[2] = {false, false};
+    _confRunPool (2, 2, _testInPool, inPool);
+    TEST_BOOL (inPool[0] && inPool[1] && !_confInPool(), "pool threads");
+    // Paths looked up by several threads at once are cached once
+    _confFileCache_t cache;
+    _confFileCacheInit (&cache);
+    _confRunPool (4, 4, _testCacheStat, &cache);
+    TEST (cache.numPaths, 40, "cached paths");
+    _confPathInfo_t info, again;
+    TEST_BOOL_ANON (_confFileCacheStat (&cache, "testParse.testxt", &info));
+    TEST_BOOL_ANON (!_confFileCacheStat (&cache, "testMissing39.testxt", &again));
+    TEST_BOOL (again.path == cache.paths[39].path, "cached path");
+    TEST_BOOL_ANON (_confFileCacheStat (&cache, "testParse.testxt", &again));
+    TEST_BOOL (again.path == info.path && info.canonical, "cached file");
+    TEST (cache.numPaths, 41, "cached paths");
+    _confFileCacheDestroy (&cache);
+    ConfFreeParseTree (seq);
+    ConfFreeParseTree (list);
+    // Test finding includes next to the including file and in search paths
+    const char* includeDirs[] = {"testConfD", "testIncludeDir"};
+    ConfOptions_t searchOpts = {0};
+    ConfDiagList_t searchDiags = {0};
+    searchOpts.diags = &searchDiags;
+    TEST_BOOL (!ConfInitEx ("testSearch.testxt", &searchOpts), "not searched");
+    TEST (searchDiags.numDiags, 1u, "include not found");
+    TEST_BOOL_ANON (!strcmp (searchDiags.diags[0].file, "searched.testxt"));
+    ConfFreeDiags (&searchDiags);
+    searchOpts.includeDirs = includeDirs;
+    searchOpts.numIncludeDirs = 2;
+    list = ConfInitEx ("testSearch.testxt", &searchOpts);
+    TEST_BOOL (list, "search path");
+    TEST (list->size, 2, "searched files");
+    block = ListEntryData (ListBack (list));
+    TEST_BOOL_ANON (!c32cmp (StrRefGet (block->blockType), U"searched"));
+    ConfFreeParseTree (list);
+    // Test parsing several files at once
+    const char* files[] = {"testParse.testxt",
+                           "testInclude.testxt",
+                           "nonexistent.testxt",
+                           "testParse.testxt"};
+    ListHead_t** trees = ConfInitMany (files, 4, NULL);
+    TEST_BOOL_ANON (trees);
+    TEST_BOOL_ANON (trees[0]);
+    TEST_BOOL_ANON (trees[1]);
+    TEST_BOOL_ANON (!trees[2]);
+    TEST_BOOL_ANON (trees[3]);
+    block = ListEntryData (ListFront (trees[1]));
+    TEST_BOOL_ANON (!c32cmp (StrRefGet (block->blockType), U"package"));
+    block = ListEntryData (ListFront (trees[3]));
+    TEST_BOOL_ANON (!c32cmp (StrRefGet (block->blockType), U"package"));
+    ConfFreeMany (trees, 4);
+    // Test statistics, if they were built in
+    ConfStats_t stats;
+    list = ConfInit ("testParse.testxt");
+    if (ConfGetStats (&stats))
+    {
+        TEST_ANON (stats.blocks, 3);
+        TEST_ANON (stats.props, 12);
+        TEST_ANON (stats.includes, 1);
+        TEST_ANON (stats.tokens[LEX_TOKEN_OBRACE], 3);
+        TEST_BOOL_ANON (stats.bytesRead);
+        TEST_BOOL_ANON (stats.allocs);
+    }
+    ConfFreeParseTree (list);
+    // Test parsing with an allocator
+    int userData = 0;
+    ConfAllocator_t alloc = {_testAlloc, _testRealloc, _testFree, &userData};
+    ConfOptions_t allocOpts = {0};
+    allocOpts.alloc = &alloc;
+    list = ConfInitEx ("testParse.testxt", &allocOpts);
+    TEST_BOOL_ANON (list);
+    TEST_BOOL_ANON (numAllocs);
+    TEST_ANON (userData, numAllocs);
+    ConfFreeParseTree (list);
+    TEST_ANON (numFrees, numAllocs);
+    // Test the pool allocator
+    allocOpts.alloc = ConfGetPoolAllocator();
+    allocOpts.parseThreads = 2;
+    trees = ConfInitMany (files, 4, &allocOpts);
+    TEST_BOOL_ANON (trees);
+    block = ListEntryData (ListFront (trees[0]));
+    TEST_BOOL_ANON (!c32cmp (StrRefGet (block->blockType), U"package"));
+    ConfFreeMany (trees, 4);
+    ConfFreePool();
+    // Test limits
+    ConfLimits_t limits = {0};
+    ConfOptions_t limitOpts = {0};
+    limitOpts.limits = &limits;
+    limits.maxBlocks = 3;
+    limits.maxProps = 12;
+    limits.maxTokens = 200;
+    limits.maxBytes = 1024;
+    limits.maxMemory = 1024 * 1024;
+    list = ConfInitEx ("testParse.testxt", &limitOpts);
+    TEST_BOOL_ANON (list);
+    ConfFreeParseTree (list);
+    limits.maxBlocks = 2;
+    TEST_BOOL (!ConfInitEx ("testParse.testxt", &limitOpts), "block limit");
+    limits.maxBlocks = 0;
+    limits.maxProps = 11;
+    TEST_BOOL (!ConfInitEx ("testParse.testxt", &limitOpts), "property limit");
+    limits.maxProps = 0;
+    limits.maxTokens = 20;
+    TEST_BOOL (!ConfInitEx ("testParse.testxt", &limitOpts), "token limit");
+    limits.maxTokens = 0;
+    limits.maxBytes = 100;
+    TEST_BOOL (!ConfInitEx ("testParse.testxt", &limitOpts), "byte limit");
+    limits.maxBytes = 0;
+    limits.maxMemory = 64;
+    TEST_BOOL (!ConfInitEx ("testParse.testxt", &limitOpts), "memory limit");
+    limits.maxMemory = 0;
+    limits.maxIncludeDepth = 1;
+    list = ConfInitEx ("testParse.testxt", &limitOpts);
+    TEST_BOOL_ANON (list);
+    ConfFreeParseTree (list);
+    // Files that include themselves stop at the default depth
+    TEST_BOOL (!ConfInit ("testRecurse.testxt"), "include depth");
+    // Test collecting diagnostics
+    ConfDiagList_t diags = {0};
+    ConfOptions_t diagOpts = {0};
+    diagOpts.diags = &diags;
+    TEST_BOOL_ANON (!ConfInitEx ("testRecover.testxt", &diagOpts));
+    TEST_ANON (diags.numDiags, 1);
+    TEST_ANON (diags.diags[0].code, CONF_DIAG_PROP_NO_BLOCK);
+    TEST_ANON (diags.diags[0].line, 1);
+    TEST_ANON (diags.diags[0].column, 1);
+    TEST_BOOL_ANON (!strcmp (diags.diags[0].file, "testRecover.testxt"));
+    char msg[256];
+    ConfFormatDiag (&diags.diags[0], msg, sizeof (msg));
+    TEST_BOOL_ANON (!strcmp (msg,
+                             "error: testRecover.testxt:1:1: "
+                             "property declared outside of a block"));
+    // Unknown characters are shown in UTF-8, even in the C locale
+    setlocale (LC_ALL, "C");
+    ConfDiag_t unknown = diags.diags[0];
+    unknown.code = CONF_DIAG_UNKNOWN_TOKEN;
+    unknown.value = 0xE9;
+    ConfFormatDiag (&unknown, msg, sizeof (msg));
+    TEST_BOOL (!strcmp (msg,
+                        "error: testRecover.testxt:1:1: "
+                        "Unknown token '\xc3\xa9'"),
+               "unknown character");
+    setlocale (LC_ALL, "");
+    ConfFreeDiags (&diags);
+    // Test recovering from errors
+    diagOpts.recover = true;
+    list = ConfInitEx ("testRecover.testxt", &diagOpts);
+    TEST_BOOL (list, "recovery");
+    TEST_ANON (diags.numDiags, 4);
+    TEST_ANON (diags.diags[1].code, CONF_DIAG_UNEXPECTED_TOKEN);
+    TEST_ANON (diags.diags[1].line, 6);
+    TEST_ANON (diags.diags[1].token, LEX_TOKEN_NUM);
+    TEST_ANON (diags.diags[1].expected, LEX_TOKEN_COLON);
+    TEST_ANON (diags.diags[2].code, CONF_DIAG_MISSING_SEMICOLON);
+    TEST_ANON (diags.diags[2].line, 8);
+    TEST_ANON (diags.diags[3].code, CONF_DIAG_UNEXPECTED_TOKEN);
+    TEST_ANON (diags.diags[3].expected, LEX_TOKEN_STR);
+    ConfFreeDiags (&diags);
+    entry = ListFront (list);
+    block = ListEntryData (entry);
+    TEST_BOOL_ANON (!c32cmp (StrRefGet (block->blockType), U"package"));
+    TEST_ANON (block->props->size, 4);
+    prop = ListEntryData (ListBack (block->props));
+    TEST_BOOL_ANON (!c32cmp (StrRefGet (prop->vals[0].str), U"string"));
+    block = ListEntryData (ListIterate (entry));
+    TEST_BOOL_ANON (!c32cmp (StrRefGet (block->blockType), U"block"));
+    ConfFreeParseTree (list);
+    // Test pushing input in pieces, which split tokens and lines
+    list = ConfInit ("testParse.testxt");
+    ListHead_t* pushed = _testPush ("testParse.testxt", 1, NULL);
+    TEST_BOOL (pushed && _testSameTree (list, pushed), "push bytes");
+    ConfFreeParseTree (pushed);
+    pushed = _testPush ("testParse.testxt", 7, NULL);
+    TEST_BOOL (pushed && _testSameTree (list, pushed), "push pieces");
+    ConfFreeParseTree (pushed);
+    pushed = _testPush ("testParse.testxt", 64, &opts);
+    TEST_BOOL_ANON (pushed);
+    TEST_ANON (pushed->size, 1);
+    ConfFreeParseTree (pushed);
+    ConfFreeParseTree (list);
+    // Pushed input reports and recovers from errors like files
+    TEST_BOOL_ANON (!_testPush ("testRecover.testxt", 5, NULL));
+    list = ConfInitEx ("testRecover.testxt", &diagOpts);
+    ConfFreeDiags (&diags);
+    pushed = _testPush ("testRecover.testxt", 3, &diagOpts);
+    TEST_BOOL_ANON (pushed && _testSameTree (list, pushed));
+    TEST_ANON (diags.numDiags, 4);
+    TEST_ANON (diags.diags[2].code, CONF_DIAG_MISSING_SEMICOLON);
+    TEST_ANON (diags.diags[2].line, 8);
+    TEST_BOOL_ANON (!strcmp (diags.diags[2].file, "testRecover.testxt"));
+    ConfFreeDiags (&diags);
+    ConfFreeParseTree (pushed);
+    ConfFreeParseTree (list);
+    limits.maxBlocks = 2;
+    TEST_BOOL (!_testPush ("testParse.testxt", 16, &limitOpts), "push limit");
+    // A parser that is reset parses like a new one, even after failing
+    list = ConfInit ("testParse.testxt");
+    ConfParser_t* reused = ConfParserCreate ("testParse.testxt", &limitOpts);
+    TEST_BOOL_ANON (!_testFeed (reused, "testParse.testxt", 16));
+    limits.maxBlocks = 0;
+    for (int i = 0; i < 2; ++i)
+    {
+        TEST_BOOL (ConfParserReset (reused, NULL), "reset");
+        pushed = _testFeed (reused, "testParse.testxt", 7);
+        TEST_BOOL (pushed && _testSameTree (list, pushed), "reused parser");
+        ConfFreeParseTree (pushed);
+    }
+    // Trees that weren't finished are freed
+    TEST_BOOL_ANON (ConfParserReset (reused, "unfinished"));
+    TEST_BOOL_ANON (ConfParserFeed (reused, "a { b: 1; } c", 13));
+    TEST_BOOL_ANON (ConfParserReset (reused, "testParse.testxt"));
+    pushed = _testFeed (reused, "testParse.testxt", 64);
+    TEST_BOOL (pushed && _testSameTree (list, pushed), "reset unfinished");
+    ConfFreeParseTree (pushed);
+    ConfParserDestroy (reused);
+    ConfFreeParseTree (list);
+    // UTF-16 and UTF-32 files parse like the same text in UTF-8
+    list = ConfInit ("testUtf8.testxt");
+    TEST_BOOL_ANON (list);
+    const char* wideFiles[] = {"testUtf16.testxt", "testUtf32.testxt"};
+    for (int i = 0; i < 2; ++i)
+    {
+        ListHead_t* wide = ConfInit (wideFiles[i]);
+        TEST_BOOL (wide && _testSameTree (list, wide), wideFiles[i]);
+        if (wide && i == 0)
+        {
+            block = ListEntryData (ListFront (wide));
+            prop = ListEntryData (ListFront (block->props));
+            TEST_BOOL (!c32cmp (StrRefGet (prop->vals[0].str),
+                                U"Gr\u00fc\u00dfe, \u4e16\u754c \U0001F600"),
+                       "surrogate pair");
+        }
+        ConfFreeParseTree (wide);
+    }
+    ConfFreeParseTree (list);
+    // Surrogates that aren't in a pair are replaced
+    list = ConfInit ("testSurrogate.testxt");
+    TEST_BOOL_ANON (list);
+    block = ListEntryData (ListFront (list));
+    prop = ListEntryData (ListFront (block->props));
+    TEST_BOOL (!c32cmp (StrRefGet (prop->vals[0].str), U"x\uFFFDy\uFFFD"),
+               "unpaired surrogates");
+    ConfFreeParseTree (list);
+    // Files lexed in chunks parse like files lexed in one go, down to the
+    // columns, even when chunks start in strings and comments
+    TEST_BOOL_ANON (_testWriteBig ("testLexPar.testxt", ""));
+    ConfOptions_t lexOpts = {0};
+    lexOpts.lexThreads = 1;
+    list = ConfInitEx ("testLexPar.testxt", &lexOpts);
+    TEST_BOOL_ANON (list);
+    for (int threads = 2; threads <= 4; threads *= 2)
+    {
+        lexOpts.lexThreads = threads;
+        ListHead_t* chunked = ConfInitEx ("testLexPar.testxt", &lexOpts);
+        TEST_BOOL (chunked && _testSameTree (list, chunked), "lex in chunks");
+        ConfFreeParseTree (chunked);
+    }
+    ConfFreeParseTree (list);
+    // A string that doesn't end in the last chunk is reported like it is when
+    // lexing in one go
+    TEST_BOOL_ANON (_testWriteBig ("testLexPar.testxt",
+                                   "last { s: 'unterminated\r\n"));
+    ConfDiag_t lexDiags[2];
+    for (int i = 0; i < 2; ++i)
+    {
+        lexOpts.lexThreads = i ? 4 : 1;
+        lexOpts.diags = &diags;
+        TEST_BOOL_ANON (!ConfInitEx ("testLexPar.testxt", &lexOpts));
+        TEST (diags.numDiags, 1, "unterminated string");
+        lexDiags[i] = diags.diags[0];
+        ConfFreeDiags (&diags);
+    }
+    TEST_ANON (lexDiags[1].code, lexDiags[0].code);
+    TEST_ANON (lexDiags[1].line, lexDiags[0].line);
+    TEST_ANON (lexDiags[1].column, lexDiags[0].column);
+    remove ("testLexPar.testxt");
     return 0;
 }
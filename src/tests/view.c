@@ -0,0 +1,77 @@
+/*
+    view.c - contains frozen view test cases
+    Copyright 2022 The NexNix Project
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+         http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+/// @file view.c
+
+#include "../internal.h"
+#include <locale.h>
+#include <stdio.h>
+#include <string.h>
+#define NEXTEST_NAME "view"
+#include <libnex/progname.h>
+#include <libnex/stringref.h>
+#include <nextest.h>
+
+int main()
+{
+    // Set up locale stuff
+    setlocale (LC_ALL, "");
+    setprogname ("view");
+    ListHead_t* list = ConfInit ("testParse.testxt");
+    TEST_BOOL_ANON (list);
+    ConfView_t* view = ConfFreeze (list);
+    // The view must not depend on the list
+    ConfFreeParseTree (list);
+    TEST_BOOL_ANON (view);
+    TEST_ANON (view->numBlocks, 3);
+    TEST_ANON (view->numProps, 12);
+    TEST_ANON (view->numVals, 18);
+    for (size_t i = 0; i < view->numBlocks; ++i)
+    {
+        const ConfViewBlock_t* block = ConfViewGetBlock (view, i);
+        TEST_BOOL_ANON (!c32cmp (block->blockName, U"test"));
+        TEST_ANON (block->numProps, 4);
+        const ConfViewProp_t* prop = ConfViewGetProp (view, block, 0);
+        TEST_BOOL_ANON (!c32cmp (prop->name, U"test"));
+        TEST_ANON (prop->numVals, 3);
+        const ConfViewVal_t* val = ConfViewGetVal (view, prop, 0);
+        TEST_ANON (val->type, DATATYPE_STRING);
+        TEST_BOOL_ANON (!c32cmp (val->str, U"test"));
+        val = ConfViewGetVal (view, prop, 1);
+        TEST_ANON (val->type, DATATYPE_NUMBER);
+        TEST_ANON (val->numVal, 3);
+        val = ConfViewGetVal (view, prop, 2);
+        TEST_ANON (val->type, DATATYPE_IDENTIFIER);
+        TEST_BOOL_ANON (!c32cmp (val->id, U"one"));
+        TEST_BOOL_ANON (!ConfViewGetVal (view, prop, 3));
+        prop = ConfViewGetProp (view, block, 3);
+        TEST_BOOL_ANON (!c32cmp (prop->name, U"prop"));
+        TEST_ANON (ConfViewGetVal (view, prop, 0)->numVal, 0x20);
+        TEST_BOOL_ANON (!ConfViewGetProp (view, block, 4));
+    }
+    TEST_BOOL_ANON (!c32cmp (view->blocks[2].blockType, U"block"));
+    TEST_ANON (view->blocks[2].lineNo, 16);
+    TEST_ANON (view->blocks[2].colNo, 1);
+    const ConfViewProp_t* prop = ConfViewGetProp (view, &view->blocks[2], 3);
+    TEST_ANON (prop->colNo, 5);
+    const ConfViewVal_t* val = ConfViewGetVal (view, prop, 0);
+    TEST_ANON (val->colNo, 11);
+    TEST_ANON (val->base, 16);
+    TEST_BOOL_ANON (!ConfViewGetBlock (view, 3));
+    ConfFreeView (view);
+    return 0;
+}
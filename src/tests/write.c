@@ -0,0 +1,117 @@
+/*
+    write.c - contains writer test cases
+    Copyright 2022 The NexNix Project
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+         http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+/// @file write.c
+
+#include "../internal.h"
+#include <locale.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#define NEXTEST_NAME "write"
+#include <libnex/progname.h>
+#include <nextest.h>
+
+// What testWrite.testxt is written as
+static const char* expected = "numbers test\n"
+                              "{\n"
+                              "    hex: 0x1f, 0x0;\n"
+                              "    octal: 017, 0;\n"
+                              "    binary: 0b101;\n"
+                              "    decimal: -42, 7;\n"
+                              "}\n"
+                              "\n"
+                              "strings\n"
+                              "{\n"
+                              "    strs: 'it\\'s', \"a\\nb \\$x\", "
+                              "'back\\\\slash';\n"
+                              "}\n";
+
+// The same in canonical form
+static const char* canonical = "numbers test\n"
+                               "{\n"
+                               "    hex: 31, 0;\n"
+                               "    octal: 15, 0;\n"
+                               "    binary: 5;\n"
+                               "    decimal: -42, 7;\n"
+                               "}\n"
+                               "\n"
+                               "strings\n"
+                               "{\n"
+                               "    strs: 'it\\'s', \"a\\nb \\$x\", "
+                               "'back\\\\slash';\n"
+                               "}\n";
+
+// Writes a tree to a file, parses it again, and writes that back to memory
+static char* _testRoundTrip (ListHead_t* list, const ConfWriteOptions_t* opts)
+{
+    char name[] = "writeXXXXXX";
+    int fd = mkstemp (name);
+    if (fd == -1)
+        return NULL;
+    bool res = ConfWrite (list, fd, opts);
+    close (fd);
+    ListHead_t* reread = res ? ConfInit (name) : NULL;
+    remove (name);
+    if (!reread)
+        return NULL;
+    char* buf = ConfWriteBuffer (reread, NULL, opts);
+    ConfFreeParseTree (reread);
+    return buf;
+}
+
+int main()
+{
+    // Set up locale stuff
+    setlocale (LC_ALL, "");
+    setprogname ("write");
+    ListHead_t* list = ConfInit ("testWrite.testxt");
+    TEST_BOOL_ANON (list);
+    size_t len = 0;
+    char* buf = ConfWriteBuffer (list, &len, NULL);
+    TEST_BOOL (buf && !strcmp (buf, expected), "testWrite output");
+    TEST (len, strlen (expected), "testWrite length");
+    char* reread = _testRoundTrip (list, NULL);
+    TEST_BOOL (reread && !strcmp (reread, expected), "testWrite round trip");
+    free (buf);
+    free (reread);
+    ConfWriteOptions_t opts = {0};
+    opts.canonical = true;
+    // Canonical output ignores the indent it is asked for
+    opts.indent = 2;
+    buf = ConfWriteBuffer (list, NULL, &opts);
+    TEST_BOOL (buf && !strcmp (buf, canonical), "testWrite canonical");
+    reread = _testRoundTrip (list, &opts);
+    TEST_BOOL (reread && !strcmp (reread, canonical), "canonical round trip");
+    free (buf);
+    free (reread);
+    ConfFreeParseTree (list);
+    // The parser's fixture, with its include, must come back the same
+    list = ConfInit ("testParse.testxt");
+    TEST_BOOL_ANON (list);
+    opts.canonical = false;
+    opts.indent = 8;
+    buf = ConfWriteBuffer (list, NULL, &opts);
+    TEST_BOOL (buf && !strncmp (buf, "package test\n{\n        ", 23), "indent");
+    reread = _testRoundTrip (list, &opts);
+    TEST_BOOL (buf && reread && !strcmp (buf, reread), "testParse round trip");
+    free (buf);
+    free (reread);
+    ConfFreeParseTree (list);
+    return 0;
+}
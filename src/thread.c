@@ -0,0 +1,233 @@
+/*
+    thread.c - contains threading helpers
+    Copyright 2022 The NexNix Project
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+         http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+/// @file thread.c
+
+#include "internal.h"
+#include <libnex/safemalloc.h>
+#include <stdlib.h>
+#ifdef HAVE_PTHREAD
+#include <unistd.h>
+#endif
+
+void _confMutexInit (_confMutex_t* mutex)
+{
+#ifdef HAVE_PTHREAD
+    pthread_mutex_init (mutex, NULL);
+#else
+    (void) mutex;
+#endif
+}
+
+void _confMutexDestroy (_confMutex_t* mutex)
+{
+#ifdef HAVE_PTHREAD
+    pthread_mutex_destroy (mutex);
+#else
+    (void) mutex;
+#endif
+}
+
+void _confMutexLock (_confMutex_t* mutex)
+{
+#ifdef HAVE_PTHREAD
+    pthread_mutex_lock (mutex);
+#else
+    (void) mutex;
+#endif
+}
+
+void _confMutexUnlock (_confMutex_t* mutex)
+{
+#ifdef HAVE_PTHREAD
+    pthread_mutex_unlock (mutex);
+#else
+    (void) mutex;
+#endif
+}
+
+int _confNumCpus (void)
+{
+#if defined HAVE_PTHREAD && defined _SC_NPROCESSORS_ONLN
+    long cpus = sysconf (_SC_NPROCESSORS_ONLN);
+    if (cpus > 0)
+        return (int) cpus;
+#endif
+    return 1;
+}
+
+// Is this thread running calls for a pool?
+static _Thread_local bool inPool = false;
+
+bool _confInPool (void)
+{
+    return inPool;
+}
+
+#ifdef HAVE_PTHREAD
+// Queue of calls owned by a worker. The calls are the indices in [head, tail)
+typedef struct _poolQueue
+{
+    _confMutex_t lock;    // Protects head and tail
+    int head;             // First call in queue. The owner takes calls from here
+    int tail;             // End of queue. Thieves take calls from here
+} poolQueue_t;
+
+// A pool of workers
+typedef struct _pool
+{
+    void (*fn) (void*, int);         // Function to run
+    void* arg;                       // Argument to pass to it
+    const ConfAllocator_t* alloc;    // Allocator of the calling thread
+    _confBudget_t* budget;           // Budget of the calling thread
+    int numWorkers;                  // Number of workers
+    poolQueue_t* queues;             // Queue of each worker
+} pool_t;
+
+// Arguments to a worker thread
+typedef struct _poolWorker
+{
+    pool_t* pool;    // Pool this worker is in
+    int idx;         // Index of this worker
+} poolWorker_t;
+
+// Takes the next call from a worker's own queue. Returns -1 if it's empty
+static int _poolPop (poolQueue_t* queue)
+{
+    int call = -1;
+    _confMutexLock (&queue->lock);
+    if (queue->head < queue->tail)
+        call = queue->head++;
+    _confMutexUnlock (&queue->lock);
+    return call;
+}
+
+// Steals half of the calls of another worker. Returns false if there was
+// nothing left to steal anywhere
+static bool _poolSteal (pool_t* pool, int idx)
+{
+    for (int i = 1; i < pool->numWorkers; ++i)
+    {
+        poolQueue_t* victim = &pool->queues[(idx + i) % pool->numWorkers];
+        _confMutexLock (&victim->lock);
+        int left = victim->tail - victim->head;
+        if (left <= 0)
+        {
+            _confMutexUnlock (&victim->lock);
+            continue;
+        }
+        // Take calls off the back, so the victim keeps the ones it's about to run
+        int tail = victim->tail;
+        victim->tail -= (left + 1) / 2;
+        int head = victim->tail;
+        _confMutexUnlock (&victim->lock);
+        poolQueue_t* queue = &pool->queues[idx];
+        _confMutexLock (&queue->lock);
+        queue->head = head;
+        queue->tail = tail;
+        _confMutexUnlock (&queue->lock);
+        return true;
+    }
+    return false;
+}
+
+// Runs calls until there are none left in the pool
+static void* _poolWork (void* data)
+{
+    poolWorker_t* worker = data;
+    pool_t* pool = worker->pool;
+    _confSetAllocator (pool->alloc);
+    _confSetBudget (pool->budget);
+    // The calling thread is a worker too, and goes back to what it was after
+    bool wasInPool = inPool;
+    inPool = true;
+    while (1)
+    {
+        int call = _poolPop (&pool->queues[worker->idx]);
+        if (call != -1)
+            pool->fn (pool->arg, call);
+        else if (!_poolSteal (pool, worker->idx))
+            break;
+    }
+    inPool = wasInPool;
+    return NULL;
+}
+#endif
+
+void _confRunPool (int n, int threads, void (*fn) (void*, int), void* arg)
+{
+#ifdef HAVE_PTHREAD
+    if (threads > n)
+        threads = n;
+    if (threads <= 1)
+        goto fallback;
+    pool_t pool = {0};
+    pool.fn = fn;
+    pool.arg = arg;
+    pool.alloc = _confGetAllocator();
+    pool.budget = _confGetBudget();
+    pool.numWorkers = threads;
+    pool.queues = _confMalloc (threads * sizeof (poolQueue_t));
+    pthread_t* ids = _confMalloc (threads * sizeof (pthread_t));
+    poolWorker_t* workers = _confMalloc (threads * sizeof (poolWorker_t));
+    bool* started = _confCalloc (threads * sizeof (bool));
+    if (!pool.queues || !ids || !workers || !started)
+    {
+        _confFree (pool.queues);
+        _confFree (ids);
+        _confFree (workers);
+        _confFree (started);
+        goto fallback;
+    }
+    // Hand out the calls evenly to begin with
+    for (int i = 0; i < threads; ++i)
+    {
+        _confMutexInit (&pool.queues[i].lock);
+        pool.queues[i].head = (int) (((int64_t) n * i) / threads);
+        pool.queues[i].tail = (int) (((int64_t) n * (i + 1)) / threads);
+        workers[i].pool = &pool;
+        workers[i].idx = i;
+    }
+    // The calling thread is worker 0. If a thread can't be made, the other
+    // workers steal its calls
+    for (int i = 1; i < threads; ++i)
+        started[i] = !pthread_create (&ids[i], NULL, _poolWork, &workers[i]);
+    _poolWork (&workers[0]);
+    for (int i = 1; i < threads; ++i)
+    {
+        if (started[i])
+            pthread_join (ids[i], NULL);
+    }
+    for (int i = 0; i < threads; ++i)
+        _confMutexDestroy (&pool.queues[i].lock);
+    _confFree (pool.queues);
+    _confFree (ids);
+    _confFree (workers);
+    _confFree (started);
+    return;
+fallback:
+#else
+    (void) threads;
+#endif
+    for (int i = 0; i < n; ++i)
+        fn (arg, i);
+}
+
+void _confRunParallel (int n, void (*fn) (void*, int), void* arg)
+{
+    _confRunPool (n, n, fn, arg);
+}
@@ -0,0 +1,324 @@
+/*
+    utf8.c - contains string conversion functions
+    Copyright 2022 The NexNix Project
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+         http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+/// @file utf8.c
+
+#include "internal.h"
+#include <libconf.h>
+#include <string.h>
+
+// Strings are converted by hand instead of with c32stombs and mbstoc32s. Those
+// depend on the locale, which configuration files and paths don't
+
+size_t _confC32ToUtf8 (char* out, size_t outSz, const char32_t* str)
+{
+    size_t len = 0;
+    bool full = (outSz == 0);
+    for (; *str; ++str)
+    {
+        uint8_t c[4];
+        size_t cLen = _confUtf8Encode (*str, c);
+        // Leave room for the null terminator, and don't split characters
+        if (!full && (len + cLen) < outSz)
+            memcpy (out + len, c, cLen);
+        else if (!full)
+        {
+            out[len] = '\0';
+            full = true;
+        }
+        len += cLen;
+    }
+    if (!full)
+        out[len] = '\0';
+    return len;
+}
+
+size_t _confUtf8ToC32 (char32_t* out, size_t outLen, const char* str, size_t len)
+{
+    const uint8_t* s = (const uint8_t*) str;
+    size_t numChars = 0;
+    size_t pos = 0;
+    while (pos < len)
+    {
+        char32_t c;
+        pos += _confUtf8Decode (s + pos, len - pos, &c);
+        if (numChars < outLen)
+            out[numChars] = c;
+        ++numChars;
+    }
+    return numChars;
+}
+
+size_t ConfStrToUtf8 (const char32_t* str, char* buf, size_t bufSz)
+{
+    return _confC32ToUtf8 (buf, bufSz, str);
+}
+
+// UTF-16 and UTF-32 files are converted a whole file at a time. Runs of ASCII
+// are narrowed by vector kernels, picked at run time from what the CPU has, and
+// everything else a code unit at a time
+
+// Narrows the leading ASCII code units of in into out. Returns how many there
+// were
+typedef size_t (*utfNarrowFn_t) (uint8_t* out,
+                                 const uint8_t* in,
+                                 size_t numUnits,
+                                 bool bigEndian);
+
+// Reads a UTF-16 code unit
+static inline char32_t _utf16Unit (const uint8_t* in, bool bigEndian)
+{
+    return bigEndian ? ((char32_t) in[0] << 8) | in[1]
+                     : ((char32_t) in[1] << 8) | in[0];
+}
+
+// Reads a UTF-32 code unit
+static inline char32_t _utf32Unit (const uint8_t* in, bool bigEndian)
+{
+    if (bigEndian)
+    {
+        return ((char32_t) in[0] << 24) | ((char32_t) in[1] << 16) |
+               ((char32_t) in[2] << 8) | in[3];
+    }
+    return ((char32_t) in[3] << 24) | ((char32_t) in[2] << 16) |
+           ((char32_t) in[1] << 8) | in[0];
+}
+
+static size_t _utf16NarrowScalar (uint8_t* out,
+                                  const uint8_t* in,
+                                  size_t numUnits,
+                                  bool bigEndian)
+{
+    size_t i = 0;
+    for (; i < numUnits; ++i)
+    {
+        char32_t c = _utf16Unit (in + (i * 2), bigEndian);
+        if (c >= 0x80)
+            break;
+        out[i] = (uint8_t) c;
+    }
+    return i;
+}
+
+static size_t _utf32NarrowScalar (uint8_t* out,
+                                  const uint8_t* in,
+                                  size_t numUnits,
+                                  bool bigEndian)
+{
+    size_t i = 0;
+    for (; i < numUnits; ++i)
+    {
+        char32_t c = _utf32Unit (in + (i * 4), bigEndian);
+        if (c >= 0x80)
+            break;
+        out[i] = (uint8_t) c;
+    }
+    return i;
+}
+
+#if defined __x86_64__ && (defined __GNUC__ || defined __clang__)
+#include <immintrin.h>
+#define UTF_HAVE_X86
+
+// SSE2 is always there on x86-64. A unit is ASCII if the bits of mask are clear,
+// and big endian units are shifted down to their low byte before narrowing
+static size_t _utf16NarrowSse2 (uint8_t* out,
+                                const uint8_t* in,
+                                size_t numUnits,
+                                bool bigEndian)
+{
+    const __m128i mask = _mm_set1_epi16 ((short) (bigEndian ? 0x80FF : 0xFF80));
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; (i + 8) <= numUnits; i += 8)
+    {
+        __m128i v = _mm_loadu_si128 ((const __m128i*) (in + (i * 2)));
+        __m128i ascii = _mm_cmpeq_epi16 (_mm_and_si128 (v, mask), zero);
+        if (_mm_movemask_epi8 (ascii) != 0xFFFF)
+            break;
+        if (bigEndian)
+            v = _mm_srli_epi16 (v, 8);
+        _mm_storel_epi64 ((__m128i*) (out + i), _mm_packus_epi16 (v, v));
+    }
+    return i + _utf16NarrowScalar (out + i, in + (i * 2), numUnits - i, bigEndian);
+}
+
+static size_t _utf32NarrowSse2 (uint8_t* out,
+                                const uint8_t* in,
+                                size_t numUnits,
+                                bool bigEndian)
+{
+    const __m128i mask =
+        _mm_set1_epi32 ((int) (bigEndian ? 0x80FFFFFF : 0xFFFFFF80));
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; (i + 8) <= numUnits; i += 8)
+    {
+        __m128i lo = _mm_loadu_si128 ((const __m128i*) (in + (i * 4)));
+        __m128i hi = _mm_loadu_si128 ((const __m128i*) (in + (i * 4) + 16));
+        __m128i ascii = _mm_or_si128 (_mm_and_si128 (lo, mask),
+                                      _mm_and_si128 (hi, mask));
+        ascii = _mm_cmpeq_epi32 (ascii, zero);
+        if (_mm_movemask_epi8 (ascii) != 0xFFFF)
+            break;
+        if (bigEndian)
+        {
+            lo = _mm_srli_epi32 (lo, 24);
+            hi = _mm_srli_epi32 (hi, 24);
+        }
+        __m128i v = _mm_packs_epi32 (lo, hi);
+        _mm_storel_epi64 ((__m128i*) (out + i), _mm_packus_epi16 (v, v));
+    }
+    return i + _utf32NarrowScalar (out + i, in + (i * 4), numUnits - i, bigEndian);
+}
+
+// AVX2 packs within 128 bit lanes, so the lanes are put back in order after
+__attribute__ ((target ("avx2"))) static size_t _utf16NarrowAvx2 (
+    uint8_t* out,
+    const uint8_t* in,
+    size_t numUnits,
+    bool bigEndian)
+{
+    const __m256i mask =
+        _mm256_set1_epi16 ((short) (bigEndian ? 0x80FF : 0xFF80));
+    const __m256i zero = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; (i + 16) <= numUnits; i += 16)
+    {
+        __m256i v = _mm256_loadu_si256 ((const __m256i*) (in + (i * 2)));
+        __m256i ascii = _mm256_cmpeq_epi16 (_mm256_and_si256 (v, mask), zero);
+        if (_mm256_movemask_epi8 (ascii) != -1)
+            break;
+        if (bigEndian)
+            v = _mm256_srli_epi16 (v, 8);
+        v = _mm256_permute4x64_epi64 (_mm256_packus_epi16 (v, v),
+                                      _MM_SHUFFLE (3, 1, 2, 0));
+        _mm_storeu_si128 ((__m128i*) (out + i), _mm256_castsi256_si128 (v));
+    }
+    return i + _utf16NarrowSse2 (out + i, in + (i * 2), numUnits - i, bigEndian);
+}
+
+__attribute__ ((target ("avx2"))) static size_t _utf32NarrowAvx2 (
+    uint8_t* out,
+    const uint8_t* in,
+    size_t numUnits,
+    bool bigEndian)
+{
+    const __m256i mask =
+        _mm256_set1_epi32 ((int) (bigEndian ? 0x80FFFFFF : 0xFFFFFF80));
+    const __m256i zero = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; (i + 16) <= numUnits; i += 16)
+    {
+        __m256i lo = _mm256_loadu_si256 ((const __m256i*) (in + (i * 4)));
+        __m256i hi = _mm256_loadu_si256 ((const __m256i*) (in + (i * 4) + 32));
+        __m256i ascii = _mm256_or_si256 (_mm256_and_si256 (lo, mask),
+                                         _mm256_and_si256 (hi, mask));
+        ascii = _mm256_cmpeq_epi32 (ascii, zero);
+        if (_mm256_movemask_epi8 (ascii) != -1)
+            break;
+        if (bigEndian)
+        {
+            lo = _mm256_srli_epi32 (lo, 24);
+            hi = _mm256_srli_epi32 (hi, 24);
+        }
+        __m256i v = _mm256_permute4x64_epi64 (_mm256_packs_epi32 (lo, hi),
+                                              _MM_SHUFFLE (3, 1, 2, 0));
+        v = _mm256_permute4x64_epi64 (_mm256_packus_epi16 (v, v),
+                                      _MM_SHUFFLE (3, 1, 2, 0));
+        _mm_storeu_si128 ((__m128i*) (out + i), _mm256_castsi256_si128 (v));
+    }
+    return i + _utf32NarrowSse2 (out + i, in + (i * 4), numUnits - i, bigEndian);
+}
+#endif
+
+// Picks the widest kernels the CPU can run
+static utfNarrowFn_t _utfNarrowFn (size_t unitSz)
+{
+#ifdef UTF_HAVE_X86
+    if (__builtin_cpu_supports ("avx2"))
+        return (unitSz == 2) ? _utf16NarrowAvx2 : _utf32NarrowAvx2;
+    return (unitSz == 2) ? _utf16NarrowSse2 : _utf32NarrowSse2;
+#else
+    return (unitSz == 2) ? _utf16NarrowScalar : _utf32NarrowScalar;
+#endif
+}
+
+size_t _confUtf16ToUtf8 (uint8_t* out,
+                         const uint8_t* in,
+                         size_t len,
+                         bool bigEndian)
+{
+    utfNarrowFn_t narrow = _utfNarrowFn (2);
+    size_t numUnits = len / 2;
+    size_t outLen = 0;
+    size_t i = 0;
+    while (i < numUnits)
+    {
+        size_t n = narrow (out + outLen, in + (i * 2), numUnits - i, bigEndian);
+        outLen += n;
+        i += n;
+        if (i == numUnits)
+            break;
+        char32_t c = _utf16Unit (in + (i++ * 2), bigEndian);
+        if (c >= 0xD800 && c <= 0xDFFF)
+        {
+            // Surrogates are only valid as a high one followed by a low one
+            char32_t low = 0;
+            if (i < numUnits)
+                low = _utf16Unit (in + (i * 2), bigEndian);
+            if (c <= 0xDBFF && low >= 0xDC00 && low <= 0xDFFF)
+            {
+                c = 0x10000 + ((c - 0xD800) << 10) + (low - 0xDC00);
+                ++i;
+            }
+            else
+                c = 0xFFFD;
+        }
+        outLen += _confUtf8Encode (c, out + outLen);
+    }
+    // Half a code unit can't be anything
+    if (len & 1)
+        outLen += _confUtf8Encode (0xFFFD, out + outLen);
+    return outLen;
+}
+
+size_t _confUtf32ToUtf8 (uint8_t* out,
+                         const uint8_t* in,
+                         size_t len,
+                         bool bigEndian)
+{
+    utfNarrowFn_t narrow = _utfNarrowFn (4);
+    size_t numUnits = len / 4;
+    size_t outLen = 0;
+    size_t i = 0;
+    while (i < numUnits)
+    {
+        size_t n = narrow (out + outLen, in + (i * 4), numUnits - i, bigEndian);
+        outLen += n;
+        i += n;
+        if (i == numUnits)
+            break;
+        char32_t c = _utf32Unit (in + (i++ * 4), bigEndian);
+        if (c > 0x10FFFF || (c >= 0xD800 && c <= 0xDFFF))
+            c = 0xFFFD;
+        outLen += _confUtf8Encode (c, out + outLen);
+    }
+    if (len & 3)
+        outLen += _confUtf8Encode (0xFFFD, out + outLen);
+    return outLen;
+}
@@ -0,0 +1,167 @@
+/*
+    view.c - contains frozen parse tree views
+    Copyright 2022 The NexNix Project
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+         http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+/// @file view.c
+
+#include "internal.h"
+#include <libconf.h>
+#include <libnex/safemalloc.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Copies str into the string pool of a view
+static inline const char32_t* _viewAddString (char32_t** pool, StringRef32_t* str)
+{
+    const char32_t* src = StrRefGet (str);
+    size_t len = c32len (src) + 1;
+    char32_t* res = *pool;
+    memcpy (res, src, len * sizeof (char32_t));
+    *pool += len;
+    return res;
+}
+
+// Gets the size in bytes of a string in the string pool
+static inline size_t _viewStringSize (StringRef32_t* str)
+{
+    return (c32len (StrRefGet (str)) + 1) * sizeof (char32_t);
+}
+
+LIBCONF_PUBLIC ConfView_t* ConfFreeze (ListHead_t* list)
+{
+    if (!list)
+        return NULL;
+    // Figure out how big everything is
+    size_t numBlocks = 0, numProps = 0, numVals = 0, poolSz = 0;
+    ListEntry_t* blockEnt = ListFront (list);
+    while (blockEnt)
+    {
+        ConfBlock_t* block = ListEntryData (blockEnt);
+        ++numBlocks;
+        poolSz += _viewStringSize (block->blockType);
+        if (block->blockName)
+            poolSz += _viewStringSize (block->blockName);
+        ListEntry_t* propEnt = ListFront (block->props);
+        while (propEnt)
+        {
+            ConfProperty_t* prop = ListEntryData (propEnt);
+            ++numProps;
+            poolSz += _viewStringSize (prop->name);
+            for (int i = 0; i < prop->nextVal; ++i)
+            {
+                ++numVals;
+                if (prop->vals[i].type != DATATYPE_NUMBER)
+                    poolSz += _viewStringSize (prop->vals[i].str);
+            }
+            propEnt = ListIterate (propEnt);
+        }
+        blockEnt = ListIterate (blockEnt);
+    }
+    // Allocate everything at once. The string pool goes last, as everything
+    // before it is pointer aligned
+    size_t sz = sizeof (ConfView_t) + (numBlocks * sizeof (ConfViewBlock_t)) +
+                (numProps * sizeof (ConfViewProp_t)) +
+                (numVals * sizeof (ConfViewVal_t)) + poolSz;
+    ConfView_t* view = _confMalloc (sz);
+    if (!view)
+        return NULL;
+    ConfViewBlock_t* blocks = (ConfViewBlock_t*) (view + 1);
+    ConfViewProp_t* props = (ConfViewProp_t*) (blocks + numBlocks);
+    ConfViewVal_t* vals = (ConfViewVal_t*) (props + numProps);
+    char32_t* pool = (char32_t*) (vals + numVals);
+    view->blocks = blocks;
+    view->numBlocks = numBlocks;
+    view->props = props;
+    view->numProps = numProps;
+    view->vals = vals;
+    view->numVals = numVals;
+    // Now fill it in
+    size_t curProp = 0, curVal = 0;
+    blockEnt = ListFront (list);
+    for (size_t curBlock = 0; blockEnt; ++curBlock)
+    {
+        ConfBlock_t* block = ListEntryData (blockEnt);
+        ConfViewBlock_t* viewBlock = &blocks[curBlock];
+        viewBlock->lineNo = block->lineNo;
+        viewBlock->colNo = block->colNo;
+        viewBlock->blockType = _viewAddString (&pool, block->blockType);
+        viewBlock->blockName = NULL;
+        if (block->blockName)
+            viewBlock->blockName = _viewAddString (&pool, block->blockName);
+        viewBlock->propStart = curProp;
+        ListEntry_t* propEnt = ListFront (block->props);
+        while (propEnt)
+        {
+            ConfProperty_t* prop = ListEntryData (propEnt);
+            ConfViewProp_t* viewProp = &props[curProp];
+            viewProp->lineNo = prop->lineNo;
+            viewProp->colNo = prop->colNo;
+            viewProp->name = _viewAddString (&pool, prop->name);
+            viewProp->valStart = curVal;
+            viewProp->numVals = prop->nextVal;
+            for (int i = 0; i < prop->nextVal; ++i)
+            {
+                ConfViewVal_t* val = &vals[curVal];
+                val->lineNo = prop->vals[i].lineNo;
+                val->colNo = prop->vals[i].colNo;
+                val->type = prop->vals[i].type;
+                val->base = prop->vals[i].base;
+                if (val->type == DATATYPE_NUMBER)
+                    val->numVal = prop->vals[i].numVal;
+                else
+                    val->str = _viewAddString (&pool, prop->vals[i].str);
+                ++curVal;
+            }
+            ++curProp;
+            propEnt = ListIterate (propEnt);
+        }
+        viewBlock->numProps = curProp - viewBlock->propStart;
+        blockEnt = ListIterate (blockEnt);
+    }
+    return view;
+}
+
+LIBCONF_PUBLIC void ConfFreeView (ConfView_t* view)
+{
+    // Everything is in one allocation
+    _confFree (view);
+}
+
+LIBCONF_PUBLIC const ConfViewBlock_t* ConfViewGetBlock (const ConfView_t* view,
+                                                        size_t idx)
+{
+    if (idx >= view->numBlocks)
+        return NULL;
+    return &view->blocks[idx];
+}
+
+LIBCONF_PUBLIC const ConfViewProp_t* ConfViewGetProp (const ConfView_t* view,
+                                                      const ConfViewBlock_t* block,
+                                                      size_t idx)
+{
+    if (idx >= block->numProps)
+        return NULL;
+    return &view->props[block->propStart + idx];
+}
+
+LIBCONF_PUBLIC const ConfViewVal_t* ConfViewGetVal (const ConfView_t* view,
+                                                    const ConfViewProp_t* prop,
+                                                    size_t idx)
+{
+    if (idx >= prop->numVals)
+        return NULL;
+    return &view->vals[prop->valStart + idx];
+}
@@ -0,0 +1,298 @@
+/*
+    write.c - contains parse tree writer
+    Copyright 2022 The NexNix Project
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+         http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+/// @file write.c
+
+#include "internal.h"
+#include <errno.h>
+#include <libconf.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef WIN32
+#include <io.h>
+#define write _write
+#else
+#include <unistd.h>
+#endif
+
+#define WRITE_BUF_SZ  65536    // Size of output buffer
+#define WRITE_MAX_NUM 72       // Longest number, with prefix, in base 2
+
+// Output that is being written
+typedef struct _writer
+{
+    uint8_t* buf;      // Output buffer
+    size_t len;        // Bytes in buf
+    size_t sz;         // Size of buf
+    int fd;            // File to write to. -1 if writing to memory
+    int indent;        // Spaces to indent properties with
+    bool canonical;    // Write numbers in base 10?
+} writer_t;
+
+// Writes out the buffer. Only used when writing to a file
+static bool _writeFlush (writer_t* writer)
+{
+    size_t pos = 0;
+    while (pos < writer->len)
+    {
+        ssize_t res = write (writer->fd, writer->buf + pos, writer->len - pos);
+        if (res < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        pos += (size_t) res;
+    }
+    writer->len = 0;
+    return true;
+}
+
+// Makes room for sz more bytes in the buffer
+static bool _writeReserve (writer_t* writer, size_t sz)
+{
+    if ((writer->sz - writer->len) >= sz)
+        return true;
+    if (writer->fd != -1 && !_writeFlush (writer))
+        return false;
+    if ((writer->sz - writer->len) >= sz)
+        return true;
+    // Memory output grows, and so does file output for very long strings
+    size_t newSz = writer->sz * 2;
+    if (newSz < (writer->len + sz))
+        newSz = writer->len + sz;
+    uint8_t* buf = realloc (writer->buf, newSz);
+    if (!buf)
+        return false;
+    writer->buf = buf;
+    writer->sz = newSz;
+    return true;
+}
+
+// Adds bytes to the output
+static inline bool _writeBytes (writer_t* writer, const void* data, size_t len)
+{
+    if (!_writeReserve (writer, len))
+        return false;
+    memcpy (writer->buf + writer->len, data, len);
+    writer->len += len;
+    return true;
+}
+
+// Adds an identifier to the output
+static bool _writeId (writer_t* writer, const char32_t* id)
+{
+    size_t len = c32len (id);
+    if (!_writeReserve (writer, len * 4))
+        return false;
+    uint8_t* out = writer->buf + writer->len;
+    for (size_t i = 0; i < len; ++i)
+    {
+        if (id[i] < 0x80)
+            *out++ = (uint8_t) id[i];
+        else
+            out += _confUtf8Encode (id[i], out);
+    }
+    writer->len = out - writer->buf;
+    return true;
+}
+
+// Adds a quoted string to the output. Strings with newlines are put in double
+// quotes, where they can be escaped. Everything else is put in single quotes,
+// which never expand variables
+static bool _writeString (writer_t* writer, const char32_t* str)
+{
+    size_t len = c32len (str);
+    char32_t quote = '\'';
+    for (size_t i = 0; i < len; ++i)
+    {
+        if (str[i] == '\n')
+        {
+            quote = '"';
+            break;
+        }
+    }
+    // Escapes take 2 bytes, and only replace characters that take 1
+    if (!_writeReserve (writer, (len * 4) + 2))
+        return false;
+    uint8_t* out = writer->buf + writer->len;
+    *out++ = (uint8_t) quote;
+    for (size_t i = 0; i < len; ++i)
+    {
+        char32_t c = str[i];
+        if (c >= 0x80)
+        {
+            out += _confUtf8Encode (c, out);
+            continue;
+        }
+        if (c == '\\' || c == quote || (quote == '"' && c == '$'))
+            *out++ = '\\';
+        else if (c == '\n')
+        {
+            *out++ = '\\';
+            c = 'n';
+        }
+        *out++ = (uint8_t) c;
+    }
+    *out++ = (uint8_t) quote;
+    writer->len = out - writer->buf;
+    return true;
+}
+
+// Adds a number to the output, in the base it was written in if it has a prefix
+// the lexer knows
+static bool _writeNum (writer_t* writer, int64_t num, int base)
+{
+    char buf[WRITE_MAX_NUM];
+    char* end = buf + WRITE_MAX_NUM;
+    char* start = end;
+    // Only base 10 numbers can be negative
+    if (writer->canonical || num < 0 || (base != 2 && base != 8 && base != 16))
+        base = 10;
+    uint64_t val = (num < 0) ? -(uint64_t) num : (uint64_t) num;
+    do
+    {
+        *--start = "0123456789abcdef"[val % base];
+        val /= base;
+    } while (val);
+    if (num < 0)
+        *--start = '-';
+    else if (base == 16)
+    {
+        *--start = 'x';
+        *--start = '0';
+    }
+    else if (base == 2)
+    {
+        *--start = 'b';
+        *--start = '0';
+    }
+    else if (base == 8 && num)
+        *--start = '0';
+    return _writeBytes (writer, start, end - start);
+}
+
+// Adds a property to the output
+static bool _writeProp (writer_t* writer, ConfProperty_t* prop)
+{
+    if (!_writeReserve (writer, writer->indent))
+        return false;
+    memset (writer->buf + writer->len, ' ', writer->indent);
+    writer->len += writer->indent;
+    if (!_writeId (writer, StrRefGet (prop->name)) || !_writeBytes (writer, ": ", 2))
+        return false;
+    for (int i = 0; i < prop->nextVal; ++i)
+    {
+        ConfPropVal_t* val = &prop->vals[i];
+        if (i && !_writeBytes (writer, ", ", 2))
+            return false;
+        bool res = false;
+        if (val->type == DATATYPE_STRING)
+            res = _writeString (writer, StrRefGet (val->str));
+        else if (val->type == DATATYPE_IDENTIFIER)
+            res = _writeId (writer, StrRefGet (val->id));
+        else
+            res = _writeNum (writer, val->numVal, val->base);
+        if (!res)
+            return false;
+    }
+    return _writeBytes (writer, ";\n", 2);
+}
+
+// Adds a block to the output
+static bool _writeBlock (writer_t* writer, ConfBlock_t* block)
+{
+    if (!_writeId (writer, StrRefGet (block->blockType)))
+        return false;
+    if (block->blockName && (!_writeBytes (writer, " ", 1) ||
+                             !_writeId (writer, StrRefGet (block->blockName))))
+    {
+        return false;
+    }
+    if (!_writeBytes (writer, "\n{\n", 3))
+        return false;
+    ListEntry_t* propEnt = ListFront (block->props);
+    while (propEnt)
+    {
+        if (!_writeProp (writer, ListEntryData (propEnt)))
+            return false;
+        propEnt = ListIterate (propEnt);
+    }
+    return _writeBytes (writer, "}\n", 2);
+}
+
+// Writes a whole tree
+static bool _writeTree (writer_t* writer, ListHead_t* list)
+{
+    ListEntry_t* blockEnt = ListFront (list);
+    while (blockEnt)
+    {
+        // Blocks are separated by a blank line
+        if (blockEnt != ListFront (list) && !_writeBytes (writer, "\n", 1))
+            return false;
+        if (!_writeBlock (writer, ListEntryData (blockEnt)))
+            return false;
+        blockEnt = ListIterate (blockEnt);
+    }
+    return true;
+}
+
+// Sets up a writer
+static bool _writeInit (writer_t* writer, int fd, const ConfWriteOptions_t* opts)
+{
+    memset (writer, 0, sizeof (writer_t));
+    writer->fd = fd;
+    writer->indent = 4;
+    if (opts && !opts->canonical && opts->indent > 0)
+        writer->indent = opts->indent;
+    if (opts)
+        writer->canonical = opts->canonical;
+    writer->buf = malloc (WRITE_BUF_SZ);
+    if (!writer->buf)
+        return false;
+    writer->sz = WRITE_BUF_SZ;
+    return true;
+}
+
+LIBCONF_PUBLIC bool ConfWrite (ListHead_t* list,
+                               int fd,
+                               const ConfWriteOptions_t* opts)
+{
+    writer_t writer;
+    if (!_writeInit (&writer, fd, opts))
+        return false;
+    bool res = _writeTree (&writer, list) && _writeFlush (&writer);
+    free (writer.buf);
+    return res;
+}
+
+LIBCONF_PUBLIC char* ConfWriteBuffer (ListHead_t* list,
+                                      size_t* len,
+                                      const ConfWriteOptions_t* opts)
+{
+    writer_t writer;
+    if (!_writeInit (&writer, -1, opts))
+        return NULL;
+    if (!_writeTree (&writer, list) || !_writeBytes (&writer, "", 1))
+    {
+        free (writer.buf);
+        return NULL;
+    }
+    if (len)
+        *len = writer.len - 1;
+    return (char*) writer.buf;
+}